@@ -8,9 +8,26 @@
 
 #include <limits.h>
 #include <errno.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#if !defined(ANAGRAM_NO_STATS) || !defined(ANAGRAM_NO_THREADS)
+#include <pthread.h>
+#endif
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define ANAGRAM_CLASSIFY_SSE2
+#endif
+#if defined(__SSE4_2__) && defined(__x86_64__)
+#include <nmmintrin.h>
+#define ANAGRAM_CRC32C_SSE42
+#elif defined(__ARM_FEATURE_CRC32) && defined(__aarch64__)
+#include <arm_acle.h>
+#define ANAGRAM_CRC32C_ARM
+#endif
 #include "stream/stream.h"
 #include "anagram.h"
 
@@ -31,14 +48,249 @@
 /* first three records of two bytes each */
 #define ANAGRAM_FILE_MINSIZE 6
 
+/* file header: magic (whose first byte never starts a UTF-8 string, which
+ * tells files written before headers apart), header size, record size,
+ * permutation count, completion flag, records per checksum block, block
+ * count, CRC32C of the records of the last partial block and CRC32C of the
+ * rest of the header; integers are 32-bit little-endian. The CRC32C of every
+ * full block follows. The control records come next, as in files without a
+ * header. */
+#define ANAGRAM_HEADER_MAGIC "\377ANAGHD1"
+#define ANAGRAM_HEADER_FIXED 40
+
+/* records per checksum block of new files */
+#define ANAGRAM_HEADER_BLOCK 4096
+
+/* reads of a header torn by a concurrent rewrite before giving up */
+#define ANAGRAM_REFRESH_ATTEMPTS 8
+
+/* longest pause, in milliseconds, between two polls of "anagram_wait" */
+#define ANAGRAM_WAIT_DELAY 64
+
+/* first line of a shard manifest */
+#define ANAGRAM_MANIFEST_MAGIC "ANAGRAM-MANIFEST 1"
+
+/* longest line (and shard path) accepted in a shard manifest */
+#define ANAGRAM_MANIFEST_LINE 1024
+
+/* records read per block by "anagram_export" */
+#define ANAGRAM_EXPORT_RECORDS 8192
+
+/* digits of the line number written by ANAGRAM_EXPORT_NUMBERED ("%07d") */
+#define ANAGRAM_EXPORT_DIGITS 7
+
+/* sub-anagram file header: magic, k, end of the records (set once the rank
+ * index is being written), record count (set once it is complete) and the
+ * null padded source string; integers are 32-bit little-endian */
+#define ANAGRAM_SUB_MAGIC "ANAGSUB1"
+#define ANAGRAM_SUB_SOURCE 24
+#define ANAGRAM_SUB_HEADER 64
+
+/* bytes scanned (and index bytes written) per block by "sub_index" */
+#define ANAGRAM_SUB_BLOCK 8192
+
+/* compact file header: magic, record size, permutation count, records per
+ * block, block count and offset of the block directory; integers are 32-bit
+ * little-endian. The three control records follow, then the blocks. */
+#define ANAGRAM_COMPACT_MAGIC "ANAGCMP1"
+#define ANAGRAM_COMPACT_HEADER 32
+
+/* records per front-coded block written by "anagram_save_compact" */
+#define ANAGRAM_COMPACT_RECORDS 64
+
+/* most records per block accepted when opening a compact file */
+#define ANAGRAM_COMPACT_RECORDS_MAX 4096
+
+/* position index file header: magic, record count, positions, distinct
+ * elements, chunks and offset of the container directory (32-bit
+ * little-endian), followed by the code of each distinct element */
+#define ANAGRAM_INDEX_MAGIC "ANAGIDX1"
+#define ANAGRAM_INDEX_HEADER 32
+
+/* records covered by each container and the size of a bitmap container */
+#define ANAGRAM_INDEX_CHUNK 65536
+#define ANAGRAM_INDEX_BYTES (ANAGRAM_INDEX_CHUNK / 8)
+
+/* directory size of a bitmap container (others hold their run count) */
+#define ANAGRAM_INDEX_BITMAP 0xFFFFFFFFL
+
+/* bits and words of a container in memory */
+#define ANAGRAM_INDEX_WORD_BITS ((int)(8 * sizeof(unsigned long)))
+#define ANAGRAM_INDEX_WORDS (ANAGRAM_INDEX_CHUNK / ANAGRAM_INDEX_WORD_BITS)
+
+/* most threads of "anagram_classify", and fewest candidates for each */
+#define ANAGRAM_CLASSIFY_THREADS 64
+#define ANAGRAM_CLASSIFY_SLICE 16384
+
+
+/*
+ * Statistics Macros
+ */
+
+
+#ifndef ANAGRAM_NO_STATS
+#define STATS_ADD(a, field, n) ((a)->stats.field += (n))
+#define STATS_MARK(mark) (stats_timing ? stats_now(&(mark)) : (void)0)
+#define STATS_LAP(a, field, mark) \
+	(stats_timing ? (void)((a)->stats.field += stats_lap(&(mark))) : (void)0)
+#else
+#define STATS_ADD(a, field, n) ((void)0)
+#define STATS_MARK(mark) ((void)(mark))
+#define STATS_LAP(a, field, mark) ((void)(mark))
+#endif
+
 
 /*
  * Basic Types
  */
 
 
+struct shard {
+	stream *file;
+	long   origin;  /* size of its header */
+	int    first;
+	int    count;
+};
+
+
+struct header {
+	long          size;      /* bytes ahead of the control records */
+	long          position;  /* offset past the header */
+	long          frontier;  /* end of the records checksummed so far */
+	int           bytes;
+	int           per_block;
+	int           blocks;
+	int           flushed;   /* checksums on disk, -1 before the first flush */
+	unsigned long crc;       /* of the records after the last full block */
+	unsigned char *data;     /* file image of the header */
+};
+
+
+struct compact {
+	stream *file;
+	char   *keys;     /* first record of every block */
+	long   *offsets;  /* of every block, then the end of the last one */
+	char   *raw;      /* encoded block */
+	char   *records;  /* decoded block, fixed-width */
+	int    blocks;
+	int    per_block;
+	int    block;     /* held in "records", -1 if none */
+};
+
+
+struct index_container {
+	int            runs;   /* -1 for a bitmap */
+	unsigned short *pairs; /* first and last record of each run */
+	unsigned long  *bits;
+};
+
+
+struct anagram_index {
+	int    records;
+	int    positions;
+	int    distinct;
+	int    chunks;
+	long   values[ANAGRAM_ELEMENT_LIMIT];
+	struct index_container *containers; /* by position, element, chunk */
+	unsigned short *pairs;
+	unsigned long  *bits;
+};
+
+
+struct index_build {
+	stream         *file;
+	long           offset;
+	unsigned char  *directory;
+	unsigned char  *output;
+	unsigned short *firsts;  /* runs of the current chunk, by position */
+	unsigned short *lasts;
+	unsigned char  *kinds;
+	int            runs[ANAGRAM_ELEMENT_LIMIT];
+};
+
+
+struct gray_state {
+	long values[ANAGRAM_ELEMENT_LIMIT];
+	int  counts[ANAGRAM_ELEMENT_LIMIT];
+	int  distinct;
+	int  lengths[ANAGRAM_ELEMENT_LIMIT];  /* elements up to each value */
+	long sizes[ANAGRAM_ELEMENT_LIMIT];    /* spreads of each value */
+	long digits[ANAGRAM_ELEMENT_LIMIT];   /* current spread, in list order */
+	int  odd[ANAGRAM_ELEMENT_LIMIT];      /* spreads listed reflected */
+	char bits[ANAGRAM_ELEMENT_LIMIT][ANAGRAM_ELEMENT_LIMIT];
+	long words[ANAGRAM_ELEMENT_LIMIT][ANAGRAM_ELEMENT_LIMIT];
+};
+
+
+/* source multiset of "anagram_classify", shared by its threads */
+struct classify_source {
+	long values[ANAGRAM_ELEMENT_LIMIT];
+	int  counts[ANAGRAM_ELEMENT_LIMIT];
+	int  distinct;
+	long sorted[ANAGRAM_ELEMENT_LIMIT];
+	int  length;
+	int  bytes;
+	int  ascii;  /* one byte per element */
+	long total;
+	int  gray;
+};
+
+
+struct classify_slice {
+#ifndef ANAGRAM_NO_THREADS
+	pthread_t thread;
+#endif
+	const struct classify_source *source;
+	const char *const *strings;
+	char   *results;
+	int    *ranks;
+	int    from;
+	int    to;
+	int    members;
+};
+
+
+struct top_entry {
+	double score;
+	long   rank;
+};
+
+
+struct top_search {
+	const double *bigram;    /* distinct x distinct, or NULL */
+	const double *position;  /* distinct x length, or NULL */
+	int    counts[ANAGRAM_ELEMENT_LIMIT];  /* elements not placed yet */
+	int    distinct;
+	int    length;
+	int    k;
+	int    found;
+	struct top_entry *heap;  /* best found so far, worst on top */
+};
+
+
 struct anagram {
 	stream *file;
+	char   *arena;    /* in-memory backend (file is NULL) */
+	long   capacity;  /* negative if arena is borrowed (read-only) */
+	long   size;
+	long   position;
+	void   (*release)(void *);
+	void   *context;
+	struct anagram *shared; /* records borrowed from another object */
+	struct shard *shards;   /* manifest of shard files */
+	int    shard_count;
+	struct compact *compact; /* front-coded blocks */
+	struct header *header;   /* checksummed file header, if any */
+	char   *path;             /* of a file opened for reading its progress */
+	int    watch;             /* unbuffered read-only descriptor of "path", or -1 */
+	int    readonly;          /* file opened without write access */
+	int    writing;           /* records written through this object */
+	int    shard;             /* file holds ranks first.. only */
+	int    first;
+	int    constraint;        /* 1 + maximum fixed points, 0 if none */
+	int    lazy;              /* look-ahead of reads past the frontier */
+	int    publish;           /* records between published counts */
+	int    gray;              /* list in minimal-change order */
 	int    bytes;
 	int    elements;
 	int    permutations;
@@ -46,21 +298,153 @@ struct anagram {
 	int    base;
 	int    count;
 	int    references;
+#ifndef ANAGRAM_NO_STATS
+	anagram_stats stats;
+#endif
 	char   source[ANAGRAM_SIZE_LIMIT];
 	char   term[ANAGRAM_SIZE_LIMIT];
 	char   buffer[ANAGRAM_SIZE_LIMIT];
 };
 
 
+struct anagram_sub {
+	struct anagram io;        /* backing file, through the io_* layer */
+	int    k;         /* shortest arrangement */
+	int    elements;
+	int    count;
+	int    complete;  /* rank index written */
+	long   end;       /* offset past the last record */
+	char   source[ANAGRAM_SIZE_LIMIT];
+	char   buffer[ANAGRAM_SIZE_LIMIT];
+};
+
+
+struct anagram_cursor {
+	long elements[ANAGRAM_ELEMENT_LIMIT];  /* permutation of rank "rank" */
+	int  length;
+	long rank;
+	long total;
+	char buffer[ANAGRAM_SIZE_LIMIT];
+};
+
+
+#ifndef ANAGRAM_NO_STATS
+typedef struct timespec stats_mark;
+#else
+typedef int stats_mark;
+#endif
+
+
+/*
+ * Static Data
+ */
+
+
+#ifndef ANAGRAM_NO_STATS
+static anagram_stats stats_global;
+static pthread_mutex_t stats_mutex = PTHREAD_MUTEX_INITIALIZER;
+static volatile int stats_timing = 0;
+#endif
+
+#if !defined(ANAGRAM_CRC32C_SSE42) && !defined(ANAGRAM_CRC32C_ARM)
+static unsigned long crc32c_table[8][256];
+static volatile int crc32c_ready = 0;
+#endif
+
+
 /*
  * Static Function Interface
  */
 
 
+static anagram_ref load(struct anagram *a);
+static int load_kind(struct anagram *a);
+static int io_seek(struct anagram *a, long offset);
+static long io_read(struct anagram *a, char *buffer, long size);
+static int io_locate(struct anagram *a, long offset);
+static long io_fetch(struct anagram *a, char *buffer, long size);
+static long io_write(struct anagram *a, const char *buffer, long size);
+static long io_end(struct anagram *a);
+static int io_sync(struct anagram *a);
+static int io_publish(struct anagram *a, int count);
+static int publish(struct anagram *a, int count);
+static void io_close(struct anagram *a);
+static int arena_reserve(struct anagram *a, long size);
+static long shards_read(struct anagram *a, char *buffer, long size);
+static int compare_shards(const void *a, const void *b);
+static int index_flush(struct index_build *b, int positions, int distinct,
+	int chunk, int chunks);
+static void index_or(const struct index_container *c, unsigned long *mask);
+static int lazy_extend(struct anagram *a, int index);
+static int lazy_stop(void *argument, int count, const char *anagram);
+static long compact_read(struct anagram *a, char *buffer, long size);
+static int compact_decode(struct anagram *a, int block);
+static int write_all(int fd, const char *buffer, long size);
+static struct header *header_create(int bytes, int per_block, long blocks);
+static int header_load(struct anagram *a);
+static struct header *header_parse(const unsigned char *fixed);
+static int header_check(struct header *h);
+static void header_apply(struct anagram *a, struct header *h);
+static void header_extend(struct header *h, const char *buffer, long size);
+static int header_full(struct header *h);
+static void header_encode(struct header *h, int count, int complete, unsigned char *fixed);
+static int header_flush(struct anagram *a, int count);
+static void header_release(struct header *h);
+static unsigned long crc32c(unsigned long crc, const char *buffer, long size);
+#if !defined(ANAGRAM_CRC32C_SSE42) && !defined(ANAGRAM_CRC32C_ARM)
+static void crc32c_init(void);
+#endif
+#ifndef ANAGRAM_NO_STATS
+static void stats_now(stats_mark *mark);
+static double stats_lap(stats_mark *mark);
+static void stats_merge(anagram_stats *target, const anagram_stats *source);
+#endif
 static void utf8_encode(char *string, int *offset, long code);
 static long utf8_decode(const char *string, int *offset);
 static int utf8_strlen(const char *string, int *size);
+static int utf8_elements(const char *string, long *elements);
 static void sort(long *elements, int length);
+static long multinomial(const long *elements, int length);
+static int histogram(const long *elements, int length, long *values, int *counts);
+static int unrank(const long *values, const int *counts, int distinct, int length,
+	long total, long rank, long *elements);
+static double constrained_count(const long *values, const int *available, int distinct,
+	const long *source, int from, int length, int budget);
+static int constrained_fill(const long *values, int *available, int distinct,
+	const long *source, long *elements, int from, int length, int budget);
+static int constrained_next(const long *values, int distinct, const long *source,
+	long *elements, int length, int fixed);
+static double sub_extensions(const int *available, int distinct, int depth, int k);
+static int sub_next(int *available, int distinct, int *stack, int *depth, int length);
+static int sub_last(struct anagram_sub *s, long limit);
+static int sub_index(struct anagram_sub *s);
+static void put32(unsigned char *buffer, long value);
+static long get32(const unsigned char *buffer);
+static long binomial(int n, int k);
+static long gray_rank(const long *values, const int *counts, int distinct, int length,
+	const long *elements);
+static void gray_unrank(const long *values, const int *counts, int distinct, int length,
+	long rank, long *elements);
+static void gray_start(struct gray_state *g, const long *values, const int *counts,
+	int distinct, long rank);
+static int gray_next(struct gray_state *g);
+static void gray_spread(struct gray_state *g, int v);
+static long gray_comb_rank(const char *bits, int s, int t);
+static void gray_comb_unrank(char *bits, int s, int t, long rank);
+static unsigned long random_next(unsigned long *state);
+static long random_below(unsigned long *state, long bound);
+static int compare_ints(const void *a, const void *b);
+static long lex_rank(const long *values, const int *counts, int distinct, int length,
+	long total, const long *elements);
+static void *classify_run(void *argument);
+static int classify_one(const struct classify_source *c, const char *string, long *rank);
+static int classify_ascii(const struct classify_source *c, const char *string);
+static void top_visit(struct top_search *t, int depth, int last, double score,
+	long rank, long total);
+static double top_bound(struct top_search *t, int depth, int last);
+static void top_offer(struct top_search *t, double score, long rank);
+static int top_worse(const struct top_entry *a, const struct top_entry *b);
+static int compare_top(const void *a, const void *b);
 int permute(long *elements, int length);
 
 
@@ -75,15 +459,35 @@ int anagram_element_limit(void)
 }
 
 
+int anagram_permutation_total(const char *string)
+{
+
+	long elements[ANAGRAM_ELEMENT_LIMIT];
+	int length;
+
+	if (string == NULL || (length = utf8_elements(string, elements)) < 2) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	sort(elements, length);
+
+	return (int)multinomial(elements, length);
+
+}
+
+
 anagram_ref anagram_create(const char *path, const char *string)
 {
 
 	struct anagram a, *ap;
+	long elements[ANAGRAM_ELEMENT_LIMIT], total;
 	int i, errn;
 
 	/* initialize local storage */
 	memset(&a, 0, sizeof(struct anagram));
 	a.file = NULL;
+	a.header = NULL;
 
 	/* calculate sizes */
 	a.elements = utf8_strlen(string, &a.bytes);
@@ -96,6 +500,17 @@ anagram_ref anagram_create(const char *path, const char *string)
 	/* copy source string */
 	memcpy(a.source, string, a.bytes);
 
+	/* reserve a checksum for every block of the complete list */
+	utf8_elements(a.source, elements);
+	sort(elements, a.elements);
+	total = multinomial(elements, a.elements);
+	a.header = header_create(a.bytes, ANAGRAM_HEADER_BLOCK,
+		(total + ANAGRAM_HEADER_BLOCK - 1) / ANAGRAM_HEADER_BLOCK);
+	if (a.header == NULL) {
+		errn = ENOMEM;
+		goto failure;
+	}
+
 	/* create file */
 	a.file = stream_open(path, "w+");
 	if (a.file == NULL) {
@@ -103,9 +518,15 @@ anagram_ref anagram_create(const char *path, const char *string)
 		goto failure;
 	}
 
+	/* write header */
+	if (!header_flush(&a, 0)) {
+		errn = errno;
+		goto failure;
+	}
+
 	/* write first record */
 	memcpy(a.buffer, a.source, a.bytes);
-	if (stream_write(a.file, a.buffer, a.bytes) != a.bytes) {
+	if (io_write(&a, a.buffer, a.bytes) != a.bytes) {
 		errn = errno;
 		goto failure;
 	}
@@ -113,7 +534,7 @@ anagram_ref anagram_create(const char *path, const char *string)
 	/* write second and third records */
 	memset(a.buffer, 0, a.bytes);
 	for (i = 0; i < 2; i++) {
-		if (stream_write(a.file, a.buffer, a.bytes) != a.bytes) {
+		if (io_write(&a, a.buffer, a.bytes) != a.bytes) {
 			errn = errno;
 			goto failure;
 		}
@@ -140,41 +561,27 @@ anagram_ref anagram_create(const char *path, const char *string)
 			stream_close(a.file);
 			unlink(path);
 		}
+		header_release(a.header);
 		errno = errn;
 		return NULL;
 
 }
 
 
-anagram_ref anagram_open(const char *path)
+anagram_ref anagram_create_memory(const char *string)
 {
 
 	struct anagram a, *ap;
-	ldiv_t division;
-	long size;
+	long elements[ANAGRAM_ELEMENT_LIMIT];
 	int i, errn;
 
 	/* initialize local storage */
 	memset(&a, 0, sizeof(struct anagram));
 	a.file = NULL;
-
-	/* open file */
-	a.file = stream_open(path, "r+");
-	if (a.file == NULL) {
-		errn = errno;
-		goto failure;
-	}
-
-	/* populate buffer with file data
-	 * reading ANAGRAM_SIZE_LIMIT - 1 ensures the buffer is null-byte terminated */
-	size = stream_read(a.file, a.buffer, ANAGRAM_SIZE_LIMIT - 1);
-	if (size < ANAGRAM_FILE_MINSIZE) {
-		errn = size < 0 ? errno : EBADF;
-		goto failure;
-	}
+	a.arena = NULL;
 
 	/* calculate sizes */
-	a.elements = utf8_strlen(a.buffer, &a.bytes);
+	a.elements = utf8_strlen(string, &a.bytes);
 	if (a.elements < 2 || a.elements > ANAGRAM_ELEMENT_LIMIT
 		|| a.bytes < 2 || a.bytes > ANAGRAM_SIZE_LIMIT - 1) {
 		errn = EINVAL;
@@ -182,61 +589,24 @@ anagram_ref anagram_open(const char *path)
 	}
 
 	/* copy source string */
-	memcpy(a.source, a.buffer, a.bytes);
-
-	/* get file size */
-	size = stream_end(a.file);
-
-	/* check record count */
-	division = ldiv(size, a.bytes);
-	if (division.rem != 0 || division.quot < 3 || division.quot > INT_MAX) {
-		errn = EBADF;
-		goto failure;
-	}
-
-	/* save current permutation count
-	 * total of records minus the first three control records */
-	a.permutations = (int)division.quot - 3;
-
-	/* point to second record */
-	if (stream_seek(a.file, (long)a.bytes) < 0) {
-		errn = errno;
-		goto failure;
-	}
-
-	/* read second record to buffer */
-	memset(a.buffer, 0, ANAGRAM_SIZE_LIMIT);
-	if ((size = stream_read(a.file, a.buffer, a.bytes)) != a.bytes) {
-		errn = size < 0 ? errno : EBADF;
-		goto failure;
-	}
-
-	/* check if second record is zero filled */
-	for (i = 0; i < a.bytes; i++) {
-		if (*(a.buffer + i) != '\0') {
-			errn = EBADF;
-			goto failure;
-		}
-	}
+	memcpy(a.source, string, a.bytes);
 
-	/* read third record to buffer */
-	memset(a.buffer, 0, ANAGRAM_SIZE_LIMIT);
-	if ((size = stream_read(a.file, a.buffer, a.bytes)) != a.bytes) {
-		errn = size < 0 ? errno : EBADF;
+	/* size arena for the control records and every distinct permutation */
+	utf8_elements(a.source, elements);
+	sort(elements, a.elements);
+	if (!arena_reserve(&a, (multinomial(elements, a.elements) + 3) * a.bytes)) {
+		errn = ENOMEM;
 		goto failure;
 	}
 
-	/* check if third record is zero filled (improve this?) */
-	for (i = 0; i < a.bytes; i++) {
-		if (*(a.buffer + i) != '\0') {
-			a.complete = 1;
-			break;
-		}
-	}
+	/* write first record */
+	memcpy(a.buffer, a.source, a.bytes);
+	io_write(&a, a.buffer, a.bytes);
 
-	/* set result */
-	a.base = 0;
-	a.count = a.permutations;
+	/* write second and third records */
+	memset(a.buffer, 0, a.bytes);
+	for (i = 0; i < 2; i++)
+		io_write(&a, a.buffer, a.bytes);
 
 	/* try to allocate space from heap */
 	ap = malloc(sizeof(struct anagram));
@@ -251,556 +621,5581 @@ anagram_ref anagram_open(const char *path)
 	/* copy local data to heap */
 	memcpy(ap, &a, sizeof(struct anagram));
 
-	/* success! */
+	/* success */
 	return ap;
 
 	failure:
-		if (a.file != NULL)
-			stream_close(a.file);
+		free(a.arena);
 		errno = errn;
 		return NULL;
 
 }
 
 
-anagram_ref anagram_retain(anagram_ref a)
+anagram_ref anagram_open(const char *path)
 {
-	if (a != NULL)
-		a->references++;
-	return a;
-}
 
+	struct anagram a;
+	anagram_ref ap;
+	int errn;
+
+	/* initialize local storage */
+	memset(&a, 0, sizeof(struct anagram));
+	a.file = NULL;
+	a.watch = -1;
+
+	/* keep the path for "anagram_refresh" */
+	a.path = malloc(strlen(path) + 1);
+	if (a.path == NULL)
+		return NULL;
+	strcpy(a.path, path);
+
+	/* open file; one that cannot be written can still be read and followed */
+	a.file = stream_open(path, "r+");
+	if (a.file == NULL && (errno == EACCES || errno == EROFS)) {
+		a.file = stream_open(path, "r");
+		a.readonly = 1;
+	}
+	if (a.file == NULL) {
+		errn = errno;
+		free(a.path);
+		errno = errn;
+		return NULL;
+	}
+
+	/* read control records */
+	ap = load(&a);
+	if (ap == NULL) {
+		errn = errno;
+		stream_close(a.file);
+		free(a.path);
+		errno = errn;
+	}
+
+	return ap;
 
-const char *anagram_source_string(anagram_ref a)
-{
-	if (a != NULL)
-		return a->source;
-	return NULL;
 }
 
 
-int anagram_element_count(anagram_ref a)
+anagram_ref anagram_open_buffer(const void *data, long size,
+	void (*release)(void *), void *context)
 {
-	if (a != NULL)
-		return a->elements;
-	return -1;
+
+	struct anagram a;
+
+	if (data == NULL) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	/* initialize local storage; a negative capacity marks the arena as
+	 * borrowed and read-only */
+	memset(&a, 0, sizeof(struct anagram));
+	a.file = NULL;
+	a.arena = (char *)data;
+	a.size = size;
+	a.capacity = -1;
+	a.release = release;
+	a.context = context;
+
+	return load(&a);
+
 }
 
 
-int anagram_permutation_count(anagram_ref a)
+anagram_ref anagram_retain(anagram_ref a)
 {
 	if (a != NULL)
-		return a->permutations;
-	return -1;
+		a->references++;
+	return a;
 }
 
 
-int anagram_generate(anagram_ref a, void *argument, anagram_callback_f callback)
+anagram_ref anagram_open_manifest(const char *path)
 {
 
-	stream *file;
-	long size, element, elements[ANAGRAM_ELEMENT_LIMIT];
-	int index, length, offset;
-	int i, errn, canceled;
-	char buffer[ANAGRAM_SIZE_LIMIT];
-	const char *string;
-
-	if (a == NULL) {
-		errn = EINVAL;
-		goto failure;
-	}
+	FILE *fp;
+	struct anagram a, *ap, *sp;
+	struct shard *shards;
+	char line[ANAGRAM_MANIFEST_LINE], name[ANAGRAM_MANIFEST_LINE * 2];
+	const char *slash;
+	long elements[ANAGRAM_ELEMENT_LIMIT], total, next;
+	int first, last, count, length, i, errn;
 
-	if (a->complete)
-		goto success;
+	/* initialize local storage */
+	memset(&a, 0, sizeof(struct anagram));
+	a.file = NULL;
+	a.arena = NULL;
+	a.shards = NULL;
+	sp = NULL;
 
-	/* initialize locals */
-	file  = a->file;
-	index = a->permutations;
+	fp = fopen(path, "r");
+	if (fp == NULL)
+		return NULL;
 
-	/* select source string or last generated permutation */
-	if (index < 1) {
-		index = 0;
-		string = a->source;
+	/* header and source lines */
+	if (fgets(line, sizeof(line), fp) == NULL
+		|| strncmp(line, ANAGRAM_MANIFEST_MAGIC "\n", sizeof(line)) != 0
+		|| fgets(line, sizeof(line), fp) == NULL
+		|| strncmp(line, "source ", 7) != 0) {
+		errn = EBADF;
+		goto failure;
 	}
-	else {
-		if (stream_seek(file, ((long)index + 2) * a->bytes) < 0) {
+	line[strcspn(line, "\n")] = '\0';
+	a.elements = utf8_strlen(line + 7, &a.bytes);
+	if (a.elements < 2 || a.elements > ANAGRAM_ELEMENT_LIMIT
+		|| a.bytes < 2 || a.bytes > ANAGRAM_SIZE_LIMIT - 1) {
+		errn = EBADF;
+		goto failure;
+	}
+	memcpy(a.source, line + 7, a.bytes);
+
+	/* shard paths are relative to the manifest directory */
+	slash = strrchr(path, '/');
+	length = slash != NULL ? (int)(slash - path) + 1 : 0;
+
+	/* open each shard and keep its stream */
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		line[strcspn(line, "\n")] = '\0';
+		if (line[0] == '\0')
+			continue;
+		if (sscanf(line, "shard %d %d %n", &first, &last, &i) != 2 || i == 0
+			|| first < 0 || last <= first) {
+			errn = EBADF;
+			goto failure;
+		}
+		if (line[i] == '/' || length == 0)
+			strcpy(name, line + i);
+		else {
+			memcpy(name, path, length);
+			strcpy(name + length, line + i);
+		}
+		sp = anagram_open(name);
+		if (sp == NULL) {
 			errn = errno;
 			goto failure;
 		}
-		if ((size = stream_read(file, a->buffer, a->bytes)) != a->bytes) {
-			errn = size < 0 ? errno : EBADF;
+		if (strcmp(sp->source, a.source) != 0 || sp->first != first || sp->constraint || sp->gray
+			|| sp->permutations > last - first
+			|| (sp->complete && sp->permutations != last - first)) {
+			errn = EBADF;
 			goto failure;
 		}
-		a->buffer[a->bytes] = '\0';
-		string = a->buffer;
-	}
-
-	/* populate array of elements */
-	length = 0, offset = 0;
-	while ((element = utf8_decode(string, &offset)) != 0) {
-		if (element < 0) {
-			errn = EILSEQ;
-			goto failure;
+		if (a.shard_count % 16 == 0) {
+			shards = realloc(a.shards, sizeof(struct shard) * (a.shard_count + 16));
+			if (shards == NULL) {
+				errn = ENOMEM;
+				goto failure;
+			}
+			a.shards = shards;
 		}
-		elements[length++] = element;
+		/* a negative count marks a shard still being generated */
+		a.shards[a.shard_count].file = sp->file;
+		a.shards[a.shard_count].origin = sp->header != NULL ? sp->header->size : 0;
+		a.shards[a.shard_count].first = first;
+		a.shards[a.shard_count].count = sp->complete ? sp->permutations : -1 - sp->permutations;
+		a.shard_count++;
+		sp->file = NULL;
+		anagram_release(sp);
+		sp = NULL;
 	}
 
-	/* check internal values */
-	if (length != a->elements || offset != a->bytes) {
-		errn = EBADF;
-		goto failure;
-	}
+	fclose(fp);
+	fp = NULL;
 
-	/* set file offset */
-	if (stream_seek(file, ((long)index + 3) * offset) < 0) {
-		errn = errno;
+	if (a.shard_count == 0) {
+		errn = EBADF;
 		goto failure;
 	}
 
-	/* clear buffer */
-	memset(buffer, 0, ANAGRAM_SIZE_LIMIT);
-
-	/* sort elements if first permutation and write it to first record */
-	if (index == 0) {
-		sort(elements, length);
-		for (i = 0, offset = 0; i < length; i++)
-			utf8_encode(buffer, &offset, elements[i]);
-		if (stream_write(file, buffer, offset) != offset) {
-			errn = errno;
-			goto failure;
-		}
-		a->permutations = ++index;
-	}
-
-	/* clear canceled flag */
-	canceled = 0;
-
-	/* perform permutations */
-	while (permute(elements, length) != 0) {
-		for (i = 0, offset = 0; i < length; i++)
-			utf8_encode(buffer, &offset, elements[i]);
-		if (stream_write(file, buffer, offset) != offset) {
-			errn = errno;
-			goto failure;
+	/* logical list: contiguous shards from rank 0, up to the first one
+	 * that is incomplete */
+	qsort(a.shards, a.shard_count, sizeof(struct shard), compare_shards);
+	utf8_elements(a.source, elements);
+	sort(elements, a.elements);
+	total = multinomial(elements, a.elements);
+	next = 0;
+	a.complete = 1;
+	for (i = 0; i < a.shard_count; i++) {
+		if (a.shards[i].first != next) {
+			if (a.shards[i].first < next) {
+				errn = EBADF;
+				goto failure;
+			}
+			a.complete = 0;
+			break;
 		}
-		index++; /* point to next permutation */
-		if (callback != NULL && !callback(argument, index, buffer)) {
-			canceled = 1;
+		count = a.shards[i].count;
+		next += count < 0 ? -1 - count : count;
+		if (count < 0) {
+			a.complete = 0;
 			break;
 		}
 	}
-
-	/* set permutation count */
-	a->permutations = index;
-
-	/* update result set */
-	a->base = 0;
-	a->count = index;
-	a->term[0] = '\0';
-
-	if (canceled == 0) {
-		if (stream_seek(file, (long)offset * 2) < 0) {
-			errn = errno;
-			goto failure;
-		}
-		if (stream_write(file, buffer, offset) != offset) {
-			errn = errno;
-			goto failure;
-		}
-		a->complete = 1;
+	if (next != total)
+		a.complete = 0;
+	a.permutations = (int)next;
+	for (i = 0; i < a.shard_count; i++)
+		if (a.shards[i].count < 0)
+			a.shards[i].count = -1 - a.shards[i].count;
+
+	/* synthesize control records */
+	a.arena = calloc(3, a.bytes);
+	if (a.arena == NULL) {
+		errn = ENOMEM;
+		goto failure;
 	}
+	memcpy(a.arena, a.source, a.bytes);
+	if (a.complete)
+		memcpy(a.arena + 2 * a.bytes, a.source, a.bytes);
+	a.size = (3L + a.permutations) * a.bytes;
 
-	/* flush changes to file */
-	if (stream_sync(file) != 0) {
+	/* set result */
+	a.base = 0;
+	a.count = a.permutations;
+
+	/* try to allocate space from heap */
+	ap = malloc(sizeof(struct anagram));
+	if (ap == NULL) {
 		errn = errno;
 		goto failure;
 	}
 
-	success:
-		return 1;
+	/* initialize reference count */
+	a.references = 1;
+
+	/* copy local data to heap */
+	memcpy(ap, &a, sizeof(struct anagram));
+
+	return ap;
 
 	failure:
+		if (fp != NULL)
+			fclose(fp);
+		if (sp != NULL)
+			anagram_release(sp);
+		io_close(&a);
 		errno = errn;
-		return 0;
+		return NULL;
 
 }
 
 
-int anagram_test(anagram_ref a, void *arg, anagram_callback_f cb)
+int anagram_manifest_add(const char *path, anagram_ref shard, const char *shard_path)
 {
 
-	stream *file;
-	long size;
-	register int cnt, i, j;
-	int len, errn;
-	char bufa[ANAGRAM_SIZE_LIMIT], bufb[ANAGRAM_SIZE_LIMIT];
+	FILE *fp;
+	char line[ANAGRAM_MANIFEST_LINE];
 
-	if (a == NULL) {
-		errn = EINVAL;
-		goto failure;
+	if (path == NULL || shard == NULL || shard_path == NULL
+		|| shard->shards != NULL || shard->compact != NULL
+		|| strchr(shard_path, '\n') != NULL) {
+		errno = EINVAL;
+		return 0;
 	}
 
-	if (a->permutations < 2 || !a->complete) {
-		errn = EAGAIN;
-		goto failure;
+	if (!shard->complete) {
+		errno = EAGAIN;
+		return 0;
 	}
 
-	/* initialize locals */
-	memset(bufa, 0, ANAGRAM_SIZE_LIMIT);
-	memset(bufb, 0, ANAGRAM_SIZE_LIMIT);
-	file = a->file;
-	len = a->bytes;
-
-	/* main comparison loop */
-	for (i = 0, cnt = a->permutations; i < cnt - 1; i++) {
-		if (stream_seek(file, ((long)i + 3) * len) < 0) {
-			errn = errno;
-			goto failure;
-		}
-		if ((size = stream_read(file, bufa, len)) != len) {
-			errn = size < 0 ? errno : EBADF;
-			goto failure;
-		}
-		for (j = i + 1; j < cnt; j++) {
-			if ((size = stream_read(file, bufb, len)) != len) {
-				errn = size < 0 ? errno : EBADF;
-				goto failure;
-			}
-			if (strcmp(bufa, bufb) == 0) {
-				errn = EILSEQ;
-				goto failure;
-			}
-			if (cb != NULL && !cb(arg, j, bufb)) {
-				errn = ECANCELED;
-				goto failure;
-			}
+	/* an existing manifest must describe the same source */
+	fp = fopen(path, "r");
+	if (fp != NULL) {
+		if (fgets(line, sizeof(line), fp) == NULL
+			|| strcmp(line, ANAGRAM_MANIFEST_MAGIC "\n") != 0
+			|| fgets(line, sizeof(line), fp) == NULL
+			|| strncmp(line, "source ", 7) != 0
+			|| strncmp(line + 7, shard->source, strlen(shard->source)) != 0
+			|| line[7 + strlen(shard->source)] != '\n') {
+			fclose(fp);
+			errno = EINVAL;
+			return 0;
 		}
+		fclose(fp);
+		fp = fopen(path, "a");
+	}
+	else if (errno == ENOENT) {
+		fp = fopen(path, "w");
+		if (fp != NULL)
+			fprintf(fp, "%s\nsource %s\n", ANAGRAM_MANIFEST_MAGIC, shard->source);
 	}
 
-	return 1;
+	if (fp == NULL)
+		return 0;
 
-	failure:
-		errno = errn;
+	fprintf(fp, "shard %d %d %s\n", shard->first, shard->first + shard->permutations, shard_path);
+
+	if (fclose(fp) != 0)
 		return 0;
 
+	return 1;
+
 }
 
 
-const char *anagram_string(anagram_ref a, int index)
+anagram_ref anagram_alias(anagram_ref shared, const char *string)
 {
 
-	long size;
-	int errn;
+	struct anagram a, *ap;
+	char key[ANAGRAM_SIZE_LIMIT], canonical[ANAGRAM_SIZE_LIMIT];
 
-	if (a == NULL) {
-		errn = EINVAL;
-		goto failure;
+	if (shared == NULL || string == NULL) {
+		errno = EINVAL;
+		return NULL;
 	}
 
-	if (index < 0 || index >= a->count) {
-		errn = ERANGE;
-		goto failure;
+	if (!shared->complete) {
+		errno = EAGAIN;
+		return NULL;
 	}
 
-	if (stream_seek(a->file, ((long)index + (long)a->base + 3L) * (long)a->bytes) < 0) {
-		errn = errno;
-		goto failure;
+	/* fixed points are relative to the positions of the shared source */
+	if (shared->constraint) {
+		errno = EINVAL;
+		return NULL;
 	}
 
-	if ((size = stream_read(a->file, a->buffer, a->bytes)) != a->bytes) {
-		errn = size < 0 ? errno : EBADF;
-		goto failure;
+	/* both sources must hold the same multiset of elements */
+	if (anagram_canonical_string(string, key, ANAGRAM_SIZE_LIMIT) < 0
+		|| anagram_canonical_string(shared->source, canonical, ANAGRAM_SIZE_LIMIT) < 0
+		|| strcmp(key, canonical) != 0) {
+		errno = EINVAL;
+		return NULL;
 	}
 
-	*(a->buffer + a->bytes) = '\0';
-
-	return a->buffer;
+	/* initialize local storage from the shared object */
+	memset(&a, 0, sizeof(struct anagram));
+	a.file = NULL;
+	a.arena = NULL;
+	a.shared = shared;
+	a.bytes = shared->bytes;
+	a.elements = shared->elements;
+	a.permutations = shared->permutations;
+	a.gray = shared->gray;
+	a.complete = 1;
+	a.base = 0;
+	a.count = a.permutations;
+	strcpy(a.source, string);
 
-	failure:
-		errno = errn;
+	/* try to allocate space from heap */
+	ap = malloc(sizeof(struct anagram));
+	if (ap == NULL)
 		return NULL;
 
-}
+	/* initialize reference count */
+	a.references = 1;
 
+	/* copy local data to heap */
+	memcpy(ap, &a, sizeof(struct anagram));
+	anagram_retain(shared);
+
+	return ap;
 
-int anagram_is_complete(anagram_ref a)
-{
-	if (a != NULL)
-		return a->complete;
-	return 0;
 }
 
 
-int anagram_filter(anagram_ref a, const char *s)
+int anagram_canonical_string(const char *string, char *buffer, int size)
 {
 
-	stream *file;
-	long size;
-	int base, count, length, permutations;
-	int i, errn;
-	char term[ANAGRAM_SIZE_LIMIT], buf[ANAGRAM_SIZE_LIMIT];
+	long elements[ANAGRAM_ELEMENT_LIMIT];
+	int length, offset, i;
+	char canonical[ANAGRAM_SIZE_LIMIT];
 
-	/* check for null pointers */
-	if (a == NULL) {
-		errn = EINVAL;
-		goto failure;
+	if (string == NULL || buffer == NULL
+		|| (length = utf8_elements(string, elements)) < 1) {
+		errno = EINVAL;
+		return -1;
 	}
 
-	/* if term is a null pointer or an empty string, reset result set */
-	if (s == NULL || *s == '\0') {
-		base = 0;
-		count = a->permutations;
-		term[0] = '\0';
-		goto success;
-	}
+	sort(elements, length);
+	for (i = 0, offset = 0; i < length; i++)
+		utf8_encode(canonical, &offset, elements[i]);
 
-	/* check filter string */
-	length = utf8_strlen(s, NULL);
-	if (length < 1 || length > a->elements) {
-		base = 0;
-		count = 0;
-		term[0] = '\0';
-		goto success;
+	if (offset >= size) {
+		errno = ERANGE;
+		return -1;
 	}
 
-	/* initialize local storage */
-	file = a->file;
-	length = a->bytes;
-	permutations = a->permutations;
-	base = 0;
-	count = 0;
-	strcpy(term, s);
-	memset(buf, 0, ANAGRAM_SIZE_LIMIT);
+	memcpy(buffer, canonical, offset);
+	buffer[offset] = '\0';
 
-	/* set stream pointer to first record */
-	if (stream_seek(file, (long)length * 3) < 0) {
-		errn = errno;
-		goto failure;
+	return offset;
+
+}
+
+
+int anagram_decode(const char *string, long *elements, int size)
+{
+
+	long element;
+	int length, offset;
+
+	if (string == NULL || (elements == NULL && size > 0) || size < 0) {
+		errno = EINVAL;
+		return -1;
 	}
 
-	/* perform search */
-	for (i = 0; i < permutations; i++) {
-		if ((size = stream_read(file, buf, length)) != length) {
-			errn = size < 0 ? errno : EBADF;
-			goto failure;
+	length = 0, offset = 0;
+	while ((element = utf8_decode(string, &offset)) != 0) {
+		if (element < 0) {
+			errno = EILSEQ;
+			return -1;
 		}
-		if (strstr(buf, term) == buf) {
-			if (count == 0)
-				base = i;
-			count++;
+		if (length == size) {
+			errno = ERANGE;
+			return -1;
 		}
-		else if (count != 0)
-			break;
+		elements[length++] = element;
 	}
 
-	success:
-		a->base = base;
-		a->count = count;
-		strcpy(a->term, term);
-		return count;
-
-	failure:
-		errno = errn;
-		return -1;
+	return length;
 
 }
 
 
-const char *anagram_term(anagram_ref a)
+const char *anagram_source_string(anagram_ref a)
 {
 	if (a != NULL)
-		return a->term;
+		return a->source;
 	return NULL;
 }
 
 
-int anagram_count(anagram_ref a)
+int anagram_element_count(anagram_ref a)
 {
 	if (a != NULL)
-		return a->count;
+		return a->elements;
 	return -1;
 }
 
 
-void anagram_release(anagram_ref a)
+int anagram_permutation_count(anagram_ref a)
 {
-	if (a == NULL)
-		return;
-	a->references--;
-	if (a->references == 0) {
-		stream_close(a->file);
-		free(a);
-	}
+	if (a != NULL)
+		return a->permutations;
+	return -1;
+}
+
+
+int anagram_generate(anagram_ref a, void *argument, anagram_callback_f callback)
+{
+	return anagram_generate_range(a, 0, -1, argument, callback);
+}
+
+
+int anagram_generate_range(anagram_ref a, int start, int end, void *argument,
+	anagram_callback_f callback)
+{
+
+	long size, element, elements[ANAGRAM_ELEMENT_LIMIT];
+	long values[ANAGRAM_ELEMENT_LIMIT], total;
+	int counts[ANAGRAM_ELEMENT_LIMIT];
+	int index, limit, length, offset, sharded;
+	int i, errn, canceled;
+	char buffer[ANAGRAM_SIZE_LIMIT];
+	const char *string;
+	stats_mark mark;
+
+	if (a == NULL) {
+		errn = EINVAL;
+		goto failure;
+	}
+
+	if (a->shards != NULL || a->compact != NULL) {
+		errn = EROFS;
+		goto failure;
+	}
+
+	if (a->constraint || a->gray) {
+		errn = EINVAL;
+		goto failure;
+	}
+
+	/* check range; a shard is any range other than the whole list */
+	utf8_elements(a->source, elements);
+	sort(elements, a->elements);
+	total = multinomial(elements, a->elements);
+	if (end < 0)
+		end = (int)total;
+	if (start < 0 || start >= end || end > total) {
+		errn = ERANGE;
+		goto failure;
+	}
+	sharded = start != 0 || end != total;
+	if (a->permutations > 0 && (sharded != a->shard || start != a->first)) {
+		errn = EINVAL;
+		goto failure;
+	}
+
+	if (a->complete)
+		goto success;
+
+	/* initialize locals */
+	index = a->permutations;
+	limit = end - start;
+
+	/* select source string or last generated permutation */
+	if (index < 1) {
+		index = 0;
+		string = a->source;
+	}
+	else {
+		if (io_seek(a, ((long)index + 2) * a->bytes) < 0) {
+			errn = errno;
+			goto failure;
+		}
+		if ((size = io_read(a, a->buffer, a->bytes)) != a->bytes) {
+			errn = size < 0 ? errno : EBADF;
+			goto failure;
+		}
+		a->buffer[a->bytes] = '\0';
+		string = a->buffer;
+	}
+
+	/* populate array of elements */
+	length = 0, offset = 0;
+	while ((element = utf8_decode(string, &offset)) != 0) {
+		if (element < 0) {
+			errn = EILSEQ;
+			goto failure;
+		}
+		elements[length++] = element;
+	}
+
+	/* check internal values */
+	if (length != a->elements || offset != a->bytes) {
+		errn = EBADF;
+		goto failure;
+	}
+
+	/* clear buffer */
+	memset(buffer, 0, ANAGRAM_SIZE_LIMIT);
+
+	/* shards record their first rank in the second record, after a null
+	 * byte (ranks below n! have at most n - 1 digits for n <= 10) */
+	if (index == 0 && sharded) {
+		sprintf(buffer + 1, "%d", start);
+		if (io_seek(a, (long)offset) < 0) {
+			errn = errno;
+			goto failure;
+		}
+		if (io_write(a, buffer, offset) != offset) {
+			errn = errno;
+			goto failure;
+		}
+		memset(buffer, 0, ANAGRAM_SIZE_LIMIT);
+		a->shard = 1;
+		a->first = start;
+	}
+
+	/* readers may open the list as soon as it is marked */
+	if (!publish(a, index)) {
+		errn = errno;
+		goto failure;
+	}
+
+	/* set file offset */
+	if (io_seek(a, ((long)index + 3) * offset) < 0) {
+		errn = errno;
+		goto failure;
+	}
+
+	/* sort elements (or unrank the shard start) if first permutation and
+	 * write it to first record */
+	if (index == 0) {
+		sort(elements, length);
+		if (start > 0) {
+			i = histogram(elements, length, values, counts);
+			unrank(values, counts, i, length, total, start, elements);
+		}
+		for (i = 0, offset = 0; i < length; i++)
+			utf8_encode(buffer, &offset, elements[i]);
+		if (io_write(a, buffer, offset) != offset) {
+			errn = errno;
+			goto failure;
+		}
+		a->permutations = ++index;
+	}
+
+	/* clear canceled flag */
+	canceled = 0;
+
+	/* perform permutations */
+	STATS_MARK(mark);
+	while (index < limit && permute(elements, length) != 0) {
+		STATS_LAP(a, permute_time, mark);
+		for (i = 0, offset = 0; i < length; i++)
+			utf8_encode(buffer, &offset, elements[i]);
+		STATS_LAP(a, encode_time, mark);
+		if (io_write(a, buffer, offset) != offset) {
+			errn = errno;
+			goto failure;
+		}
+		if (!publish(a, index + 1)) {
+			errn = errno;
+			goto failure;
+		}
+		STATS_MARK(mark);
+		index++; /* point to next permutation */
+		if (callback != NULL) {
+			STATS_ADD(a, callbacks, 1);
+			canceled = !callback(argument, index, buffer);
+			STATS_LAP(a, callback_time, mark);
+			if (canceled)
+				break;
+		}
+	}
+
+	/* set permutation count */
+	STATS_ADD(a, permutations, index - a->permutations);
+	a->permutations = index;
+
+	/* update result set */
+	a->base = 0;
+	a->count = index;
+	a->term[0] = '\0';
+
+	if (canceled == 0) {
+		/* the third record only has to be non-zero; nothing was permuted
+		 * when resuming at the last permutation */
+		if (buffer[0] == '\0')
+			memcpy(buffer, a->source, offset);
+		if (io_seek(a, (long)offset * 2) < 0) {
+			errn = errno;
+			goto failure;
+		}
+		if (io_write(a, buffer, offset) != offset) {
+			errn = errno;
+			goto failure;
+		}
+		a->complete = 1;
+	}
+
+	/* flush changes to file */
+	if (io_sync(a) != 0) {
+		errn = errno;
+		goto failure;
+	}
+
+	success:
+		return 1;
+
+	failure:
+		errno = errn;
+		return 0;
+
+}
+
+
+int anagram_constrained_total(anagram_ref a, int fixed)
+{
+
+	long elements[ANAGRAM_ELEMENT_LIMIT], source[ANAGRAM_ELEMENT_LIMIT];
+	long values[ANAGRAM_ELEMENT_LIMIT];
+	int counts[ANAGRAM_ELEMENT_LIMIT], distinct;
+
+	if (a == NULL || fixed < 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	utf8_elements(a->source, source);
+	memcpy(elements, source, sizeof(long) * a->elements);
+	sort(elements, a->elements);
+	distinct = histogram(elements, a->elements, values, counts);
+
+	return (int)constrained_count(values, counts, distinct, source, 0, a->elements, fixed);
+
+}
+
+
+int anagram_generate_constrained(anagram_ref a, int fixed, void *argument,
+	anagram_callback_f callback)
+{
+
+	long size, elements[ANAGRAM_ELEMENT_LIMIT], source[ANAGRAM_ELEMENT_LIMIT];
+	long values[ANAGRAM_ELEMENT_LIMIT];
+	int counts[ANAGRAM_ELEMENT_LIMIT], distinct;
+	int index, length, offset;
+	int i, errn, canceled = 0;
+	char buffer[ANAGRAM_SIZE_LIMIT];
+	stats_mark mark;
+
+	if (a == NULL || fixed < 0 || fixed > ANAGRAM_ELEMENT_LIMIT) {
+		errn = EINVAL;
+		goto failure;
+	}
+
+	if (a->shards != NULL || a->shared != NULL || a->compact != NULL) {
+		errn = EROFS;
+		goto failure;
+	}
+
+	/* a list is constrained for good once its first record is written */
+	if (a->permutations > 0 && a->constraint != fixed + 1) {
+		errn = EINVAL;
+		goto failure;
+	}
+
+	if (a->complete)
+		goto success;
+
+	/* initialize locals */
+	index = a->permutations;
+	length = utf8_elements(a->source, source);
+	memcpy(elements, source, sizeof(long) * length);
+	sort(elements, length);
+	distinct = histogram(elements, length, values, counts);
+	memset(buffer, 0, ANAGRAM_SIZE_LIMIT);
+	offset = a->bytes;
+
+	if (index < 1) {
+		/* mark the list and find its first permutation */
+		index = 0;
+		buffer[1] = (char)('A' + fixed);
+		if (io_seek(a, (long)offset) < 0) {
+			errn = errno;
+			goto failure;
+		}
+		if (io_write(a, buffer, offset) != offset) {
+			errn = errno;
+			goto failure;
+		}
+		memset(buffer, 0, ANAGRAM_SIZE_LIMIT);
+		a->constraint = fixed + 1;
+		if (!constrained_fill(values, counts, distinct, source, elements, 0, length, fixed)) {
+			/* no permutation satisfies the constraint */
+			memcpy(buffer, a->source, offset);
+			goto complete;
+		}
+	}
+	else {
+		/* resume from the last generated permutation */
+		if (io_seek(a, ((long)index + 2) * offset) < 0) {
+			errn = errno;
+			goto failure;
+		}
+		if ((size = io_read(a, a->buffer, offset)) != offset) {
+			errn = size < 0 ? errno : EBADF;
+			goto failure;
+		}
+		a->buffer[offset] = '\0';
+		if (utf8_elements(a->buffer, elements) != length) {
+			errn = EBADF;
+			goto failure;
+		}
+	}
+
+	/* readers may open the list as soon as it is marked */
+	if (!publish(a, index)) {
+		errn = errno;
+		goto failure;
+	}
+
+	/* set file offset */
+	if (io_seek(a, ((long)index + 3) * offset) < 0) {
+		errn = errno;
+		goto failure;
+	}
+
+	/* write first permutation */
+	if (index == 0) {
+		for (i = 0, offset = 0; i < length; i++)
+			utf8_encode(buffer, &offset, elements[i]);
+		if (io_write(a, buffer, offset) != offset) {
+			errn = errno;
+			goto failure;
+		}
+		a->permutations = ++index;
+	}
+
+	/* step to the next permutation with at most "fixed" fixed points,
+	 * skipping every subtree whose count is zero */
+	STATS_MARK(mark);
+	while (constrained_next(values, distinct, source, elements, length, fixed) != 0) {
+		STATS_LAP(a, permute_time, mark);
+		for (i = 0, offset = 0; i < length; i++)
+			utf8_encode(buffer, &offset, elements[i]);
+		STATS_LAP(a, encode_time, mark);
+		if (io_write(a, buffer, offset) != offset) {
+			errn = errno;
+			goto failure;
+		}
+		if (!publish(a, index + 1)) {
+			errn = errno;
+			goto failure;
+		}
+		STATS_MARK(mark);
+		index++; /* point to next permutation */
+		if (callback != NULL) {
+			STATS_ADD(a, callbacks, 1);
+			canceled = !callback(argument, index, buffer);
+			STATS_LAP(a, callback_time, mark);
+			if (canceled)
+				break;
+		}
+	}
+
+	complete:
+
+	/* set permutation count */
+	STATS_ADD(a, permutations, index - a->permutations);
+	a->permutations = index;
+
+	/* update result set */
+	a->base = 0;
+	a->count = index;
+	a->term[0] = '\0';
+
+	if (canceled == 0) {
+		if (buffer[0] == '\0')
+			memcpy(buffer, a->source, offset);
+		if (io_seek(a, (long)offset * 2) < 0) {
+			errn = errno;
+			goto failure;
+		}
+		if (io_write(a, buffer, offset) != offset) {
+			errn = errno;
+			goto failure;
+		}
+		a->complete = 1;
+	}
+
+	/* flush changes to file */
+	if (io_sync(a) != 0) {
+		errn = errno;
+		goto failure;
+	}
+
+	success:
+		return 1;
+
+	failure:
+		errno = errn;
+		return 0;
+
+}
+
+
+int anagram_generate_gray(anagram_ref a, void *argument, anagram_swap_f callback)
+{
+
+	struct gray_state g;
+	long elements[ANAGRAM_ELEMENT_LIMIT], previous[ANAGRAM_ELEMENT_LIMIT];
+	long values[ANAGRAM_ELEMENT_LIMIT], total;
+	int counts[ANAGRAM_ELEMENT_LIMIT], distinct, swapped[2];
+	int index, length, offset;
+	int i, n, errn, canceled;
+	char buffer[ANAGRAM_SIZE_LIMIT];
+	stats_mark mark;
+
+	if (a == NULL) {
+		errn = EINVAL;
+		goto failure;
+	}
+
+	if (a->shards != NULL || a->shared != NULL || a->compact != NULL) {
+		errn = EROFS;
+		goto failure;
+	}
+
+	/* a list keeps the order of its first record */
+	if (a->permutations > 0 && !a->gray) {
+		errn = EINVAL;
+		goto failure;
+	}
+
+	if (a->complete)
+		goto success;
+
+	/* initialize locals */
+	index = a->permutations;
+	length = utf8_elements(a->source, elements);
+	sort(elements, length);
+	total = multinomial(elements, length);
+	distinct = histogram(elements, length, values, counts);
+	memset(buffer, 0, ANAGRAM_SIZE_LIMIT);
+	offset = a->bytes;
+
+	if (index < 1) {
+		/* mark the list */
+		index = 0;
+		buffer[1] = 'g';
+		if (io_seek(a, (long)offset) < 0) {
+			errn = errno;
+			goto failure;
+		}
+		if (io_write(a, buffer, offset) != offset) {
+			errn = errno;
+			goto failure;
+		}
+		memset(buffer, 0, ANAGRAM_SIZE_LIMIT);
+		a->gray = 1;
+	}
+
+	/* readers may open the list as soon as it is marked */
+	if (!publish(a, index)) {
+		errn = errno;
+		goto failure;
+	}
+
+	/* set file offset */
+	if (io_seek(a, ((long)index + 3) * offset) < 0) {
+		errn = errno;
+		goto failure;
+	}
+
+	/* clear canceled flag */
+	canceled = 0;
+
+	/* each step changes a single transposition; the elements of the
+	 * previous permutation tell which */
+	gray_start(&g, values, counts, distinct, index > 0 ? index - 1 : 0);
+	memcpy(previous, g.words[distinct - 1], sizeof(long) * length);
+	STATS_MARK(mark);
+	for (; index < total; index++) {
+		swapped[0] = -1, swapped[1] = -1;
+		if (index > 0) {
+			gray_next(&g);
+			for (i = 0, n = 0; i < length; i++) {
+				if (g.words[distinct - 1][i] != previous[i]) {
+					if (n < 2)
+						swapped[n++] = i;
+					previous[i] = g.words[distinct - 1][i];
+				}
+			}
+		}
+		STATS_LAP(a, permute_time, mark);
+		for (i = 0, offset = 0; i < length; i++)
+			utf8_encode(buffer, &offset, previous[i]);
+		STATS_LAP(a, encode_time, mark);
+		if (io_write(a, buffer, offset) != offset) {
+			errn = errno;
+			goto failure;
+		}
+		if (!publish(a, index + 1)) {
+			errn = errno;
+			goto failure;
+		}
+		STATS_MARK(mark);
+		if (callback != NULL) {
+			STATS_ADD(a, callbacks, 1);
+			canceled = !callback(argument, index + 1, buffer, swapped[0], swapped[1]);
+			STATS_LAP(a, callback_time, mark);
+			if (canceled) {
+				index++;
+				break;
+			}
+		}
+	}
+
+	/* set permutation count */
+	STATS_ADD(a, permutations, index - a->permutations);
+	a->permutations = index;
+
+	/* update result set */
+	a->base = 0;
+	a->count = index;
+	a->term[0] = '\0';
+
+	if (canceled == 0) {
+		offset = a->bytes;
+		if (io_seek(a, (long)offset * 2) < 0) {
+			errn = errno;
+			goto failure;
+		}
+		if (io_write(a, a->source, offset) != offset) {
+			errn = errno;
+			goto failure;
+		}
+		a->complete = 1;
+	}
+
+	/* flush changes to file */
+	if (io_sync(a) != 0) {
+		errn = errno;
+		goto failure;
+	}
+
+	success:
+		return 1;
+
+	failure:
+		errno = errn;
+		return 0;
+
+}
+
+
+int anagram_test(anagram_ref a, void *arg, anagram_callback_f cb)
+{
+
+	long size;
+	register int cnt, i, j;
+	int len, errn;
+	char bufa[ANAGRAM_SIZE_LIMIT], bufb[ANAGRAM_SIZE_LIMIT];
+
+	if (a == NULL) {
+		errn = EINVAL;
+		goto failure;
+	}
+
+	if (a->permutations < 2 || !a->complete) {
+		errn = EAGAIN;
+		goto failure;
+	}
+
+	/* initialize locals */
+	memset(bufa, 0, ANAGRAM_SIZE_LIMIT);
+	memset(bufb, 0, ANAGRAM_SIZE_LIMIT);
+	len = a->bytes;
+
+	/* main comparison loop */
+	for (i = 0, cnt = a->permutations; i < cnt - 1; i++) {
+		if (io_seek(a, ((long)i + 3) * len) < 0) {
+			errn = errno;
+			goto failure;
+		}
+		if ((size = io_read(a, bufa, len)) != len) {
+			errn = size < 0 ? errno : EBADF;
+			goto failure;
+		}
+		for (j = i + 1; j < cnt; j++) {
+			if ((size = io_read(a, bufb, len)) != len) {
+				errn = size < 0 ? errno : EBADF;
+				goto failure;
+			}
+			if (strcmp(bufa, bufb) == 0) {
+				errn = EILSEQ;
+				goto failure;
+			}
+			if (cb != NULL) {
+				STATS_ADD(a, callbacks, 1);
+				if (!cb(arg, j, bufb)) {
+					errn = ECANCELED;
+					goto failure;
+				}
+			}
+		}
+	}
+
+	return 1;
+
+	failure:
+		errno = errn;
+		return 0;
+
+}
+
+
+int anagram_verify(anagram_ref a)
+{
+
+	struct header *h;
+	unsigned long expected;
+	char *records;
+	long block, total, done, size;
+	int i, errn;
+
+	records = NULL;
+
+	if (a == NULL) {
+		errn = EINVAL;
+		goto failure;
+	}
+
+	if (a->shared != NULL)
+		return anagram_verify(a->shared);
+
+	/* only files with a header hold checksums */
+	h = a->header;
+	if (h == NULL) {
+		errn = ENOTSUP;
+		goto failure;
+	}
+
+	block = (long)h->per_block * a->bytes;
+	records = malloc(block);
+	if (records == NULL) {
+		errn = ENOMEM;
+		goto failure;
+	}
+
+	if (io_seek(a, 3L * a->bytes) < 0) {
+		errn = errno;
+		goto failure;
+	}
+
+	/* one read and one checksum per block; the last partial block is
+	 * checked against the running checksum */
+	total = (long)a->permutations * a->bytes;
+	for (i = 0, done = 0; done < total; i++, done += size) {
+		size = total - done < block ? total - done : block;
+		if (io_read(a, records, size) != size) {
+			errn = EBADF;
+			goto failure;
+		}
+		if (size == block)
+			expected = (unsigned long)get32(h->data + ANAGRAM_HEADER_FIXED + 4 * i) & 0xFFFFFFFFUL;
+		else
+			expected = h->crc;
+		if (crc32c(0, records, size) != expected) {
+			errn = EILSEQ;
+			goto failure;
+		}
+	}
+
+	free(records);
+
+	return 1;
+
+	failure:
+		free(records);
+		errno = errn;
+		return 0;
+
+}
+
+
+const char *anagram_string(anagram_ref a, int index)
+{
+
+	long size;
+	int errn;
+
+	if (a == NULL) {
+		errn = EINVAL;
+		goto failure;
+	}
+
+	if (index >= a->count && a->lazy > 0 && index >= 0) {
+		/* far past the frontier: compute the string instead of waiting */
+		if (index - a->permutations >= a->lazy && lazy_extend(a, -1))
+			return anagram_unrank(a, index);
+		if (!lazy_extend(a, index)) {
+			errn = errno;
+			goto failure;
+		}
+	}
+
+	if (index < 0 || index >= a->count) {
+		errn = ERANGE;
+		goto failure;
+	}
+
+	if (io_seek(a, ((long)index + (long)a->base + 3L) * (long)a->bytes) < 0) {
+		errn = errno;
+		goto failure;
+	}
+
+	if ((size = io_read(a, a->buffer, a->bytes)) != a->bytes) {
+		errn = size < 0 ? errno : EBADF;
+		goto failure;
+	}
+
+	*(a->buffer + a->bytes) = '\0';
+
+	return a->buffer;
+
+	failure:
+		errno = errn;
+		return NULL;
+
+}
+
+
+int anagram_set_lazy(anagram_ref a, int chunk)
+{
+
+	int previous;
+
+	if (a == NULL || chunk < 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	previous = a->lazy;
+	a->lazy = chunk;
+
+	return previous;
+
+}
+
+
+int anagram_set_publish(anagram_ref a, int interval)
+{
+
+	int previous;
+
+	if (a == NULL || interval < 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	previous = a->publish;
+	a->publish = interval;
+
+	return previous;
+
+}
+
+
+int anagram_refresh(anagram_ref a)
+{
+
+	unsigned char fixed[ANAGRAM_HEADER_FIXED];
+	struct header *h;
+	stream *file;
+	long size;
+	int attempt, errn;
+
+	if (a == NULL) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	/* other objects only append to incomplete files opened for reading */
+	if (a->complete || a->path == NULL)
+		return a->permutations;
+
+	/* the header of an object writing the list is ahead of the file's */
+	if (a->writing) {
+		errno = EBUSY;
+		return -1;
+	}
+
+	if (a->header == NULL) {
+		errno = ENOTSUP;
+		return -1;
+	}
+
+	/* the header is the only part of the file rewritten in place; it is
+	 * read unbuffered, through a descriptor of its own */
+	if (a->watch < 0 && (a->watch = open(a->path, O_RDONLY)) < 0)
+		return -1;
+
+	/* a header read while the writer rewrites it fails its checksum */
+	for (attempt = 1; ; attempt++) {
+		h = NULL;
+		errno = EBADF;
+		if (pread(a->watch, fixed, ANAGRAM_HEADER_FIXED, 0) == ANAGRAM_HEADER_FIXED) {
+			if (get32(fixed + 16) == a->permutations && get32(fixed + 20) == a->complete)
+				return a->permutations;
+			h = header_parse(fixed);
+			size = h != NULL ? h->size - ANAGRAM_HEADER_FIXED : 0;
+			if (h != NULL && (pread(a->watch, h->data + ANAGRAM_HEADER_FIXED, size,
+				ANAGRAM_HEADER_FIXED) != size || !header_check(h))) {
+				header_release(h);
+				h = NULL;
+				errno = EBADF;
+			}
+		}
+		if (h != NULL)
+			break;
+		if (errno != EBADF || attempt == ANAGRAM_REFRESH_ATTEMPTS)
+			return -1;
+	}
+
+	/* records published since the stream last read may hide behind its
+	 * buffer, so it is reopened, once per update */
+	file = stream_open(a->path, a->readonly ? "r" : "r+");
+	if (file == NULL) {
+		errn = errno;
+		header_release(h);
+		errno = errn;
+		return -1;
+	}
+	stream_close(a->file);
+	a->file = file;
+	header_release(a->header);
+	header_apply(a, h);
+
+	/* the writer marks the list before publishing its first record */
+	if (a->header->bytes != a->bytes || !load_kind(a)) {
+		errno = EBADF;
+		return -1;
+	}
+
+	/* unfiltered result sets follow the list */
+	if (a->term[0] == '\0') {
+		a->base = 0;
+		a->count = a->permutations;
+	}
+
+	return a->permutations;
+
+}
+
+
+int anagram_wait(anagram_ref a, int count, int timeout)
+{
+
+	struct timespec pause;
+	long waited, delay;
+	int available;
+
+	if (a == NULL) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	/* poll the header, backing off up to ANAGRAM_WAIT_DELAY milliseconds */
+	for (waited = 0, delay = 1; ; waited += delay) {
+		available = anagram_refresh(a);
+		if (available < 0)
+			return -1;
+		if (available >= count || a->complete)
+			return available;
+		if (timeout >= 0 && waited >= timeout) {
+			errno = ETIMEDOUT;
+			return -1;
+		}
+		if (waited > 0 && delay < ANAGRAM_WAIT_DELAY)
+			delay *= 2;
+		if (timeout >= 0 && delay > timeout - waited)
+			delay = timeout - waited;
+		pause.tv_sec = delay / 1000;
+		pause.tv_nsec = (delay % 1000) * 1000000L;
+		nanosleep(&pause, NULL);
+	}
+
+}
+
+
+int anagram_is_complete(anagram_ref a)
+{
+	if (a != NULL)
+		return a->complete;
+	return 0;
+}
+
+
+int anagram_filter(anagram_ref a, const char *s)
+{
+
+	long size;
+	int base, count, length, permutations;
+	int i, errn;
+	char term[ANAGRAM_SIZE_LIMIT], buf[ANAGRAM_SIZE_LIMIT];
+
+	/* check for null pointers */
+	if (a == NULL) {
+		errn = EINVAL;
+		goto failure;
+	}
+
+	/* if term is a null pointer or an empty string, reset result set */
+	if (s == NULL || *s == '\0') {
+		base = 0;
+		count = a->permutations;
+		term[0] = '\0';
+		goto success;
+	}
+
+	/* matches only form a single run of records in lexicographic order */
+	if (a->gray) {
+		errn = EINVAL;
+		goto failure;
+	}
+
+	/* check filter string */
+	length = utf8_strlen(s, NULL);
+	if (length < 1 || length > a->elements) {
+		base = 0;
+		count = 0;
+		term[0] = '\0';
+		goto success;
+	}
+
+	/* initialize local storage */
+	length = a->bytes;
+	permutations = a->permutations;
+	base = 0;
+	count = 0;
+	strcpy(term, s);
+	memset(buf, 0, ANAGRAM_SIZE_LIMIT);
+
+	/* set stream pointer to first record */
+	if (io_seek(a, (long)length * 3) < 0) {
+		errn = errno;
+		goto failure;
+	}
+
+	/* perform search */
+	for (i = 0; i < permutations; i++) {
+		if ((size = io_read(a, buf, length)) != length) {
+			errn = size < 0 ? errno : EBADF;
+			goto failure;
+		}
+		if (strstr(buf, term) == buf) {
+			if (count == 0)
+				base = i;
+			count++;
+		}
+		else if (count != 0)
+			break;
+	}
+
+	success:
+		a->base = base;
+		a->count = count;
+		strcpy(a->term, term);
+		return count;
+
+	failure:
+		errno = errn;
+		return -1;
+
+}
+
+
+int anagram_rank(anagram_ref a, const char *string)
+{
+
+	long elements[ANAGRAM_ELEMENT_LIMIT], sorted[ANAGRAM_ELEMENT_LIMIT];
+	long values[ANAGRAM_ELEMENT_LIMIT];
+	int counts[ANAGRAM_ELEMENT_LIMIT];
+	int length, distinct;
+
+	if (a == NULL || string == NULL || a->constraint) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	/* the string must hold exactly the elements of the source */
+	length = utf8_elements(string, elements);
+	if (length != a->elements) {
+		errno = EINVAL;
+		return -1;
+	}
+	memcpy(sorted, elements, sizeof(long) * length);
+	sort(sorted, length);
+	utf8_elements(a->source, values);
+	sort(values, length);
+	if (memcmp(sorted, values, sizeof(long) * length) != 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	distinct = histogram(sorted, length, values, counts);
+	if (a->gray)
+		return (int)gray_rank(values, counts, distinct, length, elements);
+
+	return (int)lex_rank(values, counts, distinct, length, multinomial(sorted, length), elements);
+
+}
+
+
+int anagram_classify(anagram_ref a, const char *const *strings, int count,
+	char *results, int *ranks)
+{
+
+	struct classify_source c;
+	struct classify_slice slices[ANAGRAM_CLASSIFY_THREADS];
+	long elements[ANAGRAM_ELEMENT_LIMIT];
+	int threads, members, i;
+
+	if (a == NULL || (strings == NULL && count > 0) || count < 0 || a->constraint) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	/* source histogram, and whether candidates can be compared bytewise */
+	c.length = utf8_elements(a->source, elements);
+	sort(elements, c.length);
+	memcpy(c.sorted, elements, sizeof(long) * c.length);
+	c.total = multinomial(elements, c.length);
+	c.distinct = histogram(elements, c.length, c.values, c.counts);
+	c.bytes = (int)strlen(a->source);
+	c.ascii = c.bytes == c.length;
+	c.gray = a->gray;
+
+	threads = 1;
+#ifndef ANAGRAM_NO_THREADS
+	threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	if (threads > count / ANAGRAM_CLASSIFY_SLICE)
+		threads = count / ANAGRAM_CLASSIFY_SLICE;
+	if (threads > ANAGRAM_CLASSIFY_THREADS)
+		threads = ANAGRAM_CLASSIFY_THREADS;
+	if (threads < 1)
+		threads = 1;
+#endif
+
+	for (i = 0; i < threads; i++) {
+		slices[i].source = &c;
+		slices[i].strings = strings;
+		slices[i].results = results;
+		slices[i].ranks = ranks;
+		slices[i].from = (int)((long)count * i / threads);
+		slices[i].to = (int)((long)count * (i + 1) / threads);
+		slices[i].members = 0;
+	}
+
+#ifndef ANAGRAM_NO_THREADS
+	/* the calling thread takes the first slice, and any slice whose thread
+	 * could not be started */
+	for (i = 1; i < threads; i++)
+		if (pthread_create(&slices[i].thread, NULL, classify_run, &slices[i]) != 0)
+			slices[i].members = -1;
+	classify_run(&slices[0]);
+	for (i = 1; i < threads; i++) {
+		if (slices[i].members < 0) {
+			slices[i].members = 0;
+			classify_run(&slices[i]);
+		}
+		else
+			pthread_join(slices[i].thread, NULL);
+	}
+#else
+	classify_run(&slices[0]);
+#endif
+
+	for (i = 0, members = 0; i < threads; i++)
+		members += slices[i].members;
+
+	return members;
+
+}
+
+
+const char *anagram_unrank(anagram_ref a, int rank)
+{
+
+	long elements[ANAGRAM_ELEMENT_LIMIT], values[ANAGRAM_ELEMENT_LIMIT], total;
+	int counts[ANAGRAM_ELEMENT_LIMIT];
+	int distinct, offset, i;
+
+	if (a == NULL || a->constraint) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	utf8_elements(a->source, elements);
+	sort(elements, a->elements);
+	total = multinomial(elements, a->elements);
+	if (rank < 0 || rank >= total) {
+		errno = ERANGE;
+		return NULL;
+	}
+
+	distinct = histogram(elements, a->elements, values, counts);
+	if (a->gray)
+		gray_unrank(values, counts, distinct, a->elements, rank, elements);
+	else
+		unrank(values, counts, distinct, a->elements, total, rank, elements);
+	for (i = 0, offset = 0; i < a->elements; i++)
+		utf8_encode(a->buffer, &offset, elements[i]);
+	a->buffer[offset] = '\0';
+
+	return a->buffer;
+
+}
+
+
+int anagram_sample(anagram_ref a, int k, unsigned long seed, int sorted,
+	int *ranks, void *argument, anagram_callback_f callback)
+{
+
+	long elements[ANAGRAM_ELEMENT_LIMIT], values[ANAGRAM_ELEMENT_LIMIT];
+	long total, t, j;
+	unsigned long state, h;
+	int counts[ANAGRAM_ELEMENT_LIMIT];
+	int *set, *drawn, buckets, distinct, offset, i, n;
+
+	if (a == NULL || k < 0 || a->constraint) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	utf8_elements(a->source, elements);
+	sort(elements, a->elements);
+	total = multinomial(elements, a->elements);
+	distinct = histogram(elements, a->elements, values, counts);
+	if (k > total) {
+		errno = ERANGE;
+		return -1;
+	}
+
+	/* open addressing set of drawn ranks, at most half full */
+	for (buckets = 16; buckets < 2 * k; buckets *= 2)
+		;
+	set = malloc(sizeof(int) * buckets);
+	drawn = ranks != NULL ? ranks : malloc(sizeof(int) * (k > 0 ? k : 1));
+	if (set == NULL || drawn == NULL) {
+		free(set);
+		if (drawn != ranks)
+			free(drawn);
+		errno = ENOMEM;
+		return -1;
+	}
+	for (i = 0; i < buckets; i++)
+		set[i] = -1;
+
+	/*
+	 * Floyd's algorithm: for j = total - k .. total - 1 draw t in [0, j];
+	 * take t unless already drawn, in which case take j (never drawn yet).
+	 * Every k-subset of ranks is equally likely.
+	 */
+	state = ((seed ^ 0x9E3779B9UL) * 2654435761UL) & 0xFFFFFFFFUL;
+	if (state == 0)
+		state = 1;
+	for (n = 0, j = total - k; j < total; j++) {
+		t = random_below(&state, j + 1);
+		for (h = ((unsigned long)t * 2654435761UL) & (buckets - 1); set[h] >= 0; h = (h + 1) & (buckets - 1))
+			if (set[h] == t)
+				break;
+		if (set[h] == t) {
+			t = j;
+			for (h = ((unsigned long)t * 2654435761UL) & (buckets - 1); set[h] >= 0; h = (h + 1) & (buckets - 1))
+				;
+		}
+		set[h] = (int)t;
+		drawn[n++] = (int)t;
+	}
+	free(set);
+
+	if (sorted)
+		qsort(drawn, n, sizeof(int), compare_ints);
+
+	/* unrank the sample */
+	if (callback != NULL) {
+		for (i = 0; i < n; i++) {
+			if (a->gray)
+				gray_unrank(values, counts, distinct, a->elements, drawn[i], elements);
+			else
+				unrank(values, counts, distinct, a->elements, total, drawn[i], elements);
+			for (j = 0, offset = 0; j < a->elements; j++)
+				utf8_encode(a->buffer, &offset, elements[j]);
+			a->buffer[offset] = '\0';
+			STATS_ADD(a, callbacks, 1);
+			if (!callback(argument, drawn[i], a->buffer)) {
+				n = i + 1;
+				break;
+			}
+		}
+	}
+
+	if (drawn != ranks)
+		free(drawn);
+
+	return n;
+
+}
+
+
+int anagram_top(anagram_ref a, const anagram_weights *weights, int k,
+	int *ranks, double *scores, void *argument, anagram_callback_f callback)
+{
+
+	struct top_search t;
+	long elements[ANAGRAM_ELEMENT_LIMIT], values[ANAGRAM_ELEMENT_LIMIT], total;
+	int distinct, offset, i, j, n;
+
+	if (a == NULL || weights == NULL || k < 0 || a->constraint) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	utf8_elements(a->source, elements);
+	sort(elements, a->elements);
+	total = multinomial(elements, a->elements);
+	distinct = histogram(elements, a->elements, values, t.counts);
+	if (k > total)
+		k = (int)total;
+	if (k == 0)
+		return 0;
+
+	t.bigram = weights->bigram;
+	t.position = weights->position;
+	t.distinct = distinct;
+	t.length = a->elements;
+	t.k = k;
+	t.found = 0;
+	t.heap = malloc(sizeof(struct top_entry) * k);
+	if (t.heap == NULL) {
+		errno = ENOMEM;
+		return -1;
+	}
+
+	top_visit(&t, 0, -1, 0.0, 0, total);
+	qsort(t.heap, k, sizeof(struct top_entry), compare_top);
+
+	/* the search runs over lexicographic ranks */
+	if (a->gray) {
+		for (i = 0; i < k; i++) {
+			unrank(values, t.counts, distinct, a->elements, total, t.heap[i].rank, elements);
+			t.heap[i].rank = gray_rank(values, t.counts, distinct, a->elements, elements);
+		}
+		qsort(t.heap, k, sizeof(struct top_entry), compare_top);
+	}
+
+	for (i = 0; i < k; i++) {
+		if (ranks != NULL)
+			ranks[i] = (int)t.heap[i].rank;
+		if (scores != NULL)
+			scores[i] = t.heap[i].score;
+	}
+
+	n = k;
+	if (callback != NULL) {
+		for (i = 0; i < k; i++) {
+			if (a->gray)
+				gray_unrank(values, t.counts, distinct, a->elements, t.heap[i].rank, elements);
+			else
+				unrank(values, t.counts, distinct, a->elements, total, t.heap[i].rank, elements);
+			for (j = 0, offset = 0; j < a->elements; j++)
+				utf8_encode(a->buffer, &offset, elements[j]);
+			a->buffer[offset] = '\0';
+			STATS_ADD(a, callbacks, 1);
+			if (!callback(argument, (int)t.heap[i].rank, a->buffer)) {
+				n = i + 1;
+				break;
+			}
+		}
+	}
+
+	free(t.heap);
+
+	return n;
+
+}
+
+
+const char *anagram_term(anagram_ref a)
+{
+	if (a != NULL)
+		return a->term;
+	return NULL;
+}
+
+
+int anagram_count(anagram_ref a)
+{
+	if (a != NULL)
+		return a->count;
+	return -1;
+}
+
+
+const char *anagram_records(anagram_ref a, int *size)
+{
+
+	struct anagram *owner;
+	long origin;
+
+	if (a == NULL) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	/* records live in the arena of the object (or of the one it aliases),
+	 * past the header of a file image */
+	for (owner = a; owner->shared != NULL; owner = owner->shared)
+		;
+	if (owner->file != NULL || owner->shards != NULL || owner->compact != NULL
+		|| owner->arena == NULL) {
+		errno = ENOTSUP;
+		return NULL;
+	}
+	origin = owner->header != NULL ? owner->header->size : 0;
+
+	if (size != NULL)
+		*size = a->bytes;
+
+	return owner->arena + origin + ((long)a->base + 3L) * a->bytes;
+
+}
+
+
+int anagram_read_records(anagram_ref a, int index, int count, char *buffer)
+{
+
+	long size;
+	int errn;
+
+	if (a == NULL || buffer == NULL || index < 0 || count < 0) {
+		errn = EINVAL;
+		goto failure;
+	}
+
+	if (index > a->count) {
+		errn = ERANGE;
+		goto failure;
+	}
+
+	if (count > a->count - index)
+		count = a->count - index;
+	if (count == 0)
+		return 0;
+
+	/* a single read for the whole run of records */
+	if (io_seek(a, ((long)index + (long)a->base + 3L) * (long)a->bytes) < 0) {
+		errn = errno;
+		goto failure;
+	}
+	if ((size = io_read(a, buffer, (long)count * a->bytes)) != (long)count * a->bytes) {
+		errn = size < 0 ? errno : EBADF;
+		goto failure;
+	}
+
+	return count;
+
+	failure:
+		errno = errn;
+		return -1;
+
+}
+
+
+int anagram_save(anagram_ref a, const char *path)
+{
+
+	stream *file;
+	struct header *h;
+	long elements[ANAGRAM_ELEMENT_LIMIT], total;
+	int errn;
+
+	if (a == NULL || a->file != NULL || a->shared != NULL || a->shards != NULL
+		|| a->compact != NULL || a->capacity < 0) {
+		errno = EINVAL;
+		return 0;
+	}
+
+	/* checksum the records into the header written ahead of them */
+	utf8_elements(a->source, elements);
+	sort(elements, a->elements);
+	total = multinomial(elements, a->elements);
+	h = header_create(a->bytes, ANAGRAM_HEADER_BLOCK,
+		(total + ANAGRAM_HEADER_BLOCK - 1) / ANAGRAM_HEADER_BLOCK);
+	if (h == NULL) {
+		errno = ENOMEM;
+		return 0;
+	}
+	header_extend(h, a->arena + 3L * a->bytes, (long)a->permutations * a->bytes);
+	header_encode(h, a->permutations, a->complete, h->data);
+
+	file = stream_open(path, "w+");
+	if (file == NULL) {
+		errn = errno;
+		header_release(h);
+		errno = errn;
+		return 0;
+	}
+
+	/* the arena holds the exact file image past the header */
+	if (stream_write(file, h->data, h->size) != h->size
+		|| stream_write(file, a->arena, a->size) != a->size
+		|| stream_sync(file) != 0) {
+		errn = errno;
+		stream_close(file);
+		unlink(path);
+		header_release(h);
+		errno = errn;
+		return 0;
+	}
+
+	STATS_ADD(a, writes, 2);
+	STATS_ADD(a, bytes_written, h->size + a->size);
+	STATS_ADD(a, syncs, 1);
+
+	stream_close(file);
+	header_release(h);
+
+	return 1;
+
+}
+
+
+int anagram_save_compact(anagram_ref a, const char *path)
+{
+
+	stream *file;
+	unsigned char header[ANAGRAM_COMPACT_HEADER];
+	unsigned char *directory, *entry;
+	char *records, *raw, *record, *previous;
+	long position, size;
+	int blocks, block, count, used, prefix, i, errn;
+
+	file = NULL;
+	directory = NULL;
+	records = NULL;
+	raw = NULL;
+
+	if (a == NULL || path == NULL) {
+		errn = EINVAL;
+		goto failure;
+	}
+
+	if (!a->complete || a->permutations < 1) {
+		errn = EAGAIN;
+		goto failure;
+	}
+
+	/* a directory entry is the offset and first record of a block */
+	blocks = (a->permutations + ANAGRAM_COMPACT_RECORDS - 1) / ANAGRAM_COMPACT_RECORDS;
+	directory = malloc((size_t)blocks * (4 + a->bytes));
+	records = malloc((size_t)ANAGRAM_COMPACT_RECORDS * a->bytes);
+	raw = malloc((size_t)ANAGRAM_COMPACT_RECORDS * (a->bytes + 1));
+	if (directory == NULL || records == NULL || raw == NULL) {
+		errn = ENOMEM;
+		goto failure;
+	}
+
+	file = stream_open(path, "w+");
+	if (file == NULL) {
+		errn = errno;
+		goto failure;
+	}
+
+	/* header is written last; control records are copied as they are */
+	memset(header, 0, ANAGRAM_COMPACT_HEADER);
+	if (stream_write(file, header, ANAGRAM_COMPACT_HEADER) != ANAGRAM_COMPACT_HEADER
+		|| io_seek(a, 0) < 0) {
+		errn = errno;
+		goto failure;
+	}
+	if ((size = io_read(a, records, 3L * a->bytes)) != 3L * a->bytes) {
+		errn = size < 0 ? errno : EBADF;
+		goto failure;
+	}
+	if (stream_write(file, records, 3L * a->bytes) != 3L * a->bytes) {
+		errn = errno;
+		goto failure;
+	}
+	position = ANAGRAM_COMPACT_HEADER + 3L * a->bytes;
+
+	/*
+	 * Each block holds its first record whole, then, for every other record,
+	 * the length of the prefix it shares with the previous one and the rest
+	 * of its bytes. Records of a list all have the same size, so the suffix
+	 * length follows from the prefix length.
+	 */
+	for (block = 0; block < blocks; block++) {
+		count = a->permutations - block * ANAGRAM_COMPACT_RECORDS;
+		if (count > ANAGRAM_COMPACT_RECORDS)
+			count = ANAGRAM_COMPACT_RECORDS;
+		if ((size = io_read(a, records, (long)count * a->bytes)) != (long)count * a->bytes) {
+			errn = size < 0 ? errno : EBADF;
+			goto failure;
+		}
+		memcpy(raw, records, a->bytes);
+		used = a->bytes;
+		for (i = 1; i < count; i++) {
+			previous = records + (i - 1) * a->bytes;
+			record = previous + a->bytes;
+			for (prefix = 0; prefix < a->bytes && record[prefix] == previous[prefix]; prefix++)
+				;
+			raw[used++] = (char)prefix;
+			memcpy(raw + used, record + prefix, a->bytes - prefix);
+			used += a->bytes - prefix;
+		}
+		if (stream_write(file, raw, used) != used) {
+			errn = errno;
+			goto failure;
+		}
+		entry = directory + (long)block * (4 + a->bytes);
+		put32(entry, position);
+		memcpy(entry + 4, records, a->bytes);
+		position += used;
+	}
+
+	if (stream_write(file, directory, (long)blocks * (4 + a->bytes))
+		!= (long)blocks * (4 + a->bytes)) {
+		errn = errno;
+		goto failure;
+	}
+
+	memcpy(header, ANAGRAM_COMPACT_MAGIC, 8);
+	put32(header + 8, a->bytes);
+	put32(header + 12, a->permutations);
+	put32(header + 16, ANAGRAM_COMPACT_RECORDS);
+	put32(header + 20, blocks);
+	put32(header + 24, position);
+	if (stream_sync(file) != 0 || stream_seek(file, 0) < 0
+		|| stream_write(file, header, ANAGRAM_COMPACT_HEADER) != ANAGRAM_COMPACT_HEADER
+		|| stream_sync(file) != 0) {
+		errn = errno;
+		goto failure;
+	}
+
+	stream_close(file);
+	free(directory);
+	free(records);
+	free(raw);
+
+	return 1;
+
+	failure:
+		if (file != NULL) {
+			stream_close(file);
+			unlink(path);
+		}
+		free(directory);
+		free(records);
+		free(raw);
+		errno = errn;
+		return 0;
+
+}
+
+
+anagram_ref anagram_open_compact(const char *path)
+{
+
+	struct anagram a;
+	struct compact *c;
+	anagram_ref ap;
+	unsigned char header[ANAGRAM_COMPACT_HEADER], *directory, *entry;
+	long size, end;
+	int permutations, i, errn;
+
+	/* initialize local storage */
+	memset(&a, 0, sizeof(struct anagram));
+	a.file = NULL;
+	a.arena = NULL;
+	directory = NULL;
+
+	c = calloc(1, sizeof(struct compact));
+	if (c == NULL)
+		return NULL;
+	a.compact = c;
+	c->block = -1;
+
+	c->file = stream_open(path, "r+");
+	if (c->file == NULL) {
+		errn = errno;
+		goto failure;
+	}
+
+	/* read and check header */
+	if (stream_read(c->file, header, ANAGRAM_COMPACT_HEADER) != ANAGRAM_COMPACT_HEADER
+		|| memcmp(header, ANAGRAM_COMPACT_MAGIC, 8) != 0) {
+		errn = EBADF;
+		goto failure;
+	}
+	a.bytes = (int)get32(header + 8);
+	permutations = (int)get32(header + 12);
+	c->per_block = (int)get32(header + 16);
+	c->blocks = (int)get32(header + 20);
+	end = get32(header + 24);
+	if (a.bytes < 2 || a.bytes > ANAGRAM_SIZE_LIMIT - 1 || permutations < 1
+		|| c->per_block < 1 || c->per_block > ANAGRAM_COMPACT_RECORDS_MAX
+		|| c->blocks != (permutations - 1) / c->per_block + 1) {
+		errn = EBADF;
+		goto failure;
+	}
+
+	/* control records are kept in the arena, as for manifests */
+	a.arena = malloc(3 * a.bytes);
+	c->keys = malloc((size_t)c->blocks * a.bytes);
+	c->offsets = malloc(sizeof(long) * (c->blocks + 1));
+	c->raw = malloc((size_t)c->per_block * (a.bytes + 1));
+	c->records = malloc((size_t)c->per_block * a.bytes);
+	directory = malloc((size_t)c->blocks * (4 + a.bytes));
+	if (a.arena == NULL || c->keys == NULL || c->offsets == NULL
+		|| c->raw == NULL || c->records == NULL || directory == NULL) {
+		errn = ENOMEM;
+		goto failure;
+	}
+	if (stream_read(c->file, a.arena, 3 * a.bytes) != 3 * a.bytes) {
+		errn = EBADF;
+		goto failure;
+	}
+
+	/* block directory: offsets and first records (the keys) */
+	size = (long)c->blocks * (4 + a.bytes);
+	if (stream_seek(c->file, end) < 0 || stream_read(c->file, directory, size) != size) {
+		errn = EBADF;
+		goto failure;
+	}
+	for (i = 0; i < c->blocks; i++) {
+		entry = directory + (long)i * (4 + a.bytes);
+		c->offsets[i] = get32(entry);
+		memcpy(c->keys + (long)i * a.bytes, entry + 4, a.bytes);
+		if (c->offsets[i] < ANAGRAM_COMPACT_HEADER + 3L * a.bytes
+			|| (i > 0 && c->offsets[i] <= c->offsets[i - 1])) {
+			errn = EBADF;
+			goto failure;
+		}
+	}
+	c->offsets[c->blocks] = end;
+	if (end <= c->offsets[c->blocks - 1]) {
+		errn = EBADF;
+		goto failure;
+	}
+	free(directory);
+	directory = NULL;
+
+	/* logical file: control records, then the decoded records */
+	a.size = (3L + permutations) * a.bytes;
+
+	ap = load(&a);
+	if (ap == NULL) {
+		errn = errno;
+		goto failure;
+	}
+
+	return ap;
+
+	failure:
+		free(directory);
+		io_close(&a);
+		errno = errn;
+		return NULL;
+
+}
+
+
+int anagram_find(anagram_ref a, const char *string)
+{
+
+	struct compact *c;
+	char record[ANAGRAM_SIZE_LIMIT];
+	long size;
+	int low, high, middle, result, first, errn;
+
+	if (a == NULL || string == NULL) {
+		errn = EINVAL;
+		goto failure;
+	}
+
+	/* every record of a list has the size of the source */
+	if ((int)strlen(string) != a->bytes) {
+		errn = ENOENT;
+		goto failure;
+	}
+
+	low = 0, high = a->permutations - 1;
+	first = 0;
+
+	/* a minimal-change list is not sorted, but ranks locate its records;
+	 * a compact list narrows the search to one block through its keys */
+	c = a->shared != NULL ? a->shared->compact : a->compact;
+	if (a->gray) {
+		if ((middle = anagram_rank(a, string)) < 0 || middle >= a->permutations) {
+			errn = ENOENT;
+			goto failure;
+		}
+		low = middle, high = middle;
+	}
+	else if (c != NULL) {
+		low = 0, high = c->blocks - 1;
+		while (low < high) {
+			middle = (low + high + 1) / 2;
+			if (memcmp(c->keys + (long)middle * a->bytes, string, a->bytes) <= 0)
+				low = middle;
+			else
+				high = middle - 1;
+		}
+		first = low * c->per_block;
+		low = first;
+		high = first + c->per_block - 1;
+		if (high > a->permutations - 1)
+			high = a->permutations - 1;
+	}
+
+	/* lists are sorted: binary search the records */
+	while (low <= high) {
+		middle = low + (high - low) / 2;
+		if (io_seek(a, ((long)middle + 3) * a->bytes) < 0) {
+			errn = errno;
+			goto failure;
+		}
+		if ((size = io_read(a, record, a->bytes)) != a->bytes) {
+			errn = size < 0 ? errno : EBADF;
+			goto failure;
+		}
+		result = memcmp(record, string, a->bytes);
+		if (result == 0)
+			return middle;
+		if (result < 0)
+			low = middle + 1;
+		else
+			high = middle - 1;
+	}
+
+	errn = ENOENT;
+
+	failure:
+		errno = errn;
+		return -1;
+
+}
+
+
+int anagram_index_build(anagram_ref a, const char *path)
+{
+
+	struct index_build b;
+	unsigned char header[ANAGRAM_INDEX_HEADER], field[4];
+	char *input, record[ANAGRAM_SIZE_LIMIT];
+	long elements[ANAGRAM_ELEMENT_LIMIT], values[ANAGRAM_ELEMENT_LIMIT], size;
+	int counts[ANAGRAM_ELEMENT_LIMIT], kind, last;
+	int distinct, chunks, index, local, block, i, p, v, errn;
+
+	memset(&b, 0, sizeof(struct index_build));
+	b.file = NULL;
+	input = NULL;
+
+	if (a == NULL || path == NULL) {
+		errn = EINVAL;
+		goto failure;
+	}
+
+	utf8_elements(a->source, elements);
+	sort(elements, a->elements);
+	distinct = histogram(elements, a->elements, values, counts);
+	chunks = (a->permutations + ANAGRAM_INDEX_CHUNK - 1) / ANAGRAM_INDEX_CHUNK;
+
+	input = malloc((size_t)ANAGRAM_EXPORT_RECORDS * a->bytes);
+	b.directory = malloc((size_t)a->elements * distinct * chunks * 8 + 1);
+	b.output = malloc(ANAGRAM_INDEX_BYTES);
+	b.firsts = malloc(sizeof(unsigned short) * a->elements * ANAGRAM_INDEX_CHUNK);
+	b.lasts = malloc(sizeof(unsigned short) * a->elements * ANAGRAM_INDEX_CHUNK);
+	b.kinds = malloc((size_t)a->elements * ANAGRAM_INDEX_CHUNK);
+	if (input == NULL || b.directory == NULL || b.output == NULL
+		|| b.firsts == NULL || b.lasts == NULL || b.kinds == NULL) {
+		errn = ENOMEM;
+		goto failure;
+	}
+
+	b.file = stream_open(path, "w+");
+	if (b.file == NULL) {
+		errn = errno;
+		goto failure;
+	}
+
+	/* header is written last */
+	memset(header, 0, ANAGRAM_INDEX_HEADER);
+	if (stream_write(b.file, header, ANAGRAM_INDEX_HEADER) != ANAGRAM_INDEX_HEADER) {
+		errn = errno;
+		goto failure;
+	}
+	for (v = 0; v < distinct; v++) {
+		put32(field, values[v]);
+		if (stream_write(b.file, field, 4) != 4) {
+			errn = errno;
+			goto failure;
+		}
+	}
+	b.offset = ANAGRAM_INDEX_HEADER + 4L * distinct;
+
+	/*
+	 * Records are read in blocks and split into runs of equal elements at
+	 * each position; lexicographic order makes them long at the first
+	 * positions. Runs are turned into containers at the end of each chunk.
+	 */
+	if (io_seek(a, 3L * a->bytes) < 0) {
+		errn = errno;
+		goto failure;
+	}
+	for (index = 0; index < a->permutations; index += block) {
+		block = a->permutations - index;
+		if (block > ANAGRAM_EXPORT_RECORDS)
+			block = ANAGRAM_EXPORT_RECORDS;
+		if ((size = io_read(a, input, (long)block * a->bytes)) != (long)block * a->bytes) {
+			errn = size < 0 ? errno : EBADF;
+			goto failure;
+		}
+		for (i = 0; i < block; i++) {
+			memcpy(record, input + (long)i * a->bytes, a->bytes);
+			record[a->bytes] = '\0';
+			if (utf8_elements(record, elements) != a->elements) {
+				errn = EBADF;
+				goto failure;
+			}
+			local = (index + i) % ANAGRAM_INDEX_CHUNK;
+			for (p = 0; p < a->elements; p++) {
+				for (v = 0; v < distinct && values[v] != elements[p]; v++)
+					;
+				if (v == distinct) {
+					errn = EBADF;
+					goto failure;
+				}
+				last = p * ANAGRAM_INDEX_CHUNK + b.runs[p] - 1;
+				kind = b.runs[p] > 0 ? b.kinds[last] : -1;
+				if (kind == v)
+					b.lasts[last] = (unsigned short)local;
+				else {
+					last++;
+					b.firsts[last] = (unsigned short)local;
+					b.lasts[last] = (unsigned short)local;
+					b.kinds[last] = (unsigned char)v;
+					b.runs[p]++;
+				}
+			}
+			if (local == ANAGRAM_INDEX_CHUNK - 1 || index + i == a->permutations - 1) {
+				if (!index_flush(&b, a->elements, distinct,
+					(index + i) / ANAGRAM_INDEX_CHUNK, chunks)) {
+					errn = errno;
+					goto failure;
+				}
+			}
+		}
+	}
+
+	/* directory, then header */
+	size = (long)a->elements * distinct * chunks * 8;
+	if (stream_write(b.file, b.directory, size) != size) {
+		errn = errno;
+		goto failure;
+	}
+	memcpy(header, ANAGRAM_INDEX_MAGIC, 8);
+	put32(header + 8, a->permutations);
+	put32(header + 12, a->elements);
+	put32(header + 16, distinct);
+	put32(header + 20, chunks);
+	put32(header + 24, b.offset);
+	if (stream_sync(b.file) != 0 || stream_seek(b.file, 0) < 0
+		|| stream_write(b.file, header, ANAGRAM_INDEX_HEADER) != ANAGRAM_INDEX_HEADER
+		|| stream_sync(b.file) != 0) {
+		errn = errno;
+		goto failure;
+	}
+
+	stream_close(b.file);
+	free(input);
+	free(b.directory);
+	free(b.output);
+	free(b.firsts);
+	free(b.lasts);
+	free(b.kinds);
+
+	return 1;
+
+	failure:
+		if (b.file != NULL) {
+			stream_close(b.file);
+			unlink(path);
+		}
+		free(input);
+		free(b.directory);
+		free(b.output);
+		free(b.firsts);
+		free(b.lasts);
+		free(b.kinds);
+		errno = errn;
+		return 0;
+
+}
+
+
+anagram_index_ref anagram_index_open(const char *path)
+{
+
+	stream *file;
+	struct anagram_index *x;
+	struct index_container *c;
+	unsigned char *data, *entry, *bytes;
+	long size, directory, offset, runs, pairs, bitmaps;
+	int count, i, j, k, errn;
+
+	file = NULL;
+	data = NULL;
+
+	x = calloc(1, sizeof(struct anagram_index));
+	if (x == NULL)
+		return NULL;
+
+	file = stream_open(path, "r+");
+	if (file == NULL) {
+		errn = errno;
+		goto failure;
+	}
+
+	/* the index is small next to the list: read it whole */
+	if ((size = stream_end(file)) < 0 || stream_seek(file, 0) < 0) {
+		errn = errno;
+		goto failure;
+	}
+	if (size < ANAGRAM_INDEX_HEADER || (data = malloc(size)) == NULL) {
+		errn = size < ANAGRAM_INDEX_HEADER ? EBADF : ENOMEM;
+		goto failure;
+	}
+	if (stream_read(file, data, size) != size) {
+		errn = EBADF;
+		goto failure;
+	}
+	stream_close(file);
+	file = NULL;
+
+	/* check header */
+	x->records = (int)get32(data + 8);
+	x->positions = (int)get32(data + 12);
+	x->distinct = (int)get32(data + 16);
+	x->chunks = (int)get32(data + 20);
+	directory = get32(data + 24);
+	count = x->positions * x->distinct * x->chunks;
+	if (memcmp(data, ANAGRAM_INDEX_MAGIC, 8) != 0
+		|| x->positions < 1 || x->positions > ANAGRAM_ELEMENT_LIMIT
+		|| x->distinct < 1 || x->distinct > x->positions
+		|| x->chunks != (x->records + ANAGRAM_INDEX_CHUNK - 1) / ANAGRAM_INDEX_CHUNK
+		|| directory < ANAGRAM_INDEX_HEADER + 4L * x->distinct
+		|| directory + 8L * count != size) {
+		errn = EBADF;
+		goto failure;
+	}
+	for (i = 0; i < x->distinct; i++)
+		x->values[i] = get32(data + ANAGRAM_INDEX_HEADER + 4 * i);
+
+	/* size the containers */
+	pairs = 0, bitmaps = 0;
+	for (i = 0; i < count; i++) {
+		entry = data + directory + 8L * i;
+		offset = get32(entry);
+		runs = get32(entry + 4);
+		if (runs == ANAGRAM_INDEX_BITMAP) {
+			bitmaps++;
+			runs = ANAGRAM_INDEX_BYTES / 4;
+		}
+		else
+			pairs += runs;
+		if (runs > ANAGRAM_INDEX_CHUNK || offset < ANAGRAM_INDEX_HEADER
+			|| offset + 4 * runs > directory) {
+			errn = EBADF;
+			goto failure;
+		}
+	}
+	x->containers = malloc(sizeof(struct index_container) * count + 1);
+	x->pairs = malloc(sizeof(unsigned short) * 2 * pairs + 1);
+	x->bits = malloc(sizeof(unsigned long) * ANAGRAM_INDEX_WORDS * bitmaps + 1);
+	if (x->containers == NULL || x->pairs == NULL || x->bits == NULL) {
+		errn = ENOMEM;
+		goto failure;
+	}
+
+	/* unpack them: runs as 16-bit pairs, bitmaps as native words */
+	pairs = 0, bitmaps = 0;
+	for (i = 0; i < count; i++) {
+		entry = data + directory + 8L * i;
+		bytes = data + get32(entry);
+		runs = get32(entry + 4);
+		c = &x->containers[i];
+		if (runs == ANAGRAM_INDEX_BITMAP) {
+			c->runs = -1;
+			c->pairs = NULL;
+			c->bits = x->bits + bitmaps * ANAGRAM_INDEX_WORDS;
+			for (j = 0; j < ANAGRAM_INDEX_WORDS; j++) {
+				c->bits[j] = 0;
+				for (k = 0; k < ANAGRAM_INDEX_WORD_BITS / 8; k++)
+					c->bits[j] |= (unsigned long)bytes[j * (ANAGRAM_INDEX_WORD_BITS / 8) + k] << (8 * k);
+			}
+			bitmaps++;
+		}
+		else {
+			c->runs = (int)runs;
+			c->pairs = x->pairs + 2 * pairs;
+			c->bits = NULL;
+			for (j = 0; j < 2 * runs; j++)
+				c->pairs[j] = (unsigned short)(bytes[2 * j] | (bytes[2 * j + 1] << 8));
+			pairs += runs;
+		}
+	}
+
+	free(data);
+
+	return x;
+
+	failure:
+		if (file != NULL)
+			stream_close(file);
+		free(data);
+		anagram_index_release(x);
+		errno = errn;
+		return NULL;
+
+}
+
+
+int anagram_index_count(anagram_index_ref x)
+{
+	if (x != NULL)
+		return x->records;
+	return -1;
+}
+
+
+int anagram_index_query(anagram_index_ref x, const anagram_condition *conditions,
+	int count, int *ranks, int size)
+{
+
+	unsigned long result[ANAGRAM_INDEX_WORDS], mask[ANAGRAM_INDEX_WORDS], word;
+	long elements[ANAGRAM_ELEMENT_LIMIT];
+	int positions[ANAGRAM_ELEMENT_LIMIT], sets[ANAGRAM_ELEMENT_LIMIT];
+	int total, chunk, limit, length, bit, i, j, v;
+
+	if (x == NULL || count < 0 || count > ANAGRAM_ELEMENT_LIMIT
+		|| (count > 0 && conditions == NULL) || size < 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	/* resolve positions and turn element sets into bit sets of values */
+	for (i = 0; i < count; i++) {
+		positions[i] = conditions[i].position;
+		if (positions[i] < 0)
+			positions[i] += x->positions;
+		if (positions[i] < 0 || positions[i] >= x->positions || conditions[i].element == NULL
+			|| (length = utf8_elements(conditions[i].element, elements)) < 1) {
+			errno = EINVAL;
+			return -1;
+		}
+		sets[i] = 0;
+		for (j = 0; j < length; j++)
+			for (v = 0; v < x->distinct; v++)
+				if (x->values[v] == elements[j])
+					sets[i] |= 1 << v;
+	}
+
+	/*
+	 * Each chunk starts with every record and is narrowed, one condition at
+	 * a time, by the union (OR) of the containers of its elements, negated
+	 * if so asked; whole words are combined at once.
+	 */
+	total = 0;
+	for (chunk = 0; chunk < x->chunks; chunk++) {
+		limit = x->records - chunk * ANAGRAM_INDEX_CHUNK;
+		if (limit > ANAGRAM_INDEX_CHUNK)
+			limit = ANAGRAM_INDEX_CHUNK;
+		for (j = 0; j < ANAGRAM_INDEX_WORDS; j++) {
+			if ((j + 1) * ANAGRAM_INDEX_WORD_BITS <= limit)
+				result[j] = ~0UL;
+			else if (j * ANAGRAM_INDEX_WORD_BITS >= limit)
+				result[j] = 0;
+			else
+				result[j] = (1UL << (limit - j * ANAGRAM_INDEX_WORD_BITS)) - 1;
+		}
+		for (i = 0; i < count; i++) {
+			memset(mask, 0, sizeof(mask));
+			for (v = 0; v < x->distinct; v++)
+				if (sets[i] & (1 << v))
+					index_or(&x->containers[(positions[i] * x->distinct + v) * x->chunks + chunk], mask);
+			if (conditions[i].negate)
+				for (j = 0; j < ANAGRAM_INDEX_WORDS; j++)
+					result[j] &= ~mask[j];
+			else
+				for (j = 0; j < ANAGRAM_INDEX_WORDS; j++)
+					result[j] &= mask[j];
+		}
+		for (j = 0; j < ANAGRAM_INDEX_WORDS; j++) {
+			for (word = result[j]; word != 0; word &= word - 1) {
+				if (ranks != NULL && total < size) {
+					for (bit = 0; !(word & (1UL << bit)); bit++)
+						;
+					ranks[total] = chunk * ANAGRAM_INDEX_CHUNK + j * ANAGRAM_INDEX_WORD_BITS + bit;
+				}
+				total++;
+			}
+		}
+	}
+
+	return total;
+
+}
+
+
+void anagram_index_release(anagram_index_ref x)
+{
+	if (x == NULL)
+		return;
+	free(x->containers);
+	free(x->pairs);
+	free(x->bits);
+	free(x);
+}
+
+
+int anagram_export(anagram_ref a, int fd, int format)
+{
+
+	struct anagram *owner;
+	unsigned char fixed[ANAGRAM_HEADER_FIXED];
+	char *input, *output, *in, *out;
+	char digits[12];
+	long size, start;
+	int done, total, block, width, first, i, j, errn;
+
+	input = NULL, output = NULL;
+
+	if (a == NULL || fd < 0 || format < ANAGRAM_EXPORT_NUMBERED
+		|| format > ANAGRAM_EXPORT_IMAGE) {
+		errn = EINVAL;
+		goto failure;
+	}
+
+	/* an image covers every record, control records included, after the
+	 * header of the file that holds them */
+	if (format == ANAGRAM_EXPORT_IMAGE) {
+		start = 0;
+		total = a->permutations + 3;
+		owner = a->shared != NULL ? a->shared : a;
+		if (owner->header != NULL) {
+			header_encode(owner->header, owner->permutations, owner->complete, fixed);
+			if (!write_all(fd, (const char *)fixed, ANAGRAM_HEADER_FIXED)
+				|| !write_all(fd, (const char *)owner->header->data + ANAGRAM_HEADER_FIXED,
+				owner->header->size - ANAGRAM_HEADER_FIXED)) {
+				errn = errno;
+				goto failure;
+			}
+		}
+	}
+	else {
+		start = (long)a->base + 3L;
+		total = a->count;
+	}
+
+	if (total == 0)
+		return 0;
+
+	/* raw records are written straight from the input block; the other
+	 * formats need at most 11 digits, ". " and a delimiter per record */
+	input = malloc((size_t)ANAGRAM_EXPORT_RECORDS * a->bytes);
+	if (format < ANAGRAM_EXPORT_RAW)
+		output = malloc((size_t)ANAGRAM_EXPORT_RECORDS * (a->bytes + 14));
+	if (input == NULL || (format < ANAGRAM_EXPORT_RAW && output == NULL)) {
+		errn = ENOMEM;
+		goto failure;
+	}
+
+	/* line number kept as a right-aligned decimal string, incremented in
+	 * place instead of being formatted for every record */
+	memset(digits, '0', sizeof(digits));
+	width = ANAGRAM_EXPORT_DIGITS;
+	first = (int)sizeof(digits) - ANAGRAM_EXPORT_DIGITS;
+
+	if (io_seek(a, start * (long)a->bytes) < 0) {
+		errn = errno;
+		goto failure;
+	}
+
+	for (done = 0; done < total; done += block) {
+
+		block = total - done;
+		if (block > ANAGRAM_EXPORT_RECORDS)
+			block = ANAGRAM_EXPORT_RECORDS;
+
+		size = (long)block * a->bytes;
+		if ((size = io_read(a, input, size)) != (long)block * a->bytes) {
+			errn = size < 0 ? errno : EBADF;
+			goto failure;
+		}
+
+		/* the image of an alias holds its own source string */
+		if (start + done == 0 && a->shared != NULL)
+			memcpy(input, a->source, a->bytes);
+
+		if (format >= ANAGRAM_EXPORT_RAW) {
+			if (!write_all(fd, input, size)) {
+				errn = errno;
+				goto failure;
+			}
+			continue;
+		}
+
+		in = input, out = output;
+		for (i = 0; i < block; i++, in += a->bytes) {
+			if (format == ANAGRAM_EXPORT_NUMBERED) {
+				for (j = (int)sizeof(digits) - 1; digits[j] == '9'; j--)
+					digits[j] = '0';
+				digits[j]++;
+				if (j < first) {
+					first = j;
+					width++;
+				}
+				memcpy(out, digits + sizeof(digits) - width, width);
+				out += width;
+				*out++ = '.';
+				*out++ = ' ';
+			}
+			memcpy(out, in, a->bytes);
+			out += a->bytes;
+			*out++ = format == ANAGRAM_EXPORT_NUL ? '\0' : '\n';
+		}
+
+		if (!write_all(fd, output, (long)(out - output))) {
+			errn = errno;
+			goto failure;
+		}
+
+	}
+
+	free(input);
+	free(output);
+
+	return format == ANAGRAM_EXPORT_IMAGE ? total - 3 : total;
+
+	failure:
+		free(input);
+		free(output);
+		errno = errn;
+		return -1;
+
+}
+
+
+void anagram_release(anagram_ref a)
+{
+	if (a == NULL)
+		return;
+	a->references--;
+	if (a->references == 0) {
+#ifndef ANAGRAM_NO_STATS
+		pthread_mutex_lock(&stats_mutex);
+		stats_merge(&stats_global, &a->stats);
+		pthread_mutex_unlock(&stats_mutex);
+#endif
+		io_close(a);
+		free(a);
+	}
+}
+
+
+int anagram_get_stats(anagram_ref a, anagram_stats *stats)
+{
+
+#ifndef ANAGRAM_NO_STATS
+
+	if (stats == NULL) {
+		errno = EINVAL;
+		return 0;
+	}
+
+	if (a != NULL) {
+		memcpy(stats, &a->stats, sizeof(anagram_stats));
+		return 1;
+	}
+
+	pthread_mutex_lock(&stats_mutex);
+	memcpy(stats, &stats_global, sizeof(anagram_stats));
+	pthread_mutex_unlock(&stats_mutex);
+
+	return 1;
+
+#else
+
+	if (stats != NULL)
+		memset(stats, 0, sizeof(anagram_stats));
+	errno = stats == NULL ? EINVAL : ENOTSUP;
+	return 0;
+
+#endif
+
+}
+
+
+void anagram_reset_stats(anagram_ref a)
+{
+#ifndef ANAGRAM_NO_STATS
+	if (a != NULL) {
+		memset(&a->stats, 0, sizeof(anagram_stats));
+		return;
+	}
+	pthread_mutex_lock(&stats_mutex);
+	memset(&stats_global, 0, sizeof(anagram_stats));
+	pthread_mutex_unlock(&stats_mutex);
+#endif
+}
+
+
+int anagram_stats_timing(int enable)
+{
+#ifndef ANAGRAM_NO_STATS
+	int previous;
+	previous = stats_timing;
+	stats_timing = enable != 0;
+	return previous;
+#else
+	return 0;
+#endif
+}
+
+
+int anagram_sub_total(const char *string, int k)
+{
+
+	long elements[ANAGRAM_ELEMENT_LIMIT], values[ANAGRAM_ELEMENT_LIMIT];
+	int counts[ANAGRAM_ELEMENT_LIMIT], length, distinct;
+
+	if (string == NULL || (length = utf8_elements(string, elements)) < 2
+		|| k < 1 || k > length) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	sort(elements, length);
+	distinct = histogram(elements, length, values, counts);
+
+	return (int)sub_extensions(counts, distinct, 0, k);
+
+}
+
+
+anagram_sub_ref anagram_sub_create(const char *path, const char *string, int k)
+{
+
+	struct anagram_sub s, *sp;
+	unsigned char header[ANAGRAM_SUB_HEADER];
+	int errn;
+
+	/* initialize local storage */
+	memset(&s, 0, sizeof(struct anagram_sub));
+	
+	/* check source string and arrangement length */
+	if (path == NULL || string == NULL) {
+		errn = EINVAL;
+		goto failure;
+	}
+	s.elements = utf8_strlen(string, NULL);
+	if (s.elements < 2 || s.elements > ANAGRAM_ELEMENT_LIMIT
+		|| strlen(string) > ANAGRAM_SIZE_LIMIT - 1 || k < 1 || k > s.elements) {
+		errn = EINVAL;
+		goto failure;
+	}
+	strcpy(s.source, string);
+	s.k = k;
+	s.end = ANAGRAM_SUB_HEADER;
+
+	/* create file and write header */
+	memset(header, 0, ANAGRAM_SUB_HEADER);
+	memcpy(header, ANAGRAM_SUB_MAGIC, 8);
+	put32(header + 8, k);
+	memcpy(header + ANAGRAM_SUB_SOURCE, string, strlen(string));
+	s.io.file = stream_open(path, "w+");
+	if (s.io.file == NULL) {
+		errn = errno;
+		goto failure;
+	}
+	if (io_write(&s.io, (const char *)header, ANAGRAM_SUB_HEADER) != ANAGRAM_SUB_HEADER
+		|| io_sync(&s.io) != 0) {
+		errn = errno;
+		goto failure;
+	}
+
+	sp = malloc(sizeof(struct anagram_sub));
+	if (sp == NULL) {
+		errn = errno;
+		goto failure;
+	}
+	memcpy(sp, &s, sizeof(struct anagram_sub));
+
+	return sp;
+
+	failure:
+		io_close(&s.io);
+		errno = errn;
+		return NULL;
+
+}
+
+
+anagram_sub_ref anagram_sub_open(const char *path)
+{
+
+	struct anagram_sub s, *sp;
+	unsigned char header[ANAGRAM_SUB_HEADER];
+	long limit, count;
+	int rank, errn;
+
+	/* initialize local storage */
+	memset(&s, 0, sizeof(struct anagram_sub));
+	
+	if (path == NULL) {
+		errn = EINVAL;
+		goto failure;
+	}
+
+	s.io.file = stream_open(path, "r+");
+	if (s.io.file == NULL) {
+		errn = errno;
+		goto failure;
+	}
+
+	/* read and check header */
+	if (io_seek(&s.io, 0) < 0) {
+		errn = errno;
+		goto failure;
+	}
+	if (io_read(&s.io, (char *)header, ANAGRAM_SUB_HEADER) != ANAGRAM_SUB_HEADER
+		|| memcmp(header, ANAGRAM_SUB_MAGIC, 8) != 0) {
+		errn = EBADF;
+		goto failure;
+	}
+	memcpy(s.source, header + ANAGRAM_SUB_SOURCE, ANAGRAM_SIZE_LIMIT - 1);
+	s.k = (int)get32(header + 8);
+	s.elements = utf8_strlen(s.source, NULL);
+	if (s.elements < 2 || s.elements > ANAGRAM_ELEMENT_LIMIT || s.k < 1 || s.k > s.elements) {
+		errn = EBADF;
+		goto failure;
+	}
+
+	/* records end where the rank index starts, once it is being written;
+	 * before that, at the last null byte of the file (an interrupted write
+	 * leaves a record without one) */
+	limit = get32(header + 12);
+	if (limit == 0 && (limit = io_end(&s.io)) < 0) {
+		errn = errno;
+		goto failure;
+	}
+	if (!sub_last(&s, limit)) {
+		errn = errno;
+		goto failure;
+	}
+
+	/* the rank of the last record tells how many precede it */
+	if (s.end > ANAGRAM_SUB_HEADER) {
+		if ((rank = anagram_sub_rank(&s, s.buffer)) < 0) {
+			errn = EBADF;
+			goto failure;
+		}
+		s.count = rank + 1;
+	}
+
+	/* a non-zero record count marks a complete list with its rank index */
+	count = get32(header + 16);
+	if (count != 0) {
+		if (count != s.count || count != anagram_sub_total(s.source, s.k)) {
+			errn = EBADF;
+			goto failure;
+		}
+		s.complete = 1;
+	}
+
+	sp = malloc(sizeof(struct anagram_sub));
+	if (sp == NULL) {
+		errn = errno;
+		goto failure;
+	}
+	memcpy(sp, &s, sizeof(struct anagram_sub));
+
+	return sp;
+
+	failure:
+		io_close(&s.io);
+		errno = errn;
+		return NULL;
+
+}
+
+
+int anagram_sub_generate(anagram_sub_ref s, void *argument, anagram_callback_f callback)
+{
+
+	long elements[ANAGRAM_ELEMENT_LIMIT], values[ANAGRAM_ELEMENT_LIMIT];
+	int counts[ANAGRAM_ELEMENT_LIMIT], stack[ANAGRAM_ELEMENT_LIMIT];
+	int offsets[ANAGRAM_ELEMENT_LIMIT + 1];
+	int length, distinct, depth, offset, index;
+	int i, errn, canceled;
+	char buffer[ANAGRAM_SIZE_LIMIT];
+
+	if (s == NULL) {
+		errn = EINVAL;
+		goto failure;
+	}
+
+	if (s->complete)
+		return 1;
+
+	/* initialize locals */
+	length = utf8_elements(s->source, elements);
+	sort(elements, length);
+	distinct = histogram(elements, length, values, counts);
+	index = s->count;
+	offsets[0] = 0;
+	depth = 0;
+
+	/* resume below the last written record: rebuild its path in the tree */
+	if (index > 0) {
+		length = utf8_elements(s->buffer, elements);
+		for (depth = 0; depth < length; depth++) {
+			for (i = 0; values[i] != elements[depth]; i++)
+				;
+			counts[i]--;
+			stack[depth] = i;
+			offsets[depth + 1] = offsets[depth];
+			utf8_encode(buffer, &offsets[depth + 1], elements[depth]);
+		}
+		length = s->elements;
+	}
+
+	/* set file offset */
+	if (io_seek(&s->io, s->end) < 0) {
+		errn = errno;
+		goto failure;
+	}
+
+	/* clear canceled flag */
+	canceled = 0;
+
+	/*
+	 * Walk the tree of arrangements in preorder, which is lexicographic order
+	 * with every prefix before its extensions. Each step changes only the
+	 * deepest element, so the encoded prefix is shared and only one element
+	 * is encoded per record.
+	 */
+	while (sub_next(counts, distinct, stack, &depth, length)) {
+		offset = offsets[depth - 1];
+		utf8_encode(buffer, &offset, values[stack[depth - 1]]);
+		offsets[depth] = offset;
+		if (depth < s->k)
+			continue;
+		buffer[offset++] = '\0';
+		if (io_write(&s->io, buffer, offset) != offset) {
+			errn = errno;
+			goto failure;
+		}
+		memcpy(s->buffer, buffer, offset);
+		s->end += offset;
+		s->count = ++index;
+		if (callback != NULL && !callback(argument, index, buffer)) {
+			canceled = 1;
+			break;
+		}
+	}
+
+	if (!canceled && !sub_index(s)) {
+		errn = errno;
+		goto failure;
+	}
+
+	/* flush changes to file */
+	if (io_sync(&s->io) != 0) {
+		errn = errno;
+		goto failure;
+	}
+
+	return 1;
+
+	failure:
+		errno = errn;
+		return 0;
+
+}
+
+
+int anagram_sub_count(anagram_sub_ref s)
+{
+	if (s != NULL)
+		return s->count;
+	return -1;
+}
+
+
+int anagram_sub_is_complete(anagram_sub_ref s)
+{
+	if (s != NULL)
+		return s->complete;
+	return 0;
+}
+
+
+const char *anagram_sub_string(anagram_sub_ref s, int rank)
+{
+
+	unsigned char entry[4];
+	long offset, size;
+	int errn;
+
+	if (s == NULL) {
+		errn = EINVAL;
+		goto failure;
+	}
+
+	if (!s->complete) {
+		errn = EAGAIN;
+		goto failure;
+	}
+
+	if (rank < 0 || rank >= s->count) {
+		errn = ERANGE;
+		goto failure;
+	}
+
+	/* the rank index holds the offset of every record */
+	if (io_seek(&s->io, s->end + 4L * rank) < 0) {
+		errn = errno;
+		goto failure;
+	}
+	if ((size = io_read(&s->io, (char *)entry, 4)) != 4) {
+		errn = size < 0 ? errno : EBADF;
+		goto failure;
+	}
+	offset = get32(entry);
+
+	size = s->end - offset;
+	if (size > ANAGRAM_SIZE_LIMIT)
+		size = ANAGRAM_SIZE_LIMIT;
+	if (offset < ANAGRAM_SUB_HEADER || size < 1 || io_seek(&s->io, offset) < 0) {
+		errn = offset < ANAGRAM_SUB_HEADER || size < 1 ? EBADF : errno;
+		goto failure;
+	}
+	if (io_read(&s->io, s->buffer, size) != size || memchr(s->buffer, '\0', size) == NULL) {
+		errn = EBADF;
+		goto failure;
+	}
+
+	return s->buffer;
+
+	failure:
+		errno = errn;
+		return NULL;
+
+}
+
+
+int anagram_sub_rank(anagram_sub_ref s, const char *string)
+{
+
+	long elements[ANAGRAM_ELEMENT_LIMIT], sorted[ANAGRAM_ELEMENT_LIMIT];
+	long values[ANAGRAM_ELEMENT_LIMIT];
+	int counts[ANAGRAM_ELEMENT_LIMIT], length, distinct, i, j;
+	long rank;
+
+	if (s == NULL || string == NULL || (length = utf8_elements(string, elements)) < s->k) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	utf8_elements(s->source, sorted);
+	sort(sorted, s->elements);
+	distinct = histogram(sorted, s->elements, values, counts);
+
+	/*
+	 * Every proper prefix of length k or more comes first, then, at each
+	 * position, the whole subtree of every smaller element still available.
+	 */
+	rank = 0;
+	for (i = 0; i < length; i++) {
+		if (i >= s->k)
+			rank++;
+		for (j = 0; j < distinct && values[j] != elements[i]; j++) {
+			if (counts[j] > 0) {
+				counts[j]--;
+				rank += (long)sub_extensions(counts, distinct, i + 1, s->k);
+				counts[j]++;
+			}
+		}
+		if (j == distinct || counts[j] == 0) {
+			errno = EINVAL;
+			return -1;
+		}
+		counts[j]--;
+	}
+
+	return (int)rank;
+
+}
+
+
+void anagram_sub_release(anagram_sub_ref s)
+{
+	if (s == NULL)
+		return;
+#ifndef ANAGRAM_NO_STATS
+	pthread_mutex_lock(&stats_mutex);
+	stats_merge(&stats_global, &s->io.stats);
+	pthread_mutex_unlock(&stats_mutex);
+#endif
+	io_close(&s->io);
+	free(s);
+}
+
+
+anagram_cursor_ref anagram_cursor_create(const char *string, int rank)
+{
+
+	struct anagram_cursor *c;
+	long values[ANAGRAM_ELEMENT_LIMIT];
+	int counts[ANAGRAM_ELEMENT_LIMIT], bytes, distinct;
+
+	if (string == NULL || utf8_strlen(string, &bytes) < 2 || bytes >= ANAGRAM_SIZE_LIMIT) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	c = malloc(sizeof(struct anagram_cursor));
+	if (c == NULL)
+		return NULL;
+
+	memset(c, 0, sizeof(struct anagram_cursor));
+	c->length = utf8_elements(string, c->elements);
+	if (c->length < 2) {
+		free(c);
+		errno = EINVAL;
+		return NULL;
+	}
+
+	sort(c->elements, c->length);
+	c->total = multinomial(c->elements, c->length);
+
+	if (rank < 0 || rank >= c->total) {
+		free(c);
+		errno = ERANGE;
+		return NULL;
+	}
+
+	/* the first permutation is the sorted one */
+	c->rank = rank;
+	if (rank > 0) {
+		distinct = histogram(c->elements, c->length, values, counts);
+		unrank(values, counts, distinct, c->length, c->total, rank, c->elements);
+	}
+
+	return c;
+
+}
+
+
+const char *anagram_cursor_next(anagram_cursor_ref c)
+{
+
+	int i, offset;
+
+	if (c == NULL) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	if (c->rank >= c->total)
+		return NULL;
+
+	for (i = 0, offset = 0; i < c->length; i++)
+		utf8_encode(c->buffer, &offset, c->elements[i]);
+	c->buffer[offset] = '\0';
+
+	/* step ahead, unless this is the last permutation */
+	if (++c->rank < c->total)
+		permute(c->elements, c->length);
+
+	return c->buffer;
+
+}
+
+
+int anagram_cursor_rank(anagram_cursor_ref c)
+{
+	if (c != NULL)
+		return (int)c->rank;
+	return -1;
+}
+
+
+void anagram_cursor_release(anagram_cursor_ref c)
+{
+	free(c);
+}
+
+
+/*
+ * Static Function Implementation
+ */
+
+
+static anagram_ref load(struct anagram *init)
+{
+
+	struct anagram a, *ap;
+	ldiv_t division;
+	long size;
+	int i, errn;
+
+	/* work on a local copy of the partially initialized object */
+	memcpy(&a, init, sizeof(struct anagram));
+
+	/* populate buffer with file data
+	 * reading ANAGRAM_SIZE_LIMIT - 1 ensures the buffer is null-byte terminated */
+	size = io_read(&a, a.buffer, ANAGRAM_SIZE_LIMIT - 1);
+
+	/* skip the header, which holds the permutation count and completion
+	 * flag, to the control records */
+	if (size >= 8 && memcmp(a.buffer, ANAGRAM_HEADER_MAGIC, 8) == 0) {
+		if (!header_load(&a)) {
+			errn = errno;
+			goto failure;
+		}
+		memset(a.buffer, 0, ANAGRAM_SIZE_LIMIT);
+		size = io_seek(&a, 0) < 0 ? -1 : io_read(&a, a.buffer, ANAGRAM_SIZE_LIMIT - 1);
+	}
+
+	if (size < ANAGRAM_FILE_MINSIZE) {
+		errn = size < 0 ? errno : EBADF;
+		goto failure;
+	}
+
+	/* calculate sizes */
+	a.elements = utf8_strlen(a.buffer, &a.bytes);
+	if (a.elements < 2 || a.elements > ANAGRAM_ELEMENT_LIMIT
+		|| a.bytes < 2 || a.bytes > ANAGRAM_SIZE_LIMIT - 1) {
+		errn = EINVAL;
+		goto failure;
+	}
+
+	/* copy source string */
+	memcpy(a.source, a.buffer, a.bytes);
+
+	/* get file size */
+	size = io_end(&a);
+
+	if (a.header != NULL) {
+		/* records past the count were left by an interrupted run and are
+		 * overwritten when it is resumed */
+		if (a.header->bytes != a.bytes || size < (a.permutations + 3L) * a.bytes) {
+			errn = EBADF;
+			goto failure;
+		}
+	}
+	else {
+		/* check record count */
+		division = ldiv(size, a.bytes);
+		if (division.rem != 0 || division.quot < 3 || division.quot > INT_MAX) {
+			errn = EBADF;
+			goto failure;
+		}
+
+		/* save current permutation count
+		 * total of records minus the first three control records */
+		a.permutations = (int)division.quot - 3;
+	}
+
+	/* read second record */
+	if (!load_kind(&a)) {
+		errn = errno;
+		goto failure;
+	}
+
+	/* without a header, a third record that is not zero filled marks the
+	 * list as complete */
+	if (a.header == NULL) {
+		memset(a.buffer, 0, ANAGRAM_SIZE_LIMIT);
+		if ((size = io_read(&a, a.buffer, a.bytes)) != a.bytes) {
+			errn = size < 0 ? errno : EBADF;
+			goto failure;
+		}
+		for (i = 0; i < a.bytes; i++) {
+			if (*(a.buffer + i) != '\0') {
+				a.complete = 1;
+				break;
+			}
+		}
+	}
+
+	/* set result */
+	a.base = 0;
+	a.count = a.permutations;
+
+	/* try to allocate space from heap */
+	ap = malloc(sizeof(struct anagram));
+	if (ap == NULL) {
+		errn = errno;
+		goto failure;
+	}
+
+	/* initialize reference count */
+	a.references = 1;
+
+	/* copy local data to heap */
+	memcpy(ap, &a, sizeof(struct anagram));
+
+	/* success! */
+	return ap;
+
+	failure:
+		header_release(a.header);
+		errno = errn;
+		return NULL;
+
+}
+
+
+static int load_kind(struct anagram *a)
+{
+
+	/*
+	 * The second record is zero filled or, after a null byte (which keeps the
+	 * source string terminated), holds either the decimal rank of the first
+	 * permutation of a shard, the letter 'A' + m of a list constrained to at
+	 * most m fixed points or 'g' for minimal-change order.
+	 */
+
+	long size;
+	int i;
+	char *end;
+
+	if (io_seek(a, (long)a->bytes) < 0)
+		return 0;
+
+	memset(a->buffer, 0, ANAGRAM_SIZE_LIMIT);
+	if ((size = io_read(a, a->buffer, a->bytes)) != a->bytes) {
+		if (size >= 0)
+			errno = EBADF;
+		return 0;
+	}
+
+	a->shard = 0, a->first = 0, a->constraint = 0, a->gray = 0;
+	end = a->buffer + 1;
+	if (a->buffer[1] >= '0' && a->buffer[1] <= '9') {
+		a->first = (int)strtol(a->buffer + 1, &end, 10);
+		a->shard = 1;
+	}
+	else if (a->buffer[1] >= 'A' && a->buffer[1] <= 'A' + ANAGRAM_ELEMENT_LIMIT) {
+		a->constraint = a->buffer[1] - 'A' + 1;
+		end = a->buffer + 2;
+	}
+	else if (a->buffer[1] == 'g') {
+		a->gray = 1;
+		end = a->buffer + 2;
+	}
+	if (a->buffer[0] != '\0' || a->first < 0)
+		end = a->buffer;
+	for (i = (int)(end - a->buffer); i < a->bytes; i++) {
+		if (*(a->buffer + i) != '\0') {
+			errno = EBADF;
+			return 0;
+		}
+	}
+
+	return 1;
+
+}
+
+
+static int io_seek(struct anagram *a, long offset)
+{
+	STATS_ADD(a, seeks, 1);
+	return io_locate(a, offset);
+}
+
+
+static long io_read(struct anagram *a, char *buffer, long size)
+{
+
+	stats_mark mark;
+	long result;
+
+	STATS_MARK(mark);
+	result = io_fetch(a, buffer, size);
+	STATS_LAP(a, io_time, mark);
+	STATS_ADD(a, reads, 1);
+	if (result > 0)
+		STATS_ADD(a, bytes_read, result);
+
+	return result;
+
+}
+
+
+static int io_locate(struct anagram *a, long offset)
+{
+
+	/* an alias keeps a position of its own, so it can be read alongside
+	 * the object it shares */
+	if (a->shared != NULL) {
+		if (offset < 0) {
+			errno = EINVAL;
+			return -1;
+		}
+		a->position = offset;
+		return 0;
+	}
+
+	/* offsets are relative to the control records */
+	if (a->header != NULL) {
+		if (offset < 0) {
+			errno = EINVAL;
+			return -1;
+		}
+		a->header->position = offset;
+		offset += a->header->size;
+	}
+
+	if (a->file != NULL)
+		return stream_seek(a->file, offset) < 0 ? -1 : 0;
+
+	if (offset < 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	a->position = offset;
+
+	return 0;
+
+}
+
+
+static long io_fetch(struct anagram *a, char *buffer, long size)
+{
+
+	/* reads for "io_read", which counts them once, on the object asked */
+
+	long result;
+
+	if (a->shared != NULL) {
+		if (io_locate(a->shared, a->position) < 0)
+			return -1;
+		result = io_fetch(a->shared, buffer, size);
+		if (result > 0)
+			a->position += result;
+		return result;
+	}
+
+	if (a->file != NULL)
+		result = stream_read(a->file, buffer, size);
+	else if (a->shards != NULL)
+		result = shards_read(a, buffer, size);
+	else if (a->compact != NULL)
+		result = compact_read(a, buffer, size);
+	else {
+		result = a->size - a->position;
+		if (result > size)
+			result = size;
+		if (result < 0)
+			result = 0;
+		memcpy(buffer, a->arena + a->position, result);
+		a->position += result;
+	}
+	if (a->header != NULL && result > 0)
+		a->header->position += result;
+
+	return result;
+
+}
+
+
+static long io_write(struct anagram *a, const char *buffer, long size)
+{
+
+	stats_mark mark;
+	long result;
+
+	STATS_MARK(mark);
+	if (a->file != NULL) {
+		result = stream_write(a->file, buffer, size);
+		if (result > 0)
+			a->writing = 1;
+		/* records appended at the end of the list are checksummed */
+		if (a->header != NULL && result > 0) {
+			if (a->header->position == a->header->frontier)
+				header_extend(a->header, buffer, result);
+			a->header->position += result;
+		}
+	}
+	else if (a->shared != NULL || a->shards != NULL || a->compact != NULL
+		|| a->capacity < 0) {
+		errno = EROFS;
+		result = -1;
+	}
+	else if (!arena_reserve(a, a->position + size)) {
+		errno = ENOMEM;
+		result = -1;
+	}
+	else {
+		if (a->position > a->size)
+			memset(a->arena + a->size, 0, a->position - a->size);
+		memcpy(a->arena + a->position, buffer, size);
+		a->position += size;
+		if (a->position > a->size)
+			a->size = a->position;
+		result = size;
+	}
+	STATS_LAP(a, io_time, mark);
+	STATS_ADD(a, writes, 1);
+	if (result > 0)
+		STATS_ADD(a, bytes_written, result);
+
+	return result;
+
+}
+
+
+static long io_end(struct anagram *a)
+{
+
+	long end;
+
+	STATS_ADD(a, seeks, 1);
+
+	if (a->shared != NULL) {
+		a->position = ((long)a->permutations + 3L) * a->bytes;
+		return a->position;
+	}
+
+	if (a->file != NULL)
+		end = stream_end(a->file);
+	else {
+		a->position = a->size;
+		end = a->size;
+	}
+
+	if (a->header != NULL && end >= 0) {
+		end -= a->header->size;
+		a->header->position = end;
+	}
+
+	return end;
+
+}
+
+
+static int io_sync(struct anagram *a)
+{
+	return io_publish(a, a->permutations);
+}
+
+
+static int io_publish(struct anagram *a, int count)
+{
+
+	/* the header only counts records already on disk, so readers never see
+	 * a record before it is durable */
+
+	stats_mark mark;
+	int result;
+
+	if (a->file == NULL)
+		return 0;
+
+	STATS_MARK(mark);
+	result = stream_sync(a->file);
+	if (result == 0 && a->header != NULL) {
+		if (!header_flush(a, count) || stream_sync(a->file) != 0)
+			result = -1;
+	}
+	STATS_LAP(a, io_time, mark);
+	STATS_ADD(a, syncs, 1);
+
+	return result;
+
+}
+
+
+static int publish(struct anagram *a, int count)
+{
+
+	/* publishes the first "count" records during generation, every
+	 * "a->publish" of them */
+
+	if (a->publish == 0 || a->header == NULL || count % a->publish != 0)
+		return 1;
+
+	return io_publish(a, count) == 0;
+
+}
+
+
+static void io_close(struct anagram *a)
+{
+
+	int i;
+
+	for (i = 0; i < a->shard_count; i++)
+		stream_close(a->shards[i].file);
+	free(a->shards);
+	a->shards = NULL;
+	a->shard_count = 0;
+
+	if (a->compact != NULL) {
+		if (a->compact->file != NULL)
+			stream_close(a->compact->file);
+		free(a->compact->keys);
+		free(a->compact->offsets);
+		free(a->compact->raw);
+		free(a->compact->records);
+		free(a->compact);
+		a->compact = NULL;
+	}
+
+	header_release(a->header);
+	a->header = NULL;
+	if (a->path != NULL && a->watch >= 0)
+		close(a->watch);
+	free(a->path);
+	a->path = NULL;
+
+	if (a->shared != NULL)
+		anagram_release(a->shared);
+	else if (a->file != NULL)
+		stream_close(a->file);
+	else if (a->capacity < 0) {
+		if (a->release != NULL)
+			a->release(a->context);
+	}
+	else
+		free(a->arena);
+	a->file = NULL;
+	a->arena = NULL;
+	a->shared = NULL;
+}
+
+
+static long shards_read(struct anagram *a, char *buffer, long size)
+{
+
+	/*
+	 * Reads the logical file of a manifest: control records from the arena,
+	 * then the records of each shard, located by binary search on ranks.
+	 */
+
+	struct shard *sh;
+	long header, record, offset, chunk, done, got;
+	int low, high, middle;
+
+	header = 3L * a->bytes;
+	if (size > a->size - a->position)
+		size = a->size - a->position;
+
+	for (done = 0; done < size; done += chunk) {
+
+		if (a->position < header) {
+			chunk = header - a->position;
+			if (chunk > size - done)
+				chunk = size - done;
+			memcpy(buffer + done, a->arena + a->position, chunk);
+			a->position += chunk;
+			continue;
+		}
+
+		record = a->position / a->bytes - 3;
+		offset = a->position % a->bytes;
+		low = 0, high = a->shard_count - 1;
+		while (low < high) {
+			middle = (low + high + 1) / 2;
+			if (a->shards[middle].first <= record)
+				low = middle;
+			else
+				high = middle - 1;
+		}
+		sh = &a->shards[low];
+
+		chunk = ((long)sh->first + sh->count - record) * a->bytes - offset;
+		if (chunk > size - done)
+			chunk = size - done;
+		if (stream_seek(sh->file, sh->origin + (record - sh->first + 3) * a->bytes + offset) < 0)
+			return -1;
+		got = stream_read(sh->file, buffer + done, chunk);
+		if (got < 0)
+			return -1;
+		a->position += got;
+		if (got < chunk)
+			return done + got;
+
+	}
+
+	return done;
+
+}
+
+
+static int index_flush(struct index_build *b, int positions, int distinct,
+	int chunk, int chunks)
+{
+
+	/*
+	 * Writes the containers of one chunk: the runs of each element at each
+	 * position as 16-bit pairs, or as a bitmap if that is smaller.
+	 */
+
+	unsigned char *entry;
+	long size, runs;
+	int first, last, p, v, r, i;
+
+	for (p = 0; p < positions; p++) {
+		for (v = 0; v < distinct; v++) {
+			runs = 0;
+			for (r = 0; r < b->runs[p]; r++)
+				if (b->kinds[p * ANAGRAM_INDEX_CHUNK + r] == v)
+					runs++;
+			if (runs * 4 < ANAGRAM_INDEX_BYTES) {
+				size = 0;
+				for (r = 0; r < b->runs[p]; r++) {
+					i = p * ANAGRAM_INDEX_CHUNK + r;
+					if (b->kinds[i] != v)
+						continue;
+					b->output[size++] = (unsigned char)(b->firsts[i] & 0xFF);
+					b->output[size++] = (unsigned char)(b->firsts[i] >> 8);
+					b->output[size++] = (unsigned char)(b->lasts[i] & 0xFF);
+					b->output[size++] = (unsigned char)(b->lasts[i] >> 8);
+				}
+			}
+			else {
+				memset(b->output, 0, ANAGRAM_INDEX_BYTES);
+				for (r = 0; r < b->runs[p]; r++) {
+					i = p * ANAGRAM_INDEX_CHUNK + r;
+					if (b->kinds[i] != v)
+						continue;
+					for (first = b->firsts[i], last = b->lasts[i]; first <= last; first++)
+						b->output[first / 8] |= (unsigned char)(1 << (first % 8));
+				}
+				size = ANAGRAM_INDEX_BYTES;
+				runs = ANAGRAM_INDEX_BITMAP;
+			}
+			if (size > 0 && stream_write(b->file, b->output, size) != size)
+				return 0;
+			entry = b->directory + (((long)p * distinct + v) * chunks + chunk) * 8;
+			put32(entry, b->offset);
+			put32(entry + 4, runs);
+			b->offset += size;
+		}
+		b->runs[p] = 0;
+	}
+
+	return 1;
+
+}
+
+
+static void index_or(const struct index_container *c, unsigned long *mask)
+{
+
+	int first, last, r, w;
+
+	if (c->runs < 0) {
+		for (w = 0; w < ANAGRAM_INDEX_WORDS; w++)
+			mask[w] |= c->bits[w];
+		return;
+	}
+
+	/* fill whole words inside each run */
+	for (r = 0; r < c->runs; r++) {
+		first = c->pairs[2 * r];
+		last = c->pairs[2 * r + 1];
+		while (first <= last) {
+			w = first / ANAGRAM_INDEX_WORD_BITS;
+			if (first % ANAGRAM_INDEX_WORD_BITS == 0 && last - first + 1 >= ANAGRAM_INDEX_WORD_BITS) {
+				mask[w] = ~0UL;
+				first += ANAGRAM_INDEX_WORD_BITS;
+			}
+			else {
+				mask[w] |= 1UL << (first % ANAGRAM_INDEX_WORD_BITS);
+				first++;
+			}
+		}
+	}
+
+}
+
+
+static int lazy_extend(struct anagram *a, int index)
+{
+
+	/*
+	 * Extends generation of a plain list, whole and unfiltered, so that it
+	 * holds "index" plus the look-ahead chunk, resuming from the last record.
+	 * A negative index only checks that the list may be extended.
+	 */
+
+	long elements[ANAGRAM_ELEMENT_LIMIT], total;
+	int target;
+
+	if (a->complete || a->shard || a->constraint || a->gray || a->base != 0 || a->term[0] != '\0'
+		|| a->count != a->permutations || a->shared != NULL || a->shards != NULL
+		|| a->compact != NULL || (a->file == NULL && a->capacity < 0)) {
+		errno = ERANGE;
+		return 0;
+	}
+
+	utf8_elements(a->source, elements);
+	sort(elements, a->elements);
+	total = multinomial(elements, a->elements);
+	if (index >= total) {
+		errno = ERANGE;
+		return 0;
+	}
+	if (index < 0)
+		return 1;
+
+	/* the last chunk runs to completion, which marks the list complete */
+	if ((long)index + 1 + a->lazy >= total)
+		return anagram_generate(a, NULL, NULL);
+
+	target = index + 1 + a->lazy;
+
+	return anagram_generate(a, &target, lazy_stop);
+
+}
+
+
+static int lazy_stop(void *argument, int count, const char *anagram)
+{
+	(void)anagram;
+	return count < *(int *)argument;
+}
+
+
+static long compact_read(struct anagram *a, char *buffer, long size)
+{
+
+	/*
+	 * Reads the logical file of a compact list: control records from the
+	 * arena, then records from the block that holds them, decoded once and
+	 * kept until a record of another block is read.
+	 */
+
+	struct compact *c = a->compact;
+	long header, record, offset, chunk, done;
+	int block;
+
+	header = 3L * a->bytes;
+	if (size > a->size - a->position)
+		size = a->size - a->position;
+
+	for (done = 0; done < size; done += chunk) {
+
+		if (a->position < header) {
+			chunk = header - a->position;
+			if (chunk > size - done)
+				chunk = size - done;
+			memcpy(buffer + done, a->arena + a->position, chunk);
+			a->position += chunk;
+			continue;
+		}
+
+		record = a->position / a->bytes - 3;
+		offset = a->position % a->bytes;
+		block = (int)(record / c->per_block);
+		if (block != c->block && !compact_decode(a, block))
+			return done > 0 ? done : -1;
+
+		record -= (long)block * c->per_block;
+		chunk = (long)c->per_block * a->bytes - (record * a->bytes + offset);
+		if (chunk > size - done)
+			chunk = size - done;
+		memcpy(buffer + done, c->records + record * a->bytes + offset, chunk);
+		a->position += chunk;
+
+	}
+
+	return done;
+
+}
+
+
+static int compact_decode(struct anagram *a, int block)
+{
+
+	struct compact *c = a->compact;
+	char *record;
+	long size;
+	int count, used, prefix, i;
+
+	c->block = -1;
+	size = c->offsets[block + 1] - c->offsets[block];
+	if (size < a->bytes || size > (long)c->per_block * (a->bytes + 1)) {
+		errno = EBADF;
+		return 0;
+	}
+	if (stream_seek(c->file, c->offsets[block]) < 0)
+		return 0;
+	if (stream_read(c->file, c->raw, size) != size) {
+		errno = EBADF;
+		return 0;
+	}
+
+	/* the block's records, the last block being possibly short */
+	count = (int)((a->size / a->bytes - 3) - (long)block * c->per_block);
+	if (count > c->per_block)
+		count = c->per_block;
+
+	memcpy(c->records, c->raw, a->bytes);
+	used = a->bytes;
+	for (i = 1; i < count; i++) {
+		record = c->records + (long)i * a->bytes;
+		if (used >= size) {
+			errno = EBADF;
+			return 0;
+		}
+		prefix = (unsigned char)c->raw[used++];
+		if (prefix > a->bytes || used + a->bytes - prefix > size) {
+			errno = EBADF;
+			return 0;
+		}
+		memcpy(record, record - a->bytes, prefix);
+		memcpy(record + prefix, c->raw + used, a->bytes - prefix);
+		used += a->bytes - prefix;
+	}
+
+	c->block = block;
+
+	return 1;
+
+}
+
+
+static int compare_shards(const void *a, const void *b)
+{
+	const struct shard *x = a, *y = b;
+	return x->first < y->first ? -1 : x->first > y->first;
+}
+
+
+static int arena_reserve(struct anagram *a, long size)
+{
+
+	char *arena;
+	long capacity;
+
+	if (size <= a->capacity)
+		return 1;
+
+	/* grow geometrically past the initial (exact) reservation */
+	capacity = a->capacity > 0 ? a->capacity * 2 : size;
+	if (capacity < size)
+		capacity = size;
+
+	arena = realloc(a->arena, (size_t)capacity);
+	if (arena == NULL)
+		return 0;
+
+	a->arena = arena;
+	a->capacity = capacity;
+
+	return 1;
+
+}
+
+
+static int write_all(int fd, const char *buffer, long size)
+{
+
+	ssize_t written;
+
+	while (size > 0) {
+		written = write(fd, buffer, (size_t)size);
+		if (written < 0) {
+			if (errno == EINTR)
+				continue;
+			return 0;
+		}
+		buffer += written;
+		size -= (long)written;
+	}
+
+	return 1;
+
+}
+
+
+static struct header *header_create(int bytes, int per_block, long blocks)
+{
+
+	struct header *h;
+
+	h = malloc(sizeof(struct header));
+	if (h == NULL)
+		return NULL;
+
+	memset(h, 0, sizeof(struct header));
+	h->size = ANAGRAM_HEADER_FIXED + 4L * blocks;
+	h->frontier = 3L * bytes;
+	h->flushed = -1;
+	h->bytes = bytes;
+	h->per_block = per_block;
+	h->blocks = (int)blocks;
+	h->data = calloc(h->size, 1);
+	if (h->data == NULL) {
+		free(h);
+		return NULL;
+	}
+
+	return h;
+
+}
+
+
+static int header_load(struct anagram *a)
+{
+
+	/* reads the header of a file opened by "load", before any offset is
+	 * made relative to the control records */
+
+	unsigned char fixed[ANAGRAM_HEADER_FIXED];
+	struct header *h;
+	long size;
+	int errn;
+
+	h = NULL;
+
+	if (io_seek(a, 0) < 0) {
+		errn = errno;
+		goto failure;
+	}
+	if ((size = io_read(a, (char *)fixed, ANAGRAM_HEADER_FIXED)) != ANAGRAM_HEADER_FIXED) {
+		errn = size < 0 ? errno : EBADF;
+		goto failure;
+	}
+
+	h = header_parse(fixed);
+	if (h == NULL) {
+		errn = errno;
+		goto failure;
+	}
+
+	/* the checksum table follows the fixed fields */
+	size = h->size - ANAGRAM_HEADER_FIXED;
+	if (io_read(a, (char *)h->data + ANAGRAM_HEADER_FIXED, size) != size || !header_check(h)) {
+		errn = EBADF;
+		goto failure;
+	}
+
+	header_apply(a, h);
+
+	return 1;
+
+	failure:
+		header_release(h);
+		errno = errn;
+		return 0;
+
+}
+
+
+static struct header *header_parse(const unsigned char *fixed)
+{
+
+	/* checks the fixed fields and makes a header to read the rest into */
+
+	struct header *h;
+	long size, blocks, per_block, permutations, complete, bytes;
+
+	size = get32(fixed + 8);
+	bytes = get32(fixed + 12);
+	permutations = get32(fixed + 16);
+	complete = get32(fixed + 20);
+	per_block = get32(fixed + 24);
+	blocks = get32(fixed + 28);
+	if (memcmp(fixed, ANAGRAM_HEADER_MAGIC, 8) != 0
+		|| blocks < 1 || blocks > INT_MAX / 4 || size != ANAGRAM_HEADER_FIXED + 4 * blocks
+		|| bytes < 2 || bytes > ANAGRAM_SIZE_LIMIT - 1 || per_block < 1
+		|| permutations < 0 || permutations > INT_MAX || permutations / per_block > blocks
+		|| complete < 0 || complete > 1) {
+		errno = EBADF;
+		return NULL;
+	}
+
+	h = header_create((int)bytes, (int)per_block, blocks);
+	if (h == NULL) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	memcpy(h->data, fixed, ANAGRAM_HEADER_FIXED);
+
+	return h;
+
+}
+
+
+static int header_check(struct header *h)
+{
+	return crc32c(crc32c(0, (const char *)h->data, 36), (const char *)h->data + 40, h->size - 40)
+		== ((unsigned long)get32(h->data + 36) & 0xFFFFFFFFUL);
+}
+
+
+static void header_apply(struct anagram *a, struct header *h)
+{
+
+	/* makes a checked header the object's own */
+
+	h->crc = (unsigned long)get32(h->data + 32) & 0xFFFFFFFFUL;
+	h->frontier = (get32(h->data + 16) + 3) * h->bytes;
+	h->flushed = header_full(h);
+	a->permutations = (int)get32(h->data + 16);
+	a->complete = (int)get32(h->data + 20);
+	a->header = h;
+
+}
+
+
+static void header_extend(struct header *h, const char *buffer, long size)
+{
+
+	/* checksums records appended at the frontier; the checksum of a block
+	 * goes to the table as soon as the block is full */
+
+	long block, used, chunk, i;
+
+	block = (long)h->per_block * h->bytes;
+
+	while (size > 0) {
+		used = (h->frontier - 3L * h->bytes) % block;
+		chunk = block - used;
+		if (chunk > size)
+			chunk = size;
+		h->crc = crc32c(used > 0 ? h->crc : 0, buffer, chunk);
+		h->frontier += chunk;
+		buffer += chunk;
+		size -= chunk;
+		if (used + chunk == block) {
+			i = (h->frontier - 3L * h->bytes) / block - 1;
+			if (i < h->blocks)
+				put32(h->data + ANAGRAM_HEADER_FIXED + 4 * i, (long)h->crc);
+			h->crc = 0;
+		}
+	}
+
+}
+
+
+static int header_full(struct header *h)
+{
+
+	/* number of blocks with a checksum in the table */
+
+	long full;
+
+	full = (h->frontier - 3L * h->bytes) / ((long)h->per_block * h->bytes);
+
+	return full < h->blocks ? (int)full : h->blocks;
+
+}
+
+
+static void header_encode(struct header *h, int count, int complete, unsigned char *fixed)
+{
+
+	/* encodes the fixed fields into "fixed", which may be the header's own
+	 * data; the checksum of the partial block must match the first "count"
+	 * records */
+
+	memcpy(fixed, ANAGRAM_HEADER_MAGIC, 8);
+	put32(fixed + 8, h->size);
+	put32(fixed + 12, (long)h->bytes);
+	put32(fixed + 16, (long)count);
+	put32(fixed + 20, (long)(complete != 0));
+	put32(fixed + 24, (long)h->per_block);
+	put32(fixed + 28, (long)h->blocks);
+	put32(fixed + 32, (long)h->crc);
+	put32(fixed + 36, (long)crc32c(crc32c(0, (const char *)fixed, 36),
+		(const char *)h->data + 40, h->size - 40));
+
+}
+
+
+static int header_flush(struct anagram *a, int count)
+{
+
+	/* rewrites the fixed fields and the checksums of the blocks filled
+	 * since the last flush in place, then returns to the current offset */
+
+	struct header *h = a->header;
+	long offset, size;
+	int first, last;
+
+	header_encode(h, count, a->complete, h->data);
+
+	/* the whole table goes with the first flush */
+	first = h->flushed < 0 ? 0 : h->flushed;
+	last = h->flushed < 0 ? h->blocks : header_full(h);
+	offset = ANAGRAM_HEADER_FIXED + 4L * first;
+	size = 4L * (last - first);
+
+	if (stream_seek(a->file, 0) < 0
+		|| stream_write(a->file, h->data, ANAGRAM_HEADER_FIXED) != ANAGRAM_HEADER_FIXED)
+		return 0;
+	if (size > 0 && (stream_seek(a->file, offset) < 0
+		|| stream_write(a->file, h->data + offset, size) != size))
+		return 0;
+	if (stream_seek(a->file, h->size + h->position) < 0)
+		return 0;
+
+	STATS_ADD(a, writes, 1);
+	STATS_ADD(a, bytes_written, ANAGRAM_HEADER_FIXED + size);
+
+	h->flushed = header_full(h);
+
+	return 1;
+
+}
+
+
+static void header_release(struct header *h)
+{
+	if (h == NULL)
+		return;
+	free(h->data);
+	free(h);
+}
+
+
+static unsigned long crc32c(unsigned long crc, const char *buffer, long size)
+{
+
+	/*
+	 * CRC-32C (Castagnoli), continuing "crc" (0 to start). Uses the CRC32
+	 * instructions when the compiler targets them (-msse4.2, -march=armv8-a+crc)
+	 * and slicing by eight, which reads eight bytes per table round,
+	 * otherwise.
+	 */
+
+	const unsigned char *p = (const unsigned char *)buffer;
+#if defined(ANAGRAM_CRC32C_SSE42) || defined(ANAGRAM_CRC32C_ARM)
+	unsigned long long word;
+#endif
+
+	crc = ~crc & 0xFFFFFFFFUL;
+
+#if defined(ANAGRAM_CRC32C_SSE42)
+	for (; size >= 8; p += 8, size -= 8) {
+		memcpy(&word, p, 8);
+		crc = (unsigned long)_mm_crc32_u64(crc, word);
+	}
+	for (; size > 0; p++, size--)
+		crc = _mm_crc32_u8((unsigned int)crc, *p);
+#elif defined(ANAGRAM_CRC32C_ARM)
+	for (; size >= 8; p += 8, size -= 8) {
+		memcpy(&word, p, 8);
+		crc = __crc32cd((unsigned int)crc, word);
+	}
+	for (; size > 0; p++, size--)
+		crc = __crc32cb((unsigned int)crc, *p);
+#else
+	if (!crc32c_ready)
+		crc32c_init();
+	for (; size >= 8; p += 8, size -= 8) {
+		crc ^= (unsigned long)p[0] | ((unsigned long)p[1] << 8)
+			| ((unsigned long)p[2] << 16) | ((unsigned long)p[3] << 24);
+		crc = crc32c_table[7][crc & 0xFF] ^ crc32c_table[6][(crc >> 8) & 0xFF]
+			^ crc32c_table[5][(crc >> 16) & 0xFF] ^ crc32c_table[4][crc >> 24]
+			^ crc32c_table[3][p[4]] ^ crc32c_table[2][p[5]]
+			^ crc32c_table[1][p[6]] ^ crc32c_table[0][p[7]];
+	}
+	for (; size > 0; p++, size--)
+		crc = crc32c_table[0][(crc ^ *p) & 0xFF] ^ (crc >> 8);
+#endif
+
+	return ~crc & 0xFFFFFFFFUL;
+
+}
+
+
+#if !defined(ANAGRAM_CRC32C_SSE42) && !defined(ANAGRAM_CRC32C_ARM)
+static void crc32c_init(void)
+{
+
+	/* threads racing here write the same values */
+
+	unsigned long crc;
+	int i, j;
+
+	for (i = 0; i < 256; i++) {
+		crc = (unsigned long)i;
+		for (j = 0; j < 8; j++)
+			crc = crc & 1 ? (crc >> 1) ^ 0x82F63B78UL : crc >> 1;
+		crc32c_table[0][i] = crc;
+	}
+	for (i = 0; i < 256; i++)
+		for (j = 1; j < 8; j++)
+			crc32c_table[j][i] = (crc32c_table[j - 1][i] >> 8)
+				^ crc32c_table[0][crc32c_table[j - 1][i] & 0xFF];
+
+	crc32c_ready = 1;
+
+}
+#endif
+
+
+#ifndef ANAGRAM_NO_STATS
+
+static void stats_now(stats_mark *mark)
+{
+	clock_gettime(CLOCK_MONOTONIC, mark);
+}
+
+
+static double stats_lap(stats_mark *mark)
+{
+
+	struct timespec now;
+	double elapsed;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	elapsed = (double)(now.tv_sec - mark->tv_sec)
+		+ (double)(now.tv_nsec - mark->tv_nsec) / 1e9;
+	*mark = now;
+
+	return elapsed;
+
+}
+
+
+static void stats_merge(anagram_stats *target, const anagram_stats *source)
+{
+	target->seeks         += source->seeks;
+	target->reads         += source->reads;
+	target->writes        += source->writes;
+	target->syncs         += source->syncs;
+	target->bytes_read    += source->bytes_read;
+	target->bytes_written += source->bytes_written;
+	target->permutations  += source->permutations;
+	target->callbacks     += source->callbacks;
+	target->permute_time  += source->permute_time;
+	target->encode_time   += source->encode_time;
+	target->io_time       += source->io_time;
+	target->callback_time += source->callback_time;
+}
+
+#endif
+
+
+static void utf8_encode(char *string, int *offset, long code)
+{
+
+	unsigned char *s;
+	int i;
+
+	if (code < 1)
+		return;
+
+	i = *offset;
+	if (i < 0)
+		return;
+
+	s = (unsigned char *)(string + i);
+
+	if (code < 0x80) { /* Up to U+007F */
+		*s = (unsigned char)code;
+		i++;
+	}
+	else if (code < 0x800) { /* Up to U+07FF */
+		*s = (unsigned char)(0xC0 | (code >> 6));
+		*(s + 1) = (unsigned char)(0x80 | (code & 0x3F));
+		i += 2;
+	}
+	else if (code < 0x10000) { /* Up to U+FFFF */
+		*s = (unsigned char)(0xE0 | (code >> 12));
+		*(s + 1) = (unsigned char)(0x80 | ((code >> 6) & 0x3F));
+		*(s + 2) = (unsigned char)(0x80 | (code & 0x3F));
+		i += 3;
+	}
+	else if (code < 0x110000) { /* Up to U+10FFFF */
+		*s = (unsigned char)(0xF0 | (code >> 18));
+		*(s + 1) = (unsigned char)(0x80 | ((code >> 12) & 0x3F));
+		*(s + 2) = (unsigned char)(0x80 | ((code >> 6) & 0x3F));
+		*(s + 3) = (unsigned char)(0x80 | (code & 0x3F));
+		i += 4;
+	}
+
+	*offset = i;
+
+}
+
+
+static long utf8_decode(const char *string, int *offset)
+{
+
+	unsigned char byte;
+	int i, j;
+	long code;
+
+	i = *offset;
+	if (i < 0)
+		goto failure;
+
+	byte = *(string + i++);
+
+	if (byte < 0x80) {
+		code = byte;
+		j = 0;
+	}
+	else if ((byte & 0xE0) == 0xC0) {
+		code = byte & 0x1F;
+		j = 1;
+	}
+	else if ((byte & 0xF0) == 0xE0) {
+		code = byte & 0x0F;
+		j = 2;
+	}
+	else if ((byte & 0xF8) == 0xF0) {
+		code = byte & 0x07;
+		j = 3;
+	}
+	else
+		goto failure;
+
+	while (j > 0) {
+		byte = *(string + i++);
+		if ((byte & 0xC0) != 0x80)
+			goto failure;
+		code = (code << 6) | (byte & 0x3F);
+		j--;
+	}
+
+	if (code != 0)
+		*offset = i;
+
+	return code;
+
+	failure:
+		return -1;
+
+}
+
+
+static int utf8_strlen(const char *string, int *size)
+{
+
+	int length, i, j;
+	unsigned char byte;
+
+	i = 0, length = 0;
+	while ((byte = *(string + i)) != 0)
+	{
+		if (byte < 0x80)
+			j = 0;
+		else if ((byte & 0xE0) == 0xC0)
+			j = 1;
+		else if ((byte & 0xF0) == 0xE0)
+			j = 2;
+		else if ((byte & 0xF8) == 0xF0)
+			j = 3;
+		else
+			goto failure;
+		while (j > 0)
+		{
+			i++, j--;
+			byte = *(string + i);
+			if ((byte & 0xC0) != 0x80)
+				goto failure;
+		}
+		i++, length++;
+	}
+
+	if (size != NULL)
+		*size = i;
+
+	return length;
+
+	failure:
+		if (size != NULL)
+			*size = 0;
+		return -1;
+
+}
+
+
+static int utf8_elements(const char *string, long *elements)
+{
+
+	long element;
+	int length, offset;
+
+	length = 0, offset = 0;
+	while ((element = utf8_decode(string, &offset)) != 0) {
+		if (element < 0)
+			return -1;
+		if (length == ANAGRAM_ELEMENT_LIMIT)
+			return -1;
+		elements[length++] = element;
+	}
+
+	return length;
+
+}
+
+
+static void sort(long *elements, int length)
+{
+
+	/*
+	 * Bubble Sort
+	 */
+
+	int swap, last, i;
+	long temp;
+
+	if (length < 2)
+		return;
+
+	last = length - 1;
+	do {
+		swap = 0;
+		for (i = 0; i < last; i++) {
+			if (elements[i] > elements[i + 1]) {
+				temp = elements[i];
+				elements[i] = elements[i + 1];
+				elements[i + 1] = temp;
+				swap = 1;
+			}
+		}
+	} while (swap);
+
+}
+
+
+static long multinomial(const long *elements, int length)
+{
+
+	/*
+	 * Number of distinct permutations of a sorted multiset:
+	 * length! / (n1! * n2! * ...), computed incrementally so every
+	 * partial result is itself a multinomial coefficient.
+	 */
+
+	long result;
+	int run, i;
+
+	result = 1, run = 0;
+	for (i = 0; i < length; i++) {
+		run = i > 0 && elements[i] == elements[i - 1] ? run + 1 : 1;
+		result = result * (i + 1) / run;
+	}
+
+	return result;
+
+}
+
+
+static int histogram(const long *elements, int length, long *values, int *counts)
+{
+
+	/* distinct values of a sorted array and their multiplicities */
+
+	int distinct, i;
+
+	distinct = 0;
+	for (i = 0; i < length; i++) {
+		if (distinct > 0 && values[distinct - 1] == elements[i])
+			counts[distinct - 1]++;
+		else {
+			values[distinct] = elements[i];
+			counts[distinct++] = 1;
+		}
+	}
+
+	return distinct;
+
+}
+
+
+static int unrank(const long *values, const int *counts, int distinct, int length,
+	long total, long rank, long *elements)
+{
+
+	/*
+	 * Inverse of "anagram_rank": at each position pick the smallest available
+	 * element whose block of "total * count / remaining" permutations
+	 * contains the rank.
+	 */
+
+	int remaining[ANAGRAM_ELEMENT_LIMIT];
+	long block;
+	int i, j;
+
+	memcpy(remaining, counts, sizeof(int) * distinct);
+
+	for (i = 0; i < length; i++) {
+		for (j = 0; j < distinct; j++) {
+			if (remaining[j] == 0)
+				continue;
+			block = total * remaining[j] / (length - i);
+			if (rank < block)
+				break;
+			rank -= block;
+		}
+		elements[i] = values[j];
+		total = total * remaining[j] / (length - i);
+		remaining[j]--;
+	}
+
+	return length;
+
+}
+
+
+static double constrained_count(const long *values, const int *available, int distinct,
+	const long *source, int from, int length, int budget)
+{
+
+	/*
+	 * Arrangements of the available elements over positions from..length-1
+	 * with at most "budget" fixed points (element equal to the source one).
+	 * Taking copies as distinct, the positions of value v and the copies of v
+	 * form an a x b board with C(a,k) C(b,k) k! ways of placing k rooks; the
+	 * board is the product of these polynomials, and inclusion-exclusion over
+	 * its coefficients R(k) counts exactly j fixed points:
+	 *   e(j) = sum over k >= j of (-1)^(k-j) C(k,j) R(k) (n-k)!
+	 * Dividing by the product of a! undoes the distinct copies. Doubles hold
+	 * every intermediate value exactly for n <= 10.
+	 */
+
+	double board[ANAGRAM_ELEMENT_LIMIT + 1], product[ANAGRAM_ELEMENT_LIMIT + 1];
+	double factorial[ANAGRAM_ELEMENT_LIMIT + 1], binomial, exact, result, divisor;
+	int positions[ANAGRAM_ELEMENT_LIMIT];
+	int n, degree, limit, i, j, k, v;
+
+	if (budget < 0)
+		return 0.0;
+
+	n = length - from;
+	factorial[0] = 1.0;
+	for (i = 1; i <= n; i++)
+		factorial[i] = factorial[i - 1] * i;
+
+	for (v = 0; v < distinct; v++)
+		positions[v] = 0;
+	for (i = from; i < length; i++)
+		for (v = 0; v < distinct; v++)
+			if (values[v] == source[i])
+				positions[v]++;
+
+	board[0] = 1.0, degree = 0, divisor = 1.0;
+	for (v = 0; v < distinct; v++) {
+		limit = available[v] < positions[v] ? available[v] : positions[v];
+		for (i = 0; i <= degree + limit; i++)
+			product[i] = 0.0;
+		for (k = 0; k <= limit; k++) {
+			/* C(a,k) C(b,k) k! = a! b! / ((a-k)! (b-k)! k!) */
+			binomial = factorial[available[v]] / factorial[available[v] - k]
+				* factorial[positions[v]] / factorial[positions[v] - k] / factorial[k];
+			for (i = 0; i <= degree; i++)
+				product[i + k] += board[i] * binomial;
+		}
+		degree += limit;
+		for (i = 0; i <= degree; i++)
+			board[i] = product[i];
+		divisor *= factorial[available[v]];
+	}
+
+	result = 0.0;
+	for (j = 0; j <= budget && j <= degree; j++) {
+		exact = 0.0;
+		for (k = j, binomial = 1.0; k <= degree; k++) {
+			/* binomial = C(k, j) */
+			exact += ((k - j) % 2 == 0 ? 1.0 : -1.0) * binomial * board[k] * factorial[n - k];
+			binomial = binomial * (k + 1) / (k + 1 - j);
+		}
+		result += exact;
+	}
+
+	return (double)(long)(result / divisor + 0.5);
+
+}
+
+
+static int constrained_fill(const long *values, int *available, int distinct,
+	const long *source, long *elements, int from, int length, int budget)
+{
+
+	/* smallest completion of positions from..length-1, if any */
+
+	int hit = 0, i, v;
+
+	for (i = from; i < length; i++) {
+		for (v = 0; v < distinct; v++) {
+			if (available[v] == 0)
+				continue;
+			hit = values[v] == source[i];
+			available[v]--;
+			if (constrained_count(values, available, distinct, source, i + 1, length, budget - hit) > 0.0)
+				break;
+			available[v]++;
+		}
+		if (v == distinct)
+			return 0;
+		elements[i] = values[v];
+		budget -= hit;
+	}
+
+	return 1;
+
+}
+
+
+static int constrained_next(const long *values, int distinct, const long *source,
+	long *elements, int length, int fixed)
+{
+
+	/*
+	 * Lexicographic successor among the constrained permutations: release
+	 * positions from the right until one can take a larger element that
+	 * still leaves a valid completion, then append the smallest completion.
+	 */
+
+	int available[ANAGRAM_ELEMENT_LIMIT], hits[ANAGRAM_ELEMENT_LIMIT + 1];
+	int budget, hit, i, v, w;
+
+	for (v = 0; v < distinct; v++)
+		available[v] = 0;
+	for (i = 0, hits[0] = 0; i < length; i++)
+		hits[i + 1] = hits[i] + (elements[i] == source[i]);
+
+	for (i = length - 1; i >= 0; i--) {
+		for (w = 0; values[w] != elements[i]; w++)
+			;
+		available[w]++;
+		budget = fixed - hits[i];
+		for (v = w + 1; v < distinct; v++) {
+			if (available[v] == 0)
+				continue;
+			hit = values[v] == source[i];
+			available[v]--;
+			if (constrained_count(values, available, distinct, source, i + 1, length, budget - hit) > 0.0) {
+				elements[i] = values[v];
+				return constrained_fill(values, available, distinct, source, elements,
+					i + 1, length, budget - hit);
+			}
+			available[v]++;
+		}
+	}
+
+	return 0;
+
+}
+
+
+static double sub_extensions(const int *available, int distinct, int depth, int k)
+{
+
+	/*
+	 * Arrangements of length k or more below a prefix of "depth" elements,
+	 * the prefix itself included. The j-arrangements of the available
+	 * elements are j! times the coefficient of x^j in the product of the
+	 * truncated exponentials 1 + x + x^2/2! + ... + x^a/a!, one per element.
+	 */
+
+	double series[ANAGRAM_ELEMENT_LIMIT + 1], product[ANAGRAM_ELEMENT_LIMIT + 1];
+	double factorial[ANAGRAM_ELEMENT_LIMIT + 1], result;
+	int degree, i, j, t, v;
+
+	factorial[0] = 1.0;
+	for (i = 1; i <= ANAGRAM_ELEMENT_LIMIT; i++)
+		factorial[i] = factorial[i - 1] * i;
+
+	series[0] = 1.0, degree = 0;
+	for (v = 0; v < distinct; v++) {
+		if (available[v] == 0)
+			continue;
+		for (i = 0; i <= degree + available[v]; i++)
+			product[i] = 0.0;
+		for (i = 0; i <= degree; i++)
+			for (t = 0; t <= available[v]; t++)
+				product[i + t] += series[i] / factorial[t];
+		degree += available[v];
+		for (i = 0; i <= degree; i++)
+			series[i] = product[i];
+	}
+
+	result = 0.0;
+	for (j = k > depth ? k - depth : 0; j <= degree; j++)
+		result += series[j] * factorial[j];
+
+	return (double)(long)(result + 0.5);
+
+}
+
+
+static int sub_next(int *available, int distinct, int *stack, int *depth, int length)
+{
+
+	/* preorder successor: descend to the smallest available element or,
+	 * at a leaf, climb to the nearest larger sibling */
+
+	int v;
+
+	if (*depth < length) {
+		for (v = 0; available[v] == 0; v++)
+			;
+		available[v]--;
+		stack[(*depth)++] = v;
+		return 1;
+	}
+
+	while (*depth > 0) {
+		v = stack[--(*depth)];
+		available[v]++;
+		for (v++; v < distinct && available[v] == 0; v++)
+			;
+		if (v < distinct) {
+			available[v]--;
+			stack[(*depth)++] = v;
+			return 1;
+		}
+	}
+
+	return 0;
+
+}
+
+
+static int sub_last(struct anagram_sub *s, long limit)
+{
+
+	/* find the last record ending before "limit"; records are null
+	 * terminated, no longer than ANAGRAM_SIZE_LIMIT and followed by at most
+	 * the part of one interrupted record, which has no null byte */
+
+	char window[2 * ANAGRAM_SIZE_LIMIT];
+	long start, size;
+	int last, i, errn;
+
+	s->end = ANAGRAM_SUB_HEADER;
+	s->buffer[0] = '\0';
+
+	if (limit < ANAGRAM_SUB_HEADER) {
+		errn = EBADF;
+		goto failure;
+	}
+
+	start = limit - 2 * ANAGRAM_SIZE_LIMIT;
+	if (start < ANAGRAM_SUB_HEADER)
+		start = ANAGRAM_SUB_HEADER;
+	size = limit - start;
+	if (io_seek(&s->io, start) < 0) {
+		errn = errno;
+		goto failure;
+	}
+	if (io_read(&s->io, window, size) != size) {
+		errn = EBADF;
+		goto failure;
+	}
+
+	for (last = (int)size - 1; last >= 0 && window[last] != '\0'; last--)
+		;
+	for (i = last - 1; i >= 0 && window[i] != '\0'; i--)
+		;
+	if (last < 0 && start == ANAGRAM_SUB_HEADER)
+		return 1;
+	if (last < 0 || (i < 0 && start > ANAGRAM_SUB_HEADER) || last - i > ANAGRAM_SIZE_LIMIT) {
+		errn = EBADF;
+		goto failure;
+	}
+
+	memcpy(s->buffer, window + i + 1, last - i);
+	s->end = start + last + 1;
+
+	return 1;
+
+	failure:
+		errno = errn;
+		return 0;
+
+}
+
+
+static int sub_index(struct anagram_sub *s)
+{
+
+	/*
+	 * Freeze the end of the records in the header, append the offset of
+	 * every record as the rank index and only then store the record count,
+	 * which marks the list complete.
+	 */
+
+	char block[ANAGRAM_SUB_BLOCK];
+	unsigned char entries[ANAGRAM_SUB_BLOCK], field[4];
+	long position, output, size;
+	int used, first, i;
+
+	put32(field, s->end);
+	if (io_seek(&s->io, 12) < 0 || io_write(&s->io, (const char *)field, 4) != 4
+		|| io_sync(&s->io) != 0)
+		return 0;
+
+	position = ANAGRAM_SUB_HEADER;
+	output = s->end;
+	used = 0;
+	while (position < s->end) {
+		size = s->end - position;
+		if (size > ANAGRAM_SUB_BLOCK)
+			size = ANAGRAM_SUB_BLOCK;
+		if (io_seek(&s->io, position) < 0)
+			return 0;
+		if (io_read(&s->io, block, size) != size) {
+			errno = EBADF;
+			return 0;
+		}
+		for (i = 0, first = 0; i < size; i++) {
+			if (block[i] != '\0')
+				continue;
+			put32(entries + used, position + first);
+			used += 4;
+			first = i + 1;
+			if (used == ANAGRAM_SUB_BLOCK) {
+				if (io_seek(&s->io, output) < 0
+					|| io_write(&s->io, (const char *)entries, used) != used)
+					return 0;
+				output += used;
+				used = 0;
+			}
+		}
+		if (first == 0) {
+			errno = EBADF;
+			return 0;
+		}
+		/* the next block starts at the record cut by this one */
+		position += first;
+	}
+	if (used > 0) {
+		if (io_seek(&s->io, output) < 0
+			|| io_write(&s->io, (const char *)entries, used) != used)
+			return 0;
+	}
+	if (io_sync(&s->io) != 0)
+		return 0;
+
+	put32(field, s->count);
+	if (io_seek(&s->io, 16) < 0 || io_write(&s->io, (const char *)field, 4) != 4)
+		return 0;
+
+	s->complete = 1;
+
+	return 1;
+
+}
+
+
+static void put32(unsigned char *buffer, long value)
+{
+	buffer[0] = (unsigned char)(value & 0xFF);
+	buffer[1] = (unsigned char)((value >> 8) & 0xFF);
+	buffer[2] = (unsigned char)((value >> 16) & 0xFF);
+	buffer[3] = (unsigned char)((value >> 24) & 0xFF);
+}
+
+
+static long get32(const unsigned char *buffer)
+{
+	return (long)buffer[0] | ((long)buffer[1] << 8)
+		| ((long)buffer[2] << 16) | ((long)buffer[3] << 24);
+}
+
+
+static long binomial(int n, int k)
+{
+
+	long result;
+	int i;
+
+	if (k < 0 || k > n)
+		return 0;
+
+	for (result = 1, i = 1; i <= k; i++)
+		result = result * (n - k + i) / i;
+
+	return result;
+
+}
+
+
+static long gray_rank(const long *values, const int *counts, int distinct, int length,
+	const long *elements)
+{
+
+	/* inverse of "gray_unrank": the spreads are found largest value first,
+	 * then combined from the smallest up */
+
+	long work[ANAGRAM_ELEMENT_LIMIT], spread[ANAGRAM_ELEMENT_LIMIT];
+	long size[ANAGRAM_ELEMENT_LIMIT], rank;
+	char bits[ANAGRAM_ELEMENT_LIMIT];
+	int n, m, v, i;
+
+	memcpy(work, elements, sizeof(long) * length);
+	for (v = distinct - 1, n = length; v > 0; v--, n = m) {
+		for (i = 0, m = 0; i < n; i++) {
+			bits[i] = work[i] != values[v];
+			if (bits[i])
+				work[m++] = work[i];
+		}
+		spread[v] = gray_comb_rank(bits, counts[v], m);
+		size[v] = binomial(n, m);
+	}
+
+	for (v = 1, rank = 0; v < distinct; v++)
+		rank = rank * size[v] + (rank % 2 ? size[v] - 1 - spread[v] : spread[v]);
+
+	return rank;
+
+}
+
+
+static void gray_unrank(const long *values, const int *counts, int distinct, int length,
+	long rank, long *elements)
+{
+
+	struct gray_state g;
+
+	gray_start(&g, values, counts, distinct, rank);
+	memcpy(elements, g.words[distinct - 1], sizeof(long) * length);
+
+}
+
+
+static void gray_start(struct gray_state *g, const long *values, const int *counts,
+	int distinct, long rank)
+{
+
+	/*
+	 * Minimal-change order. The copies of the largest value are spread over
+	 * the positions around each permutation of the other elements (listed the
+	 * same way, recursively) in Eades-McKay order, reflected for every other
+	 * permutation of the rest. In that order an element only moves across
+	 * copies of the largest value, so every step of the spread is a single
+	 * transposition, and so is every step of the rest. The rank is a mixed
+	 * radix number whose least significant digit is the spread of the
+	 * largest value.
+	 */
+
+	int v, i;
+
+	memcpy(g->values, values, sizeof(long) * distinct);
+	memcpy(g->counts, counts, sizeof(int) * distinct);
+	g->distinct = distinct;
+
+	g->lengths[0] = counts[0];
+	for (v = 1; v < distinct; v++) {
+		g->lengths[v] = g->lengths[v - 1] + counts[v];
+		g->sizes[v] = binomial(g->lengths[v], counts[v]);
+	}
+
+	for (v = distinct - 1; v > 0; v--) {
+		g->digits[v] = rank % g->sizes[v];
+		rank /= g->sizes[v];
+		g->odd[v] = (int)(rank % 2);
+	}
+
+	for (i = 0; i < counts[0]; i++)
+		g->words[0][i] = values[0];
+	for (v = 1; v < distinct; v++) {
+		gray_comb_unrank(g->bits[v], counts[v], g->lengths[v - 1],
+			g->odd[v] ? g->sizes[v] - 1 - g->digits[v] : g->digits[v]);
+		gray_spread(g, v);
+	}
+
 }
 
 
-/*
- * Static Function Implementation
- */
+static int gray_next(struct gray_state *g)
+{
 
+	/* steps the least significant digit; a digit that wraps around starts a
+	 * reflected block, whose first spread is the last one of the block
+	 * before, and carries into the next value down */
 
-static void utf8_encode(char *string, int *offset, long code)
+	int v, w;
+
+	for (v = g->distinct - 1; v > 0; v--) {
+		if (++g->digits[v] < g->sizes[v])
+			break;
+		g->digits[v] = 0;
+		g->odd[v] = !g->odd[v];
+	}
+	if (v == 0)
+		return 0;
+
+	gray_comb_unrank(g->bits[v], g->counts[v], g->lengths[v - 1],
+		g->odd[v] ? g->sizes[v] - 1 - g->digits[v] : g->digits[v]);
+	for (w = v; w < g->distinct; w++)
+		gray_spread(g, w);
+
+	return 1;
+
+}
+
+
+static void gray_spread(struct gray_state *g, int v)
 {
 
-	unsigned char *s;
-	int i;
+	/* the elements of the values below v keep their order in the positions
+	 * marked by the spread of v, copies of v take the others */
 
-	if (code < 1)
-		return;
+	int i, j;
 
-	i = *offset;
-	if (i < 0)
-		return;
+	for (i = 0, j = 0; i < g->lengths[v]; i++)
+		g->words[v][i] = g->bits[v][i] ? g->words[v - 1][j++] : g->values[v];
 
-	s = (unsigned char *)(string + i);
+}
 
-	if (code < 0x80) { /* Up to U+007F */
-		*s = (unsigned char)code;
-		i++;
+
+static long gray_comb_rank(const char *bits, int s, int t)
+{
+
+	/*
+	 * Position of a string of s zeros and t ones in the Eades-McKay sequence
+	 * E(s,t) = 0E(s-1,t), 10E(s-1,t-1) reversed, 11E(s,t-2), in which a one
+	 * only ever moves across zeros.
+	 */
+
+	long first, second;
+
+	if (s == 0 || t == 0)
+		return 0;
+
+	if (bits[0] == 0)
+		return gray_comb_rank(bits + 1, s - 1, t);
+
+	first = binomial(s - 1 + t, t);
+	second = binomial(s + t - 2, t - 1);
+	if (bits[1] == 0)
+		return first + second - 1 - gray_comb_rank(bits + 2, s - 1, t - 1);
+
+	return first + second + gray_comb_rank(bits + 2, s, t - 2);
+
+}
+
+
+static void gray_comb_unrank(char *bits, int s, int t, long rank)
+{
+
+	long first, second;
+
+	if (s == 0 || t == 0) {
+		memset(bits, t > 0, s + t);
+		return;
 	}
-	else if (code < 0x800) { /* Up to U+07FF */
-		*s = (unsigned char)(0xC0 | (code >> 6));
-		*(s + 1) = (unsigned char)(0x80 | (code & 0x3F));
-		i += 2;
+
+	first = binomial(s - 1 + t, t);
+	second = binomial(s + t - 2, t - 1);
+	if (rank < first) {
+		bits[0] = 0;
+		gray_comb_unrank(bits + 1, s - 1, t, rank);
 	}
-	else if (code < 0x10000) { /* Up to U+FFFF */
-		*s = (unsigned char)(0xE0 | (code >> 12));
-		*(s + 1) = (unsigned char)(0x80 | ((code >> 6) & 0x3F));
-		*(s + 2) = (unsigned char)(0x80 | (code & 0x3F));
-		i += 3;
+	else if (rank < first + second) {
+		bits[0] = 1, bits[1] = 0;
+		gray_comb_unrank(bits + 2, s - 1, t - 1, first + second - 1 - rank);
 	}
-	else if (code < 0x110000) { /* Up to U+10FFFF */
-		*s = (unsigned char)(0xF0 | (code >> 18));
-		*(s + 1) = (unsigned char)(0x80 | ((code >> 12) & 0x3F));
-		*(s + 2) = (unsigned char)(0x80 | ((code >> 6) & 0x3F));
-		*(s + 3) = (unsigned char)(0x80 | (code & 0x3F));
-		i += 4;
+	else {
+		bits[0] = 1, bits[1] = 1;
+		gray_comb_unrank(bits + 2, s, t - 2, rank - first - second);
 	}
 
-	*offset = i;
+}
+
+
+static unsigned long random_next(unsigned long *state)
+{
+
+	/* xorshift32, kept to 32 bits whatever the width of long */
+
+	unsigned long x = *state & 0xFFFFFFFFUL;
+
+	x ^= (x << 13) & 0xFFFFFFFFUL;
+	x ^= x >> 17;
+	x ^= (x << 5) & 0xFFFFFFFFUL;
+	*state = x;
+
+	return x;
 
 }
 
 
-static long utf8_decode(const char *string, int *offset)
+static long random_below(unsigned long *state, long bound)
 {
 
-	unsigned char byte;
-	int i, j;
-	long code;
+	/* unbiased value in [0, bound) by rejection; xorshift32 never yields 0,
+	 * so its outputs less one are the 2^32 - 1 values below 0xFFFFFFFF, of
+	 * which the first "span", a multiple of "bound", are kept */
 
-	i = *offset;
-	if (i < 0)
-		goto failure;
+	unsigned long span, x;
 
-	byte = *(string + i++);
+	span = 0xFFFFFFFFUL - 0xFFFFFFFFUL % (unsigned long)bound;
+	do {
+		x = random_next(state) - 1;
+	} while (x >= span);
 
-	if (byte < 0x80) {
-		code = byte;
-		j = 0;
+	return (long)(x % (unsigned long)bound);
+
+}
+
+
+static int compare_ints(const void *a, const void *b)
+{
+	int x = *(const int *)a, y = *(const int *)b;
+	return x < y ? -1 : x > y;
+}
+
+
+static long lex_rank(const long *values, const int *counts, int distinct, int length,
+	long total, const long *elements)
+{
+
+	/*
+	 * Each position adds the permutations starting with a smaller element
+	 * still available: total * counts[j] / remaining for every such element,
+	 * "total" being the permutation count of the remaining multiset. The
+	 * terms share a divisor, so their counts are summed first.
+	 */
+
+	int left[ANAGRAM_ELEMENT_LIMIT];
+	long rank, smaller;
+	int remaining, i, j;
+
+	memcpy(left, counts, sizeof(int) * distinct);
+
+	rank = 0;
+	for (i = 0, remaining = length; i < length; i++, remaining--) {
+		for (j = 0, smaller = 0; values[j] != elements[i]; j++)
+			smaller += left[j];
+		rank += total * smaller / remaining;
+		total = total * left[j] / remaining;
+		left[j]--;
 	}
-	else if ((byte & 0xE0) == 0xC0) {
-		code = byte & 0x1F;
-		j = 1;
+
+	return rank;
+
+}
+
+
+static void *classify_run(void *argument)
+{
+
+	struct classify_slice *s = argument;
+	long rank;
+	int i;
+
+	for (i = s->from; i < s->to; i++) {
+		if (classify_one(s->source, s->strings[i], s->ranks != NULL ? &rank : NULL)) {
+			s->members++;
+			if (s->results != NULL)
+				s->results[i] = 1;
+			if (s->ranks != NULL)
+				s->ranks[i] = (int)rank;
+		}
+		else {
+			if (s->results != NULL)
+				s->results[i] = 0;
+			if (s->ranks != NULL)
+				s->ranks[i] = -1;
+		}
 	}
-	else if ((byte & 0xF0) == 0xE0) {
-		code = byte & 0x0F;
-		j = 2;
+
+	return NULL;
+
+}
+
+
+static int classify_one(const struct classify_source *c, const char *string, long *rank)
+{
+
+	long elements[ANAGRAM_ELEMENT_LIMIT], sorted[ANAGRAM_ELEMENT_LIMIT];
+	int length, i;
+
+	if (string == NULL)
+		return 0;
+
+	if (c->ascii) {
+		if (!classify_ascii(c, string))
+			return 0;
+		if (rank == NULL)
+			return 1;
+		for (i = 0; i < c->length; i++)
+			elements[i] = (unsigned char)string[i];
 	}
-	else if ((byte & 0xF8) == 0xF0) {
-		code = byte & 0x07;
-		j = 3;
+	else {
+		length = utf8_elements(string, elements);
+		if (length != c->length)
+			return 0;
+		memcpy(sorted, elements, sizeof(long) * length);
+		sort(sorted, length);
+		if (memcmp(sorted, c->sorted, sizeof(long) * length) != 0)
+			return 0;
+		if (rank == NULL)
+			return 1;
 	}
+
+	if (c->gray)
+		*rank = gray_rank(c->values, c->counts, c->distinct, c->length, elements);
 	else
-		goto failure;
+		*rank = lex_rank(c->values, c->counts, c->distinct, c->length, c->total, elements);
 
-	while (j > 0) {
-		byte = *(string + i++);
-		if ((byte & 0xC0) != 0x80)
-			goto failure;
-		code = (code << 6) | (byte & 0x3F);
-		j--;
-	}
+	return 1;
 
-	if (code != 0)
-		*offset = i;
+}
 
-	return code;
 
-	failure:
-		return -1;
+static int classify_ascii(const struct classify_source *c, const char *string)
+{
+
+	/*
+	 * A candidate of the source length is a permutation if it holds each
+	 * distinct source byte as many times as the source does. The candidate
+	 * is compared against every distinct byte at once (16 bytes cover the
+	 * longest ASCII source).
+	 */
+
+#ifdef ANAGRAM_CLASSIFY_SSE2
+	unsigned char buffer[16];
+	__m128i candidate;
+	unsigned int mask;
+#else
+	int j;
+#endif
+	int n, i;
+
+	for (i = 0; i < c->bytes; i++)
+		if (string[i] == '\0')
+			return 0;
+	if (string[c->bytes] != '\0')
+		return 0;
+
+#ifdef ANAGRAM_CLASSIFY_SSE2
+	memset(buffer, 0, sizeof(buffer));
+	memcpy(buffer, string, c->bytes);
+	candidate = _mm_loadu_si128((const __m128i *)buffer);
+	for (i = 0; i < c->distinct; i++) {
+		mask = (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(candidate,
+			_mm_set1_epi8((char)c->values[i])));
+		for (n = 0; mask != 0; n++)
+			mask &= mask - 1;
+		if (n != c->counts[i])
+			return 0;
+	}
+#else
+	for (i = 0; i < c->distinct; i++) {
+		for (j = 0, n = 0; j < c->bytes; j++)
+			n += (unsigned char)string[j] == c->values[i];
+		if (n != c->counts[i])
+			return 0;
+	}
+#endif
+
+	return 1;
 
 }
 
 
-static int utf8_strlen(const char *string, int *size)
+static void top_visit(struct top_search *t, int depth, int last, double score,
+	long rank, long total)
 {
 
-	int length, i, j;
-	unsigned char byte;
+	/*
+	 * Depth-first over the lexicographic permutation tree, "total" being the
+	 * permutation count of the elements not placed yet and "rank" that of the
+	 * first permutation below this node. Children are visited best bound
+	 * first, and skipped once their bound cannot beat the k-th best so far.
+	 */
 
-	i = 0, length = 0;
-	while ((byte = *(string + i)) != 0)
-	{
-		if (byte < 0x80)
-			j = 0;
-		else if ((byte & 0xE0) == 0xC0)
-			j = 1;
-		else if ((byte & 0xF0) == 0xE0)
-			j = 2;
-		else if ((byte & 0xF8) == 0xF0)
-			j = 3;
-		else
-			goto failure;
-		while (j > 0)
-		{
-			i++, j--;
-			byte = *(string + i);
-			if ((byte & 0xC0) != 0x80)
-				goto failure;
-		}
-		i++, length++;
-	}
+	double scores[ANAGRAM_ELEMENT_LIMIT], bounds[ANAGRAM_ELEMENT_LIMIT], x;
+	long ranks[ANAGRAM_ELEMENT_LIMIT], blocks[ANAGRAM_ELEMENT_LIMIT], r;
+	int order[ANAGRAM_ELEMENT_LIMIT], remaining, count, i, j, v;
+	struct top_entry e;
 
-	if (size != NULL)
-		*size = i;
+	if (depth == t->length) {
+		top_offer(t, score, rank);
+		return;
+	}
 
-	return length;
+	remaining = t->length - depth;
+	for (j = 0, count = 0, r = rank; j < t->distinct; j++) {
+		if (t->counts[j] == 0)
+			continue;
+		blocks[j] = total * t->counts[j] / remaining;
+		ranks[j] = r;
+		r += blocks[j];
+		x = score;
+		if (t->bigram != NULL && last >= 0)
+			x += t->bigram[last * t->distinct + j];
+		if (t->position != NULL)
+			x += t->position[j * t->length + depth];
+		scores[j] = x;
+		t->counts[j]--;
+		bounds[j] = x + top_bound(t, depth + 1, j);
+		t->counts[j]++;
+		for (i = count++; i > 0 && bounds[order[i - 1]] < bounds[j]; i--)
+			order[i] = order[i - 1];
+		order[i] = j;
+	}
 
-	failure:
-		if (size != NULL)
-			*size = 0;
-		return -1;
+	for (i = 0; i < count; i++) {
+		v = order[i];
+		if (t->found == t->k) {
+			/* a tie only wins with a lower rank */
+			e.score = bounds[v], e.rank = ranks[v];
+			if (!top_worse(&t->heap[0], &e))
+				continue;
+		}
+		t->counts[v]--;
+		top_visit(t, depth + 1, v, scores[v], ranks[v], blocks[v]);
+		t->counts[v]++;
+	}
 
 }
 
 
-static void sort(long *elements, int length)
+static double top_bound(struct top_search *t, int depth, int last)
 {
 
 	/*
-	 * Bubble Sort
+	 * Optimistic score of the positions from "depth" on. Every element left
+	 * follows either "last" or another element left, so it adds at most its
+	 * best bigram from one of those; every position adds at most the best
+	 * position weight of the elements left.
 	 */
 
-	int swap, last, i;
-	long temp;
+	double bound, best;
+	int i, j, p;
 
-	if (length < 2)
-		return;
+	bound = 0.0;
 
-	last = length - 1;
-	do {
-		swap = 0;
-		for (i = 0; i < last; i++) {
-			if (elements[i] > elements[i + 1]) {
-				temp = elements[i];
-				elements[i] = elements[i + 1];
-				elements[i + 1] = temp;
-				swap = 1;
-			}
+	if (t->bigram != NULL) {
+		for (j = 0; j < t->distinct; j++) {
+			if (t->counts[j] == 0)
+				continue;
+			best = t->bigram[last * t->distinct + j];
+			for (p = 0; p < t->distinct; p++)
+				if (t->counts[p] > (p == j) && t->bigram[p * t->distinct + j] > best)
+					best = t->bigram[p * t->distinct + j];
+			bound += best * t->counts[j];
 		}
-	} while (swap);
+	}
+
+	if (t->position != NULL) {
+		for (i = depth; i < t->length; i++) {
+			best = 0.0;
+			for (j = 0, p = 0; j < t->distinct; j++)
+				if (t->counts[j] > 0 && (p++ == 0 || t->position[j * t->length + i] > best))
+					best = t->position[j * t->length + i];
+			bound += best;
+		}
+	}
+
+	return bound;
+
+}
+
+
+static void top_offer(struct top_search *t, double score, long rank)
+{
+
+	/* binary min-heap under "top_worse" */
+
+	struct top_entry e, *h = t->heap;
+	int i, c;
+
+	e.score = score, e.rank = rank;
 
+	if (t->found < t->k) {
+		for (i = t->found++; i > 0 && top_worse(&e, &h[(i - 1) / 2]); i = (i - 1) / 2)
+			h[i] = h[(i - 1) / 2];
+		h[i] = e;
+		return;
+	}
+
+	if (!top_worse(&h[0], &e))
+		return;
+
+	for (i = 0; (c = 2 * i + 1) < t->k; i = c) {
+		if (c + 1 < t->k && top_worse(&h[c + 1], &h[c]))
+			c++;
+		if (!top_worse(&h[c], &e))
+			break;
+		h[i] = h[c];
+	}
+	h[i] = e;
+
+}
+
+
+static int top_worse(const struct top_entry *a, const struct top_entry *b)
+{
+	return a->score < b->score || (a->score == b->score && a->rank > b->rank);
+}
+
+
+static int compare_top(const void *a, const void *b)
+{
+	const struct top_entry *x = a, *y = b;
+	return top_worse(x, y) ? 1 : top_worse(y, x) ? -1 : 0;
 }
 
 
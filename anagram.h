@@ -17,10 +17,84 @@
 typedef struct anagram *anagram_ref;
 
 
+/* Reference to sub-anagram list opaque type. */
+typedef struct anagram_sub *anagram_sub_ref;
+
+
+/* Reference to position index opaque type. */
+typedef struct anagram_index *anagram_index_ref;
+
+
+/* Reference to permutation cursor opaque type. */
+typedef struct anagram_cursor *anagram_cursor_ref;
+
+
 /* Callback function to control time expensive functions */
 typedef int (*anagram_callback_f)(void *argument, int count, const char *anagram);
 
 
+/* Callback function of "anagram_generate_gray": also receives the positions
+ * (in elements, first < second) of the two elements swapped since the
+ * previous permutation, or -1 for the first permutation */
+typedef int (*anagram_swap_f)(void *argument, int count, const char *anagram,
+	int first, int second);
+
+
+/* Output formats accepted by "anagram_export". */
+#define ANAGRAM_EXPORT_NUMBERED 0 /* "0000001. string\n" lines */
+#define ANAGRAM_EXPORT_LINES    1 /* newline-delimited strings */
+#define ANAGRAM_EXPORT_NUL      2 /* null-byte-delimited strings */
+#define ANAGRAM_EXPORT_RAW      3 /* fixed-width records, as stored */
+#define ANAGRAM_EXPORT_IMAGE    4 /* whole anagram file, control records too */
+
+
+/*
+ * One condition of a position index query: the element at "position"
+ * (counted from 0, or from the end if negative: -1 is the last) is one of the
+ * elements of the "element" string or, if "negate" is non-zero, none of them.
+ */
+typedef struct anagram_condition {
+	int        position;
+	const char *element;
+	int        negate;
+} anagram_condition;
+
+
+/*
+ * Scoring tables of "anagram_top". Distinct elements are numbered by their
+ * order in the canonical string ("a" 0, "b" 1 and "n" 2 for "banana"). With D
+ * distinct elements out of N, a permutation scores the sum of
+ * "bigram[D * x + y]" for every element x followed by an element y, plus
+ * "position[N * x + i]" for every element x at position i. Either table may be
+ * a null pointer.
+ */
+typedef struct anagram_weights {
+	const double *bigram;
+	const double *position;
+} anagram_weights;
+
+
+/*
+ * Runtime statistics. Counters are always maintained (unless the library is
+ * built with ANAGRAM_NO_STATS defined); phase timings, in seconds, are only
+ * accumulated while enabled through "anagram_stats_timing".
+ */
+typedef struct anagram_stats {
+	unsigned long seeks;
+	unsigned long reads;
+	unsigned long writes;
+	unsigned long syncs;
+	unsigned long bytes_read;
+	unsigned long bytes_written;
+	unsigned long permutations;
+	unsigned long callbacks;
+	double        permute_time;
+	double        encode_time;
+	double        io_time;
+	double        callback_time;
+} anagram_stats;
+
+
 /*
  * This function returns the maximum number of elements
  * an anagram is allowed to have.
@@ -28,22 +102,109 @@ typedef int (*anagram_callback_f)(void *argument, int count, const char *anagram
 int anagram_element_limit(void);
 
 
+/*
+ * This function returns the number of distinct permutations of "string", that
+ * is, the size of its complete permutation list. On failure, returns -1 and
+ * sets errno to indicate the error.
+ */
+int anagram_permutation_total(const char *string);
+
+
 /*
  * This function creates an anagram file on "path" using "string" as source.
- * On success, returns a reference to an anagram object. On failure,
- * returns a NULL pointer and sets errno to indicate the error.
+ * The file starts with a header that keeps the permutation count, the
+ * completion flag and a CRC32C of every block of records, updated as they are
+ * generated. On success, returns a reference to an anagram object. On
+ * failure, returns a NULL pointer and sets errno to indicate the error.
  */
 anagram_ref anagram_create(const char *path, const char *string);
 
 
 /*
- * This function opens an anagram file. On success, returns a reference to an
- * anagram object. On failure, returns a NULL pointer and sets errno to indicate
- * the error.
+ * This function creates an anagram object backed by memory instead of a file,
+ * using "string" as source. Its records are kept in a single arena sized for
+ * every permutation of "string". On success, returns a reference to an anagram
+ * object. On failure, returns a NULL pointer and sets errno to indicate the
+ * error.
+ */
+anagram_ref anagram_create_memory(const char *string);
+
+
+/*
+ * This function opens an anagram file. The permutation count and completion
+ * flag are read from the file header, so opening takes the same time for any
+ * list size (files written before headers are still accepted). A file that
+ * cannot be written is opened for reading only. On success, returns a
+ * reference to an anagram object. On failure, returns a NULL pointer and sets
+ * errno to indicate the error.
  */
 anagram_ref anagram_open(const char *path);
 
 
+/*
+ * This function opens a shard manifest, a text file listing shard files
+ * produced by "anagram_generate_range", and returns a read-only anagram object
+ * presenting them as a single permutation list. Shard paths are relative to
+ * the manifest directory. The list covers contiguous shards from rank 0 and
+ * is complete when they cover every permutation. On failure, returns a NULL
+ * pointer and sets errno to indicate the error.
+ */
+anagram_ref anagram_open_manifest(const char *path);
+
+
+/*
+ * This function appends the fully generated shard "shard", stored on
+ * "shard_path", to the manifest on "path", creating the manifest if needed.
+ * On success, returns 1. On failure, returns 0 and sets errno to indicate
+ * the error.
+ */
+int anagram_manifest_add(const char *path, anagram_ref shard, const char *shard_path);
+
+
+/*
+ * This function opens an anagram file image of "size" bytes already present
+ * in memory (e.g. mapped from a larger file). The image is borrowed: it is
+ * never written nor freed, and "release", when not a null pointer, is called
+ * with "context" once the returned object is deallocated. On success, returns
+ * a reference to a read-only anagram object. On failure, returns a NULL pointer
+ * and sets errno to indicate the error; "release" is not called in that case.
+ */
+anagram_ref anagram_open_buffer(const void *data, long size,
+	void (*release)(void *context), void *context);
+
+
+/*
+ * This function returns an anagram object with "string" as source that reads
+ * the permutations of the fully generated object "shared", whose source must
+ * be made of the same elements (the generated lists are then identical).
+ * "shared" is retained until the returned object is released. Reads through
+ * the alias keep a position of their own and count in its statistics only.
+ * On success, returns a reference to a read-only anagram object. On failure,
+ * returns a NULL pointer and sets errno to indicate the error.
+ */
+anagram_ref anagram_alias(anagram_ref shared, const char *string);
+
+
+/*
+ * This function copies to "buffer" (of "size" bytes) the elements of "string"
+ * in sorted order, which is the first permutation generated for it and
+ * identifies every anagram with the same elements. On success, returns the
+ * length in bytes of the canonical string. On failure, returns -1 and sets
+ * errno to indicate the error.
+ */
+int anagram_canonical_string(const char *string, char *buffer, int size);
+
+
+/*
+ * This function decodes the UTF-8 "string" into at most "size" elements
+ * (code points), stored in "elements", with no limit on the element count of
+ * anagram objects. On success, returns the number of elements. On failure,
+ * returns -1 and sets errno to indicate the error (EILSEQ if "string" is not
+ * valid UTF-8, ERANGE if it holds more than "size" elements).
+ */
+int anagram_decode(const char *string, long *elements, int size);
+
+
 /*
  * This function increments the anagram object reference count and returns
  * the supplied anagram reference.
@@ -85,6 +246,52 @@ int anagram_permutation_count(anagram_ref anagram);
 int anagram_generate(anagram_ref anagram, void *argument, anagram_callback_f callback);
 
 
+/*
+ * This function works like "anagram_generate" but only generates the
+ * permutations of rank "start" (inclusive) to "end" (exclusive, or the end of
+ * the list if negative), making the backing file a shard that can be combined
+ * with others through a manifest (see "anagram_manifest_add"). The first rank
+ * is recorded in the file, and an interrupted shard is resumed by calling the
+ * function again with the same range. On success, it returns 1. On failure,
+ * 0 is returned and errno is set indicate the error.
+ */
+int anagram_generate_range(anagram_ref anagram, int start, int end,
+	void *argument, anagram_callback_f callback);
+
+
+/*
+ * This function returns the number of permutations of the supplied anagram
+ * object that keep at most "fixed" elements at their position in the source
+ * string (0 counts derangements). On error, returns -1 and sets errno.
+ */
+int anagram_constrained_total(anagram_ref anagram, int fixed);
+
+
+/*
+ * This function works like "anagram_generate" but only generates, in
+ * lexicographic order, the permutations that keep at most "fixed" elements at
+ * their position in the source string (0 generates derangements). Subtrees
+ * without such permutations are never visited, so work and storage grow with
+ * the result size. The constraint is recorded in the file; rank, unrank and
+ * sample do not apply to constrained lists. On success, it returns 1. On
+ * failure, 0 is returned and errno is set indicate the error.
+ */
+int anagram_generate_constrained(anagram_ref anagram, int fixed,
+	void *argument, anagram_callback_f callback);
+
+
+/*
+ * This function works like "anagram_generate" but lists the permutations in
+ * minimal-change order: each one differs from the previous one by a single
+ * transposition (of two elements that need not be adjacent), reported to the
+ * callback so incremental consumers do constant work per permutation. The
+ * order is recorded in the file; "anagram_rank", "anagram_unrank" and
+ * "anagram_sample" follow it. On success, it returns 1. On failure, 0 is
+ * returned and errno is set indicate the error.
+ */
+int anagram_generate_gray(anagram_ref anagram, void *argument, anagram_swap_f callback);
+
+
 /*
  * This function checks the generated permutation list. On success, returns 1.
  * On failure, returns 0 and sets errno to indicate the error.
@@ -92,12 +299,74 @@ int anagram_generate(anagram_ref anagram, void *argument, anagram_callback_f cal
 int anagram_test(anagram_ref anagram, void *argument, anagram_callback_f callback);
 
 
+/*
+ * This function checks the generated records against the checksums in the
+ * file header, reading them in large blocks. Unlike "anagram_test", it does
+ * not look for duplicates, but it runs in linear time and also works on lists
+ * still being generated. If the anagram file has no header, 0 is returned and
+ * errno is set to ENOTSUP; if a block does not match its checksum, errno is
+ * set to EILSEQ. On success, returns 1. On failure, returns 0 and sets errno
+ * to indicate the error.
+ */
+int anagram_verify(anagram_ref anagram);
+
+
 /*
  * This function loads a permutation string from the last generated result set.
+ * With lazy reads enabled (see "anagram_set_lazy"), an index past the end of
+ * an unfiltered, partially generated list extends generation to it.
  */
 const char *anagram_string(anagram_ref anagram, int index);
 
 
+/*
+ * This function enables lazy reads with a look-ahead of "chunk" permutations
+ * (0 disables them) and returns the previous look-ahead, or -1 on error.
+ * Reading index i past the generated permutations of a list resumes
+ * generation up to i + chunk; an index more than "chunk" past them is
+ * computed with "anagram_unrank" without generating anything. Only whole,
+ * unfiltered lists are extended.
+ */
+int anagram_set_lazy(anagram_ref anagram, int chunk);
+
+
+/*
+ * This function makes generation publish its progress every "interval"
+ * permutations (0, the default, only publishes when a generation call
+ * returns) and returns the previous interval, or -1 on error. Publishing
+ * syncs the records generated so far to disk, then rewrites the permutation
+ * count in the file header, so other objects (in this or other processes)
+ * reading the file with "anagram_refresh" or "anagram_wait" only see durable
+ * records. Smaller intervals let readers follow closer at the cost of more
+ * syncs. Only one object may generate a file at a time.
+ */
+int anagram_set_publish(anagram_ref anagram, int interval);
+
+
+/*
+ * This function rereads the permutation count and completion flag published
+ * in the file header by the object generating the file, and extends the
+ * unfiltered result set to every published permutation. The header is read
+ * unbuffered, and the file reopened for reading only when it has changed, so
+ * polling is cheap. On success, returns the number of permutations available.
+ * On failure, returns -1 and sets errno to indicate the error (ENOTSUP if the
+ * file has no header, EBUSY if the object itself is generating the file).
+ */
+int anagram_refresh(anagram_ref anagram);
+
+
+/*
+ * This function waits until at least "count" permutations are published (see
+ * "anagram_set_publish") or the list is complete, polling the file header with
+ * pauses that grow up to a few milliseconds. A negative "timeout" waits
+ * forever; otherwise it is the longest wait in milliseconds. On success,
+ * returns the number of permutations available, which is below "count" only
+ * if the complete list is shorter. On failure, returns -1 and sets errno to
+ * indicate the error (ETIMEDOUT if the time ran out).
+ */
+int anagram_wait(anagram_ref anagram, int count, int timeout);
+
+
 /*
  * This function checks if the list of permutations generated for the supplied
  * anagram object is complete (fully generated). 
@@ -107,13 +376,80 @@ int anagram_is_complete(anagram_ref anagram);
 
 /*
  * This function filters the entire list of permutations generated by
- * "anagram_generate" function and sets the anagram object result set.
- * On success, returns the number of permutations found. On error, returns -1
- * and sets errno to indicate the error.
+ * "anagram_generate" function and sets the anagram object result set to the
+ * permutations starting with "term". Lists in minimal-change order cannot be
+ * filtered (EINVAL), though their result set can be reset with an empty
+ * term. On success, returns the number of permutations found. On error,
+ * returns -1 and sets errno to indicate the error.
  */
 int anagram_filter(anagram_ref anagram, const char *term);
 
 
+/*
+ * This function returns the index "string" has (or will have) in the complete
+ * list of permutations of the supplied anagram object, computed from the
+ * source elements without reading the list. On success, returns the rank.
+ * On failure, returns -1 and sets errno to indicate the error (EINVAL if
+ * "string" is not a permutation of the source).
+ */
+int anagram_rank(anagram_ref anagram, const char *string);
+
+
+/*
+ * This function returns the permutation of rank "rank" in the complete list
+ * of the supplied anagram object, computed from the source elements without
+ * reading the list. The returned string is overwritten by the next call.
+ * On failure, returns a NULL pointer and sets errno to indicate the error.
+ */
+const char *anagram_unrank(anagram_ref anagram, int rank);
+
+
+/*
+ * This function draws "k" distinct permutations uniformly at random from the
+ * complete list of the supplied anagram object, using "seed" to initialize
+ * the random generator. Work is proportional to "k", and the list need not be
+ * generated. The drawn ranks are stored in "ranks" (if not a null pointer, of
+ * at least "k" integers), in ascending order if "sorted" is non-zero. If a
+ * callback function is supplied, it is called for each drawn permutation with
+ * "argument", its rank and the permuted string; returning 0 stops the calls.
+ * On success, returns the number of permutations delivered. On failure,
+ * returns -1 and sets errno to indicate the error.
+ */
+int anagram_sample(anagram_ref anagram, int k, unsigned long seed, int sorted,
+	int *ranks, void *argument, anagram_callback_f callback);
+
+
+/*
+ * This function finds the "k" best scoring permutations of the complete list
+ * of the supplied anagram object under "weights", without generating the
+ * list: whole subtrees of the permutation tree are skipped once their best
+ * possible score cannot beat the k-th best found. Results are ordered by
+ * descending score, then ascending rank, and their ranks and scores are
+ * stored in "ranks" and "scores" (either may be a null pointer). If a
+ * callback function is supplied, it is then called for each of them with
+ * "argument", its rank and the permuted string; returning 0 stops the calls.
+ * On success, returns the number of permutations delivered (fewer than "k"
+ * if the list is shorter). On failure, returns -1 and sets errno to indicate
+ * the error.
+ */
+int anagram_top(anagram_ref anagram, const anagram_weights *weights, int k,
+	int *ranks, double *scores, void *argument, anagram_callback_f callback);
+
+
+/*
+ * This function tells which of the "count" candidate "strings" are
+ * permutations of the source string of the supplied anagram object, from its
+ * element histogram alone (no list needs to be generated). For each candidate
+ * "results" (if not a null pointer) receives 1 or 0 and "ranks" (if not a null
+ * pointer) its rank or -1; null or invalid candidates are not permutations.
+ * Large batches are split across threads. On success, returns the number of
+ * permutations found. On failure, returns -1 and sets errno to indicate the
+ * error.
+ */
+int anagram_classify(anagram_ref anagram, const char *const *strings, int count,
+	char *results, int *ranks);
+
+
 /*
  * This function returns a pointer to the last term string used to filter the
  * permutation list. On error, a null pointer is returned.
@@ -130,6 +466,125 @@ const char *anagram_term(anagram_ref anagram);
 int anagram_count(anagram_ref anagram);
 
 
+/*
+ * This function gives direct access to the records of the current result set
+ * of objects held in memory ("anagram_create_memory", "anagram_open_buffer"
+ * and aliases of them). Records are fixed-width: the permutation at index i
+ * of the result set is the "size" bytes (not null-terminated) starting at
+ * offset i * size of the returned pointer, which stays valid until the object
+ * generates more permutations or is released. Other objects return a NULL
+ * pointer and set errno to ENOTSUP; "anagram_read_records" copies their
+ * records instead. On failure, returns a NULL pointer and sets errno to
+ * indicate the error.
+ */
+const char *anagram_records(anagram_ref anagram, int *size);
+
+
+/*
+ * This function copies "count" records of the current result set, starting
+ * at "index", to "buffer" with a single read. Records are fixed-width and not
+ * null-terminated, so "buffer" must hold "count" times the byte length of the
+ * source string. On success, returns the number of records copied, which is
+ * less than "count" at the end of the result set. On failure, returns -1 and
+ * sets errno to indicate the error.
+ */
+int anagram_read_records(anagram_ref anagram, int index, int count, char *buffer);
+
+
+/*
+ * This function writes the records of an anagram object created by
+ * "anagram_create_memory" to a new anagram file on "path" in a single write.
+ * The file can later be loaded with "anagram_open". On success, returns 1.
+ * On failure, returns 0 and sets errno to indicate the error.
+ */
+int anagram_save(anagram_ref anagram, const char *path);
+
+
+/*
+ * This function writes the complete list of the supplied anagram object to
+ * "path" as a compact file: blocks of records, each holding its first record
+ * whole and, for the others, the length of the prefix shared with the
+ * previous record and the remaining bytes. On success, returns 1. On failure,
+ * returns 0 and sets errno to indicate the error (EAGAIN if the list is not
+ * complete).
+ */
+int anagram_save_compact(anagram_ref anagram, const char *path);
+
+
+/*
+ * This function opens a compact file written by "anagram_save_compact" as a
+ * read-only anagram object. The first record of every block is kept in
+ * memory; reading a record decodes its block, once per run of reads within
+ * the same block. On success, returns a reference to an anagram object.
+ * On failure, returns a NULL pointer and sets errno to indicate the error.
+ */
+anagram_ref anagram_open_compact(const char *path);
+
+
+/*
+ * This function returns the index of "string" in the list generated so far,
+ * by binary search (only within one block, found through the block keys, for
+ * compact files). On failure, returns -1 and sets errno to indicate the
+ * error (ENOENT if the list does not hold "string").
+ */
+int anagram_find(anagram_ref anagram, const char *string);
+
+
+/*
+ * This function writes a position index of the permutations generated so far
+ * to "path", reading the list once. For every position and distinct element
+ * it holds the matching records, in chunks of 65536, as runs (long at the
+ * first positions of a lexicographic list) or as a bitmap, whichever is
+ * smaller. On success, returns 1. On failure, returns 0 and sets errno to
+ * indicate the error.
+ */
+int anagram_index_build(anagram_ref anagram, const char *path);
+
+
+/*
+ * This function loads a position index written by "anagram_index_build".
+ * On success, returns a reference to a position index. On failure, returns a
+ * NULL pointer and sets errno to indicate the error.
+ */
+anagram_index_ref anagram_index_open(const char *path);
+
+
+/*
+ * This function returns the number of records covered by the supplied index.
+ * On error, returns -1.
+ */
+int anagram_index_count(anagram_index_ref index);
+
+
+/*
+ * This function finds the records that meet all "count" conditions, combining
+ * the index containers a word at a time, without reading the list. Up to
+ * "size" matching indexes, in ascending order, are stored in "ranks" (which
+ * may be a null pointer). On success, returns the number of matching records.
+ * On failure, returns -1 and sets errno to indicate the error (EINVAL if
+ * "count" exceeds "anagram_element_limit" or a condition is malformed).
+ */
+int anagram_index_query(anagram_index_ref index, const anagram_condition *conditions,
+	int count, int *ranks, int size);
+
+
+/*
+ * Frees the supplied position index. No value is returned.
+ */
+void anagram_index_release(anagram_index_ref index);
+
+
+/*
+ * This function writes the current result set (see "anagram_filter") to the
+ * file descriptor "fd" using one of the ANAGRAM_EXPORT_* formats. Records are
+ * read and written in large blocks. ANAGRAM_EXPORT_IMAGE ignores the result
+ * set and writes a copy of the whole anagram file instead. On success,
+ * returns the number of permutations written. On failure, returns -1 and sets
+ * errno to indicate the error.
+ */
+int anagram_export(anagram_ref anagram, int fd, int format);
+
+
 /*
  * Decrements the reference count of the supplied anagram object.
  * When the reference count reachs 0, the object is deallocated and
@@ -138,4 +593,146 @@ int anagram_count(anagram_ref anagram);
 void anagram_release(anagram_ref anagram);
 
 
+/*
+ * This function copies the statistics of the supplied anagram object to
+ * "stats". If "anagram" is a null pointer, the global statistics are copied
+ * instead; they accumulate the counters of every released anagram object and
+ * sub-anagram list.
+ * On success, returns 1. On failure, returns 0 and sets errno to indicate
+ * the error (ENOTSUP if statistics were compiled out).
+ */
+int anagram_get_stats(anagram_ref anagram, anagram_stats *stats);
+
+
+/*
+ * This function clears the statistics of the supplied anagram object, or the
+ * global statistics if "anagram" is a null pointer. No value is returned.
+ */
+void anagram_reset_stats(anagram_ref anagram);
+
+
+/*
+ * This function enables (non-zero) or disables (zero) phase timings for all
+ * anagram objects and returns the previous setting. Timings read the monotonic
+ * clock several times per permutation and are therefore disabled by default.
+ */
+int anagram_stats_timing(int enable);
+
+
+/*
+ * Sub-anagram lists hold every arrangement of k to n elements drawn from the
+ * n elements of a source string ("ab", "aba", "abn", ... for "banana" and
+ * k = 2), in lexicographic order, as null terminated records of variable
+ * length followed by a rank index with the offset of each record.
+ */
+
+
+/*
+ * This function returns the number of arrangements of "k" or more elements
+ * drawn from the supplied string. On error, returns -1 and sets errno.
+ */
+int anagram_sub_total(const char *string, int k);
+
+
+/*
+ * This function creates a sub-anagram list file for the arrangements of "k"
+ * or more elements of "string". On success, returns a reference to a
+ * sub-anagram list. On failure, returns a NULL pointer and sets errno to
+ * indicate the error.
+ */
+anagram_sub_ref anagram_sub_create(const char *path, const char *string, int k);
+
+
+/*
+ * This function opens a sub-anagram list file, complete or not. On success,
+ * returns a reference to a sub-anagram list. On failure, returns a NULL
+ * pointer and sets errno to indicate the error.
+ */
+anagram_sub_ref anagram_sub_open(const char *path);
+
+
+/*
+ * This function generates the arrangements of the supplied list, resuming
+ * after the last stored one, and writes the rank index once all of them are
+ * stored. Arrangements sharing a prefix are produced from the same partial
+ * walk, one element encoded per record. If a callback function is supplied,
+ * it is called for each stored arrangement with "argument", its count and the
+ * string; returning 0 stops generation, which may be resumed later.
+ * On success, it returns 1. On failure, 0 is returned and errno is set
+ * indicate the error.
+ */
+int anagram_sub_generate(anagram_sub_ref sub, void *argument, anagram_callback_f callback);
+
+
+/*
+ * This function returns the number of arrangements stored in the list.
+ * On error, returns -1.
+ */
+int anagram_sub_count(anagram_sub_ref sub);
+
+
+/*
+ * This function checks if the supplied list is complete and indexed.
+ */
+int anagram_sub_is_complete(anagram_sub_ref sub);
+
+
+/*
+ * This function loads the arrangement of rank "rank" through the rank index
+ * of a complete list. The returned string is overwritten by the next call.
+ * On failure, returns a NULL pointer and sets errno to indicate the error
+ * (EAGAIN if the list is not complete).
+ */
+const char *anagram_sub_string(anagram_sub_ref sub, int rank);
+
+
+/*
+ * This function returns the rank "string" has (or will have) in the complete
+ * list, computed from the source elements without reading the list.
+ * On failure, returns -1 and sets errno to indicate the error (EINVAL if
+ * "string" is not an arrangement of k or more source elements).
+ */
+int anagram_sub_rank(anagram_sub_ref sub, const char *string);
+
+
+/*
+ * Closes the file of the supplied list and frees it. No value is returned.
+ */
+void anagram_sub_release(anagram_sub_ref sub);
+
+
+/*
+ * This function creates a cursor that steps through the permutations of
+ * "string" in the order of "anagram_generate", starting at "rank", with the
+ * same SEPA step but no anagram object or file behind it. On success, returns
+ * a reference to the cursor. On failure, returns a NULL pointer and sets
+ * errno to indicate the error (ERANGE if "rank" is not below
+ * "anagram_permutation_total").
+ */
+anagram_cursor_ref anagram_cursor_create(const char *string, int rank);
+
+
+/*
+ * This function returns the next permutation of the cursor, null terminated,
+ * in a buffer owned by the cursor and overwritten by the next call. After the
+ * last permutation, returns a NULL pointer and leaves errno unchanged. On
+ * failure, returns a NULL pointer and sets errno to indicate the error.
+ */
+const char *anagram_cursor_next(anagram_cursor_ref cursor);
+
+
+/*
+ * This function returns the rank of the permutation the next call to
+ * "anagram_cursor_next" returns (the permutation total once all were
+ * returned). On error, returns -1.
+ */
+int anagram_cursor_rank(anagram_cursor_ref cursor);
+
+
+/*
+ * Frees the supplied cursor. No value is returned.
+ */
+void anagram_cursor_release(anagram_cursor_ref cursor);
+
+
 #endif
@@ -0,0 +1,603 @@
+/*
+ * @file anagram.hpp
+ * @author Emanuel Fiuza de Oliveira
+ * @email efiuza87@gmail.com
+ *
+ * Header-only C++17 interface. "anagrams::handle" owns a reference to an
+ * anagram object; "anagrams::records" is a random-access range over a result
+ * set whose elements are "std::string_view"s of the fixed-width records.
+ * Records of objects held in memory are viewed in place; the records of other
+ * objects are read once, in a single block, into a buffer shared by copies of
+ * the range. Elements are never copied afterwards and reading them touches no
+ * shared state, so the range can be handed to parallel algorithms:
+ *
+ *     anagrams::handle h = anagrams::handle::create_memory("listen");
+ *     h.generate();
+ *     anagrams::records r = h.records();
+ *     std::for_each(std::execution::par, r.begin(), r.end(),
+ *         [](std::string_view s) { ... });
+ *
+ * "anagrams::cursor" steps through permutations without any anagram object or
+ * file. Under C++20, "anagrams::permutations" wraps it in a lazy generator:
+ *
+ *     for (std::string_view s : anagrams::permutations("listen", 100))
+ *         if (accept(s))
+ *             break;
+ */
+
+
+#ifndef _ANAGRAM_HPP
+#define _ANAGRAM_HPP
+
+
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <iterator>
+#include <memory>
+#include <string_view>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#if __cplusplus >= 202002L && defined(__has_include)
+#if __has_include(<coroutine>)
+#include <coroutine>
+#include <exception>
+#define ANAGRAM_HPP_GENERATOR 1
+#endif
+#endif
+
+extern "C" {
+#include "anagram.h"
+}
+
+
+namespace anagrams {
+
+
+/*
+ * Throws the error described by errno as a "std::system_error".
+ */
+[[noreturn]] inline void raise(const char *what)
+{
+	throw std::system_error(errno, std::generic_category(), what);
+}
+
+
+class records;
+
+
+/*
+ * Owner of one reference to an anagram object. Copies retain the object
+ * ("anagram_retain") and destruction releases it ("anagram_release").
+ */
+class handle {
+
+public:
+
+	handle() noexcept = default;
+
+	/* adopts "ref", a reference the caller already owns */
+	explicit handle(anagram_ref ref) noexcept : ref_(ref) {}
+
+	handle(const handle &other) noexcept : ref_(anagram_retain(other.ref_)) {}
+
+	handle(handle &&other) noexcept : ref_(std::exchange(other.ref_, nullptr)) {}
+
+	handle &operator=(handle other) noexcept
+	{
+		std::swap(ref_, other.ref_);
+		return *this;
+	}
+
+	~handle()
+	{
+		anagram_release(ref_);
+	}
+
+	static handle create(const char *path, const char *string)
+	{
+		return adopt(anagram_create(path, string), "anagram_create");
+	}
+
+	static handle create_memory(const char *string)
+	{
+		return adopt(anagram_create_memory(string), "anagram_create_memory");
+	}
+
+	static handle open(const char *path)
+	{
+		return adopt(anagram_open(path), "anagram_open");
+	}
+
+	static handle alias(const handle &shared, const char *string)
+	{
+		return adopt(anagram_alias(shared.ref_, string), "anagram_alias");
+	}
+
+	anagram_ref get() const noexcept
+	{
+		return ref_;
+	}
+
+	explicit operator bool() const noexcept
+	{
+		return ref_ != nullptr;
+	}
+
+	void generate()
+	{
+		if (!anagram_generate(ref_, nullptr, nullptr))
+			raise("anagram_generate");
+	}
+
+	/* narrows the result set; see "anagram_filter" */
+	std::size_t filter(const char *term)
+	{
+		int count = anagram_filter(ref_, term);
+		if (count < 0)
+			raise("anagram_filter");
+		return static_cast<std::size_t>(count);
+	}
+
+	bool complete() const noexcept
+	{
+		return anagram_is_complete(ref_) != 0;
+	}
+
+	/* a range over the current result set */
+	anagrams::records records() const;
+
+private:
+
+	static handle adopt(anagram_ref ref, const char *what)
+	{
+		if (ref == nullptr)
+			raise(what);
+		return handle(ref);
+	}
+
+	anagram_ref ref_ = nullptr;
+
+};
+
+
+/*
+ * Random-access range over the result set an anagram object had when the
+ * range was made. The range keeps the object alive; result sets changed
+ * later (by "anagram_filter" or generation) are not reflected.
+ */
+class records {
+
+public:
+
+	class iterator {
+
+	public:
+
+		using iterator_category = std::random_access_iterator_tag;
+#if __cplusplus >= 202002L
+		using iterator_concept = std::random_access_iterator_tag;
+#endif
+		using value_type = std::string_view;
+		using difference_type = std::ptrdiff_t;
+		using reference = std::string_view;
+		using pointer = void;
+
+		iterator() noexcept = default;
+
+		iterator(const char *record, std::size_t size) noexcept : record_(record), size_(size) {}
+
+		reference operator*() const noexcept
+		{
+			return std::string_view(record_, size_);
+		}
+
+		reference operator[](difference_type n) const noexcept
+		{
+			return *(*this + n);
+		}
+
+		iterator &operator++() noexcept
+		{
+			record_ += size_;
+			return *this;
+		}
+
+		iterator operator++(int) noexcept
+		{
+			iterator previous = *this;
+			record_ += size_;
+			return previous;
+		}
+
+		iterator &operator--() noexcept
+		{
+			record_ -= size_;
+			return *this;
+		}
+
+		iterator operator--(int) noexcept
+		{
+			iterator previous = *this;
+			record_ -= size_;
+			return previous;
+		}
+
+		iterator &operator+=(difference_type n) noexcept
+		{
+			record_ += n * static_cast<difference_type>(size_);
+			return *this;
+		}
+
+		iterator &operator-=(difference_type n) noexcept
+		{
+			record_ -= n * static_cast<difference_type>(size_);
+			return *this;
+		}
+
+		friend iterator operator+(iterator i, difference_type n) noexcept
+		{
+			return i += n;
+		}
+
+		friend iterator operator+(difference_type n, iterator i) noexcept
+		{
+			return i += n;
+		}
+
+		friend iterator operator-(iterator i, difference_type n) noexcept
+		{
+			return i -= n;
+		}
+
+		friend difference_type operator-(const iterator &a, const iterator &b) noexcept
+		{
+			return a.size_ != 0 ? (a.record_ - b.record_) / static_cast<difference_type>(a.size_) : 0;
+		}
+
+		friend bool operator==(const iterator &a, const iterator &b) noexcept
+		{
+			return a.record_ == b.record_;
+		}
+
+		friend bool operator!=(const iterator &a, const iterator &b) noexcept
+		{
+			return a.record_ != b.record_;
+		}
+
+		friend bool operator<(const iterator &a, const iterator &b) noexcept
+		{
+			return a.record_ < b.record_;
+		}
+
+		friend bool operator>(const iterator &a, const iterator &b) noexcept
+		{
+			return a.record_ > b.record_;
+		}
+
+		friend bool operator<=(const iterator &a, const iterator &b) noexcept
+		{
+			return a.record_ <= b.record_;
+		}
+
+		friend bool operator>=(const iterator &a, const iterator &b) noexcept
+		{
+			return a.record_ >= b.record_;
+		}
+
+	private:
+
+		const char  *record_ = nullptr;
+		std::size_t size_ = 0;
+
+	};
+
+	using value_type = std::string_view;
+	using reference = std::string_view;
+	using const_iterator = iterator;
+	using size_type = std::size_t;
+	using difference_type = std::ptrdiff_t;
+
+	records() noexcept = default;
+
+	explicit records(const handle &owner) : owner_(owner)
+	{
+		int count = anagram_count(owner_.get()), size = 0;
+
+		if (count < 0)
+			raise("anagram_count");
+
+		/* records held in memory are viewed in place */
+		data_ = anagram_records(owner_.get(), &size);
+		if (data_ == nullptr) {
+			if (errno != ENOTSUP)
+				raise("anagram_records");
+			size = static_cast<int>(std::strlen(anagram_source_string(owner_.get())));
+			if (count > 0) {
+				buffer_ = std::make_shared<std::vector<char>>(static_cast<std::size_t>(count) * size);
+				if (anagram_read_records(owner_.get(), 0, count, buffer_->data()) != count)
+					raise("anagram_read_records");
+				data_ = buffer_->data();
+			}
+		}
+
+		size_ = static_cast<std::size_t>(size);
+		count_ = static_cast<std::size_t>(count);
+	}
+
+	iterator begin() const noexcept
+	{
+		return iterator(data_, size_);
+	}
+
+	iterator end() const noexcept
+	{
+		return iterator(data_ + count_ * size_, size_);
+	}
+
+	size_type size() const noexcept
+	{
+		return count_;
+	}
+
+	bool empty() const noexcept
+	{
+		return count_ == 0;
+	}
+
+	reference operator[](size_type index) const noexcept
+	{
+		return std::string_view(data_ + index * size_, size_);
+	}
+
+	const handle &owner() const noexcept
+	{
+		return owner_;
+	}
+
+private:
+
+	handle      owner_;
+	std::shared_ptr<std::vector<char>> buffer_;
+	const char  *data_ = nullptr;
+	std::size_t size_ = 0;
+	std::size_t count_ = 0;
+
+};
+
+
+inline anagrams::records handle::records() const
+{
+	return anagrams::records(*this);
+}
+
+
+/*
+ * Owner of an "anagram_cursor". Each view returned by "next" stays valid until
+ * the following call.
+ */
+class cursor {
+
+public:
+
+	explicit cursor(const char *string, int rank = 0)
+		: ref_(anagram_cursor_create(string, rank))
+	{
+		if (ref_ == nullptr)
+			raise("anagram_cursor_create");
+		size_ = std::strlen(string);
+	}
+
+	cursor(cursor &&other) noexcept
+		: ref_(std::exchange(other.ref_, nullptr)), size_(other.size_) {}
+
+	cursor &operator=(cursor &&other) noexcept
+	{
+		std::swap(ref_, other.ref_);
+		std::swap(size_, other.size_);
+		return *this;
+	}
+
+	cursor(const cursor &) = delete;
+	cursor &operator=(const cursor &) = delete;
+
+	~cursor()
+	{
+		anagram_cursor_release(ref_);
+	}
+
+	/* false once every permutation was returned */
+	bool next(std::string_view &permutation) noexcept
+	{
+		const char *record = anagram_cursor_next(ref_);
+		if (record == nullptr)
+			return false;
+		permutation = std::string_view(record, size_);
+		return true;
+	}
+
+	/* rank of the permutation the next call returns */
+	int rank() const noexcept
+	{
+		return anagram_cursor_rank(ref_);
+	}
+
+private:
+
+	anagram_cursor_ref ref_ = nullptr;
+	std::size_t        size_ = 0;
+
+};
+
+
+#ifdef ANAGRAM_HPP_GENERATOR
+
+
+/*
+ * Minimal lazy, move-only, single-pass coroutine generator. The body runs only
+ * as the range is iterated, and destroying the generator (leaving the loop
+ * early, say) destroys the suspended body with it.
+ */
+template <typename T>
+class generator {
+
+public:
+
+	struct promise_type {
+
+		const T            *value = nullptr;
+		std::exception_ptr exception;
+
+		generator get_return_object() noexcept
+		{
+			return generator(std::coroutine_handle<promise_type>::from_promise(*this));
+		}
+
+		std::suspend_always initial_suspend() const noexcept
+		{
+			return {};
+		}
+
+		std::suspend_always final_suspend() const noexcept
+		{
+			return {};
+		}
+
+		/* the yielded object lives in the suspended frame until resumed */
+		std::suspend_always yield_value(const T &v) noexcept
+		{
+			value = std::addressof(v);
+			return {};
+		}
+
+		void return_void() const noexcept {}
+
+		void unhandled_exception() noexcept
+		{
+			exception = std::current_exception();
+		}
+
+		template <typename U>
+		void await_transform(U &&) = delete;
+
+	};
+
+	class iterator {
+
+	public:
+
+		using iterator_category = std::input_iterator_tag;
+		using iterator_concept = std::input_iterator_tag;
+		using value_type = T;
+		using difference_type = std::ptrdiff_t;
+		using reference = const T &;
+
+		iterator() noexcept = default;
+
+		explicit iterator(std::coroutine_handle<promise_type> coroutine) noexcept : coroutine_(coroutine) {}
+
+		reference operator*() const noexcept
+		{
+			return *coroutine_.promise().value;
+		}
+
+		iterator &operator++()
+		{
+			coroutine_.resume();
+			if (coroutine_.done() && coroutine_.promise().exception)
+				std::rethrow_exception(coroutine_.promise().exception);
+			return *this;
+		}
+
+		void operator++(int)
+		{
+			++*this;
+		}
+
+		friend bool operator==(const iterator &i, std::default_sentinel_t) noexcept
+		{
+			return i.coroutine_ == nullptr || i.coroutine_.done();
+		}
+
+	private:
+
+		std::coroutine_handle<promise_type> coroutine_ = nullptr;
+
+	};
+
+	generator(generator &&other) noexcept : coroutine_(std::exchange(other.coroutine_, nullptr)) {}
+
+	generator &operator=(generator &&other) noexcept
+	{
+		std::swap(coroutine_, other.coroutine_);
+		return *this;
+	}
+
+	generator(const generator &) = delete;
+	generator &operator=(const generator &) = delete;
+
+	~generator()
+	{
+		if (coroutine_)
+			coroutine_.destroy();
+	}
+
+	/* runs the body to its first value; call once */
+	iterator begin()
+	{
+		iterator i(coroutine_);
+		++i;
+		return i;
+	}
+
+	std::default_sentinel_t end() const noexcept
+	{
+		return {};
+	}
+
+private:
+
+	explicit generator(std::coroutine_handle<promise_type> coroutine) noexcept : coroutine_(coroutine) {}
+
+	std::coroutine_handle<promise_type> coroutine_ = nullptr;
+
+};
+
+
+namespace detail {
+
+
+inline generator<std::string_view> drain(cursor c)
+{
+	std::string_view permutation;
+
+	while (c.next(permutation))
+		co_yield permutation;
+}
+
+
+}
+
+
+/*
+ * The permutations of "string" from "rank" on, in the order of
+ * "anagram_generate", as a lazy range of views into the cursor's buffer (each
+ * valid until the iterator is advanced). The cursor and the coroutine frame
+ * are allocated once per range and nothing per permutation; errors in the
+ * arguments are thrown here rather than on first iteration.
+ */
+inline generator<std::string_view> permutations(const char *string, int rank = 0)
+{
+	return detail::drain(cursor(string, rank));
+}
+
+
+#endif
+
+
+}
+
+
+#endif
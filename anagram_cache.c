@@ -0,0 +1,226 @@
+/*
+ * @file anagram_cache.c
+ * @author Emanuel Fiuza de Oliveira
+ * @email efiuza87@gmail.com
+ */
+
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "anagram_cache.h"
+#include "anagram_table.h"
+
+
+/* enough for the longest canonical string plus its null byte */
+#define CACHE_KEY_SIZE 48
+
+
+/*
+ * Basic Types
+ */
+
+
+struct cache_entry {
+	char        key[CACHE_KEY_SIZE];
+	anagram_ref set;
+};
+
+
+struct anagram_cache {
+	char                 *directory;
+	struct cache_entry   *entries;
+	int                  count;
+	int                  capacity;
+	struct anagram_table table;
+};
+
+
+/*
+ * Static Function Interface
+ */
+
+
+static anagram_ref cache_load(struct anagram_cache *c, const char *key);
+static int cache_insert(struct anagram_cache *c, const char *key, anagram_ref set);
+static const char *cache_key(const void *context, int entry);
+
+
+/*
+ * Interface Implementation
+ */
+
+
+anagram_cache_ref anagram_cache_create(const char *directory)
+{
+
+	struct anagram_cache *c;
+
+	c = malloc(sizeof(struct anagram_cache));
+	if (c == NULL)
+		return NULL;
+
+	memset(c, 0, sizeof(struct anagram_cache));
+	c->directory = NULL;
+	c->entries = NULL;
+
+	if (directory != NULL) {
+		c->directory = malloc(strlen(directory) + 1);
+		if (c->directory == NULL)
+			goto failure;
+		strcpy(c->directory, directory);
+	}
+
+	if (!anagram_table_init(&c->table, 64, cache_key, c))
+		goto failure;
+
+	return c;
+
+	failure:
+		anagram_cache_release(c);
+		errno = ENOMEM;
+		return NULL;
+
+}
+
+
+anagram_ref anagram_cache_get(anagram_cache_ref c, const char *string)
+{
+
+	anagram_ref set;
+	char key[CACHE_KEY_SIZE];
+	int i;
+
+	if (c == NULL || anagram_canonical_string(string, key, CACHE_KEY_SIZE) < 0) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	i = anagram_table_find(&c->table, key);
+	if (i < 0) {
+		set = cache_load(c, key);
+		if (set == NULL)
+			return NULL;
+		if (!cache_insert(c, key, set)) {
+			anagram_release(set);
+			errno = ENOMEM;
+			return NULL;
+		}
+		i = c->count - 1;
+	}
+
+	return anagram_alias(c->entries[i].set, string);
+
+}
+
+
+int anagram_cache_count(anagram_cache_ref c)
+{
+	if (c != NULL)
+		return c->count;
+	return -1;
+}
+
+
+void anagram_cache_release(anagram_cache_ref c)
+{
+
+	int i;
+
+	if (c == NULL)
+		return;
+
+	for (i = 0; i < c->count; i++)
+		anagram_release(c->entries[i].set);
+
+	free(c->directory);
+	free(c->entries);
+	anagram_table_free(&c->table);
+	free(c);
+
+}
+
+
+/*
+ * Static Function Implementation
+ */
+
+
+static anagram_ref cache_load(struct anagram_cache *c, const char *key)
+{
+
+	anagram_ref set;
+	char *path, *p;
+	const char *k;
+	int errn;
+
+	if (c->directory == NULL) {
+		set = anagram_create_memory(key);
+		if (set == NULL)
+			return NULL;
+		if (!anagram_generate(set, NULL, NULL)) {
+			errn = errno;
+			anagram_release(set);
+			errno = errn;
+			return NULL;
+		}
+		return set;
+	}
+
+	/* file names are the hex encoded key, which may hold any element */
+	path = malloc(strlen(c->directory) + 2 * strlen(key) + 10);
+	if (path == NULL)
+		return NULL;
+	p = path + sprintf(path, "%s/", c->directory);
+	for (k = key; *k != '\0'; k++)
+		p += sprintf(p, "%02x", (unsigned char)*k);
+	strcpy(p, ".anagram");
+
+	/* reuse a list left by a previous run, resuming it if incomplete */
+	set = anagram_open(path);
+	if (set == NULL && errno == ENOENT)
+		set = anagram_create(path, key);
+	if (set != NULL && !anagram_generate(set, NULL, NULL)) {
+		errn = errno;
+		anagram_release(set);
+		set = NULL;
+		errno = errn;
+	}
+
+	free(path);
+
+	return set;
+
+}
+
+
+static int cache_insert(struct anagram_cache *c, const char *key, anagram_ref set)
+{
+
+	struct cache_entry *entries;
+
+	if (c->count == c->capacity) {
+		entries = realloc(c->entries, sizeof(struct cache_entry) * (c->capacity + 64));
+		if (entries == NULL)
+			return 0;
+		c->entries = entries;
+		c->capacity += 64;
+	}
+
+	strcpy(c->entries[c->count].key, key);
+	c->entries[c->count].set = set;
+
+	if (!anagram_table_insert(&c->table))
+		return 0;
+	c->count++;
+
+	return 1;
+
+}
+
+
+static const char *cache_key(const void *context, int entry)
+{
+	return ((const struct anagram_cache *)context)->entries[entry].key;
+}
@@ -0,0 +1,60 @@
+/*
+ * @file anagram_cache.h
+ * @author Emanuel Fiuza de Oliveira
+ * @email efiuza87@gmail.com
+ */
+
+
+#ifndef _ANAGRAM_CACHE_H
+#define _ANAGRAM_CACHE_H
+
+
+#include "anagram.h"
+
+
+/*
+ * An anagram cache keeps one generated permutation list per multiset of
+ * elements ("listen", "silent" and "enlist" share a single list) and hands out
+ * objects that read it while keeping each caller's own source string.
+ */
+
+
+/* Reference to anagram cache opaque type. */
+typedef struct anagram_cache *anagram_cache_ref;
+
+
+/*
+ * This function creates an anagram cache. Shared lists are kept as anagram
+ * files in "directory" (reused across runs) or, if "directory" is a null
+ * pointer, as in-memory anagram objects. On success, returns a reference to
+ * an anagram cache. On failure, returns a NULL pointer and sets errno to
+ * indicate the error.
+ */
+anagram_cache_ref anagram_cache_create(const char *directory);
+
+
+/*
+ * This function returns an anagram object for "string", generating the shared
+ * permutation list of its elements first if the cache does not hold it yet.
+ * The object must be freed with "anagram_release". On failure, returns a NULL
+ * pointer and sets errno to indicate the error.
+ */
+anagram_ref anagram_cache_get(anagram_cache_ref cache, const char *string);
+
+
+/*
+ * This function returns the number of distinct permutation lists held by the
+ * cache. On error, returns -1.
+ */
+int anagram_cache_count(anagram_cache_ref cache);
+
+
+/*
+ * Releases the cache and its references to the shared lists. Objects obtained
+ * through "anagram_cache_get" stay valid until they are released.
+ * No value is returned.
+ */
+void anagram_cache_release(anagram_cache_ref cache);
+
+
+#endif
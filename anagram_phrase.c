@@ -0,0 +1,646 @@
+/*
+ * @file anagram_phrase.c
+ * @author Emanuel Fiuza de Oliveira
+ * @email efiuza87@gmail.com
+ */
+
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define PHRASE_SSE2
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define PHRASE_NEON
+#endif
+#include "anagram_phrase.h"
+
+
+#define PHRASE_LINE_LIMIT 256
+#define PHRASE_ELEMENT_LIMIT 255     /* element counts are bytes */
+#define PHRASE_LANES 32              /* distinct elements of a source */
+#define PHRASE_MEMO_LIMIT (1 << 20)  /* dead ends remembered per thread */
+#define PHRASE_BUFFER_SIZE (5 * PHRASE_ELEMENT_LIMIT + 1)
+
+
+/*
+ * Basic Types
+ */
+
+
+struct anagram_phrase {
+	char **words;
+	int  count;
+	int  capacity;
+};
+
+
+/* a dictionary word made of source elements only */
+struct phrase_candidate {
+	unsigned char counts[PHRASE_LANES];  /* of each distinct source element */
+	const char    *word;
+	int           length;
+};
+
+
+struct phrase_memo {
+	unsigned char remaining[PHRASE_LANES];
+	int           budget;  /* words left, 0 if unlimited */
+	int           start;   /* dead end from this candidate on, -1 if free */
+};
+
+
+struct phrase_search {
+	struct phrase_candidate *candidates;  /* longest first */
+	int                     count;
+	int                     words;
+	unsigned char           source[PHRASE_LANES];
+	int                     length;
+	pthread_mutex_t         mutex;
+	int                     next;   /* next top level branch */
+	int                     stop;
+	int                     found;
+	void                    *argument;
+	anagram_callback_f      callback;
+};
+
+
+struct phrase_worker {
+	pthread_t            thread;
+	struct phrase_search *search;
+	struct phrase_memo   *memo;   /* open addressing */
+	int                  buckets;
+	int                  used;
+	int                  path[PHRASE_ELEMENT_LIMIT];
+};
+
+
+/*
+ * Static Function Interface
+ */
+
+
+static void *phrase_work(void *argument);
+static int phrase_visit(struct phrase_worker *w, const unsigned char *remaining,
+	int left, int start, int depth);
+static int phrase_emit(struct phrase_worker *w, int depth);
+static int phrase_candidates(struct phrase_search *s, struct anagram_phrase *p,
+	const char *string);
+static int memo_failed(struct phrase_worker *w, const unsigned char *remaining,
+	int budget, int start);
+static void memo_insert(struct phrase_worker *w, const unsigned char *remaining,
+	int budget, int start);
+static int memo_rehash(struct phrase_worker *w, int buckets);
+static unsigned long memo_hash(const unsigned char *remaining, int budget);
+static int vector_fits(const unsigned char *counts, const unsigned char *remaining);
+static void vector_subtract(unsigned char *result, const unsigned char *remaining,
+	const unsigned char *counts);
+static int compare_elements(const void *a, const void *b);
+static int compare_candidates(const void *a, const void *b);
+
+
+/*
+ * Interface Implementation
+ */
+
+
+anagram_phrase_ref anagram_phrase_create(const char *path)
+{
+
+	struct anagram_phrase *p;
+	FILE *fp;
+	char line[PHRASE_LINE_LIMIT];
+	int errn;
+
+	p = malloc(sizeof(struct anagram_phrase));
+	if (p == NULL)
+		return NULL;
+
+	memset(p, 0, sizeof(struct anagram_phrase));
+	p->words = NULL;
+
+	if (path == NULL)
+		return p;
+
+	fp = fopen(path, "r");
+	if (fp == NULL)
+		goto failure;
+
+	while (fgets(line, PHRASE_LINE_LIMIT, fp) != NULL) {
+		line[strcspn(line, "\r\n")] = '\0';
+		if (line[0] == '\0')
+			continue;
+		if (anagram_phrase_add(p, line) < 0) {
+			fclose(fp);
+			goto failure;
+		}
+	}
+
+	fclose(fp);
+
+	return p;
+
+	failure:
+		errn = errno;
+		anagram_phrase_release(p);
+		errno = errn;
+		return NULL;
+
+}
+
+
+int anagram_phrase_add(anagram_phrase_ref p, const char *word)
+{
+
+	char **words;
+
+	if (p == NULL || word == NULL) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (p->count == p->capacity) {
+		words = realloc(p->words, sizeof(char *) * (p->capacity > 0 ? p->capacity * 2 : 1024));
+		if (words == NULL) {
+			errno = ENOMEM;
+			return -1;
+		}
+		p->words = words;
+		p->capacity = p->capacity > 0 ? p->capacity * 2 : 1024;
+	}
+
+	p->words[p->count] = malloc(strlen(word) + 1);
+	if (p->words[p->count] == NULL) {
+		errno = ENOMEM;
+		return -1;
+	}
+	strcpy(p->words[p->count], word);
+
+	return ++p->count;
+
+}
+
+
+int anagram_phrase_count(anagram_phrase_ref p)
+{
+	if (p != NULL)
+		return p->count;
+	return -1;
+}
+
+
+int anagram_phrase_solve(anagram_phrase_ref p, const char *string, int words,
+	int threads, void *argument, anagram_callback_f callback)
+{
+
+	struct phrase_search s;
+	struct phrase_worker *workers;
+	int started, i;
+
+	if (p == NULL || string == NULL || words < 0 || threads < 0 || callback == NULL) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	memset(&s, 0, sizeof(struct phrase_search));
+	s.candidates = NULL;
+	s.words = words;
+	s.argument = argument;
+	s.callback = callback;
+
+	if (!phrase_candidates(&s, p, string))
+		return -1;
+
+	if (s.length == 0 || s.count == 0) {
+		free(s.candidates);
+		return 0;
+	}
+
+	/* top level branches are dealt one at a time to the threads */
+	if (threads == 0)
+		threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	if (threads > s.count)
+		threads = s.count;
+	if (threads < 1)
+		threads = 1;
+
+	workers = calloc(threads, sizeof(struct phrase_worker));
+	if (workers == NULL) {
+		free(s.candidates);
+		errno = ENOMEM;
+		return -1;
+	}
+
+	pthread_mutex_init(&s.mutex, NULL);
+	for (i = 0; i < threads; i++) {
+		workers[i].search = &s;
+		workers[i].memo = NULL;
+	}
+
+	/* the calling thread is the first worker; threads that fail to start
+	 * leave their share to the others */
+	for (started = 1; started < threads; started++)
+		if (pthread_create(&workers[started].thread, NULL, phrase_work, &workers[started]) != 0)
+			break;
+	phrase_work(&workers[0]);
+	for (i = 1; i < started; i++)
+		pthread_join(workers[i].thread, NULL);
+
+	for (i = 0; i < threads; i++)
+		free(workers[i].memo);
+	free(workers);
+	pthread_mutex_destroy(&s.mutex);
+	free(s.candidates);
+
+	return s.found;
+
+}
+
+
+void anagram_phrase_release(anagram_phrase_ref p)
+{
+
+	int i;
+
+	if (p == NULL)
+		return;
+
+	for (i = 0; i < p->count; i++)
+		free(p->words[i]);
+
+	free(p->words);
+	free(p);
+
+}
+
+
+/*
+ * Static Function Implementation
+ */
+
+
+static void *phrase_work(void *argument)
+{
+
+	struct phrase_worker *w = argument;
+	struct phrase_search *s = w->search;
+	struct phrase_candidate *c;
+	unsigned char remaining[PHRASE_LANES];
+	int i;
+
+	for (;;) {
+		pthread_mutex_lock(&s->mutex);
+		i = s->stop ? s->count : s->next++;
+		pthread_mutex_unlock(&s->mutex);
+		if (i >= s->count)
+			break;
+		c = &s->candidates[i];
+		vector_subtract(remaining, s->source, c->counts);
+		w->path[0] = i;
+		if (phrase_visit(w, remaining, s->length - c->length, i, 1) < 0)
+			break;
+	}
+
+	return NULL;
+
+}
+
+
+static int phrase_visit(struct phrase_worker *w, const unsigned char *remaining,
+	int left, int start, int depth)
+{
+
+	/*
+	 * Phrases take candidates in list order, from "start" on, so each set of
+	 * words is tried once. Returns 1 if a phrase was found below, 0 if none
+	 * was, or -1 once the search is stopped. Dead ends are remembered by
+	 * remaining multiset, so the many word orders leading to the same one
+	 * are only explored once.
+	 */
+
+	struct phrase_search *s = w->search;
+	struct phrase_candidate *c;
+	unsigned char next[PHRASE_LANES];
+	int budget, found, r, i;
+
+	if (left == 0)
+		return phrase_emit(w, depth);
+
+	/* read without locking; a late stop only costs some work */
+	if (s->stop)
+		return -1;
+
+	/* candidates are longest first */
+	budget = s->words > 0 ? s->words - depth : 0;
+	if (s->words > 0 && (budget == 0 || left > budget * s->candidates[start].length))
+		return 0;
+
+	if (memo_failed(w, remaining, budget, start))
+		return 0;
+
+	found = 0;
+	for (i = start; i < s->count; i++) {
+		c = &s->candidates[i];
+		if (c->length > left || !vector_fits(c->counts, remaining))
+			continue;
+		vector_subtract(next, remaining, c->counts);
+		w->path[depth] = i;
+		r = phrase_visit(w, next, left - c->length, i, depth + 1);
+		if (r < 0)
+			return r;
+		found |= r;
+	}
+
+	if (!found)
+		memo_insert(w, remaining, budget, start);
+
+	return found;
+
+}
+
+
+static int phrase_emit(struct phrase_worker *w, int depth)
+{
+
+	struct phrase_search *s = w->search;
+	char buffer[PHRASE_BUFFER_SIZE];
+	const char *word;
+	int offset, size, r, i;
+
+	for (i = 0, offset = 0; i < depth; i++) {
+		if (i > 0)
+			buffer[offset++] = ' ';
+		word = s->candidates[w->path[i]].word;
+		size = (int)strlen(word);
+		memcpy(buffer + offset, word, size);
+		offset += size;
+	}
+	buffer[offset] = '\0';
+
+	r = -1;
+	pthread_mutex_lock(&s->mutex);
+	if (!s->stop) {
+		r = 1;
+		if (!s->callback(s->argument, ++s->found, buffer)) {
+			s->stop = 1;
+			r = -1;
+		}
+	}
+	pthread_mutex_unlock(&s->mutex);
+
+	return r;
+
+}
+
+
+static int phrase_candidates(struct phrase_search *s, struct anagram_phrase *p,
+	const char *string)
+{
+
+	long elements[PHRASE_ELEMENT_LIMIT], values[PHRASE_LANES], *value;
+	struct phrase_candidate *c;
+	int length, distinct, i, j;
+
+	/* source elements, spaces aside, counted by distinct value */
+	length = anagram_decode(string, elements, PHRASE_ELEMENT_LIMIT);
+	if (length < 0)
+		return 0;
+	for (i = 0, j = 0; i < length; i++)
+		if (elements[i] != ' ')
+			elements[j++] = elements[i];
+	length = j;
+	qsort(elements, length, sizeof(long), compare_elements);
+
+	memset(s->source, 0, PHRASE_LANES);
+	for (i = 0, distinct = 0; i < length; i++) {
+		if (distinct == 0 || elements[i] != values[distinct - 1]) {
+			if (distinct == PHRASE_LANES) {
+				errno = ERANGE;
+				return 0;
+			}
+			values[distinct++] = elements[i];
+		}
+		s->source[distinct - 1]++;
+	}
+	s->length = length;
+
+	/* words spelled with the source elements, each fitting in the source */
+	s->candidates = malloc(sizeof(struct phrase_candidate) * (p->count > 0 ? p->count : 1));
+	if (s->candidates == NULL) {
+		errno = ENOMEM;
+		return 0;
+	}
+
+	s->count = 0;
+	for (i = 0; i < p->count; i++) {
+		length = anagram_decode(p->words[i], elements, PHRASE_ELEMENT_LIMIT);
+		if (length <= 0 || length > s->length)
+			continue;
+		c = &s->candidates[s->count];
+		memset(c->counts, 0, PHRASE_LANES);
+		for (j = 0; j < length; j++) {
+			value = bsearch(&elements[j], values, distinct, sizeof(long), compare_elements);
+			if (value == NULL || ++c->counts[value - values] > s->source[value - values])
+				break;
+		}
+		if (j < length)
+			continue;
+		c->word = p->words[i];
+		c->length = length;
+		s->count++;
+	}
+
+	/* longest first, repeated words once */
+	qsort(s->candidates, s->count, sizeof(struct phrase_candidate), compare_candidates);
+	for (i = 0, j = 0; i < s->count; i++)
+		if (j == 0 || strcmp(s->candidates[i].word, s->candidates[j - 1].word) != 0)
+			s->candidates[j++] = s->candidates[i];
+	s->count = j;
+
+	return 1;
+
+}
+
+
+static int memo_failed(struct phrase_worker *w, const unsigned char *remaining,
+	int budget, int start)
+{
+
+	unsigned long i;
+	struct phrase_memo *m;
+
+	if (w->buckets == 0)
+		return 0;
+
+	for (i = memo_hash(remaining, budget) & (w->buckets - 1); (m = &w->memo[i])->start >= 0;
+		i = (i + 1) & (w->buckets - 1))
+		if (m->budget == budget && memcmp(m->remaining, remaining, PHRASE_LANES) == 0)
+			return m->start <= start;
+
+	return 0;
+
+}
+
+
+static void memo_insert(struct phrase_worker *w, const unsigned char *remaining,
+	int budget, int start)
+{
+
+	/*
+	 * A dead end from candidate "start" on is one from any later candidate
+	 * too, so each multiset keeps the lowest start. Once the table is at its
+	 * limit, new dead ends are simply not remembered.
+	 */
+
+	unsigned long i;
+	struct phrase_memo *m;
+
+	if (w->used * 2 >= w->buckets
+		&& (w->buckets >= PHRASE_MEMO_LIMIT || !memo_rehash(w, w->buckets > 0 ? w->buckets * 2 : 1024)))
+		return;
+
+	for (i = memo_hash(remaining, budget) & (w->buckets - 1); (m = &w->memo[i])->start >= 0;
+		i = (i + 1) & (w->buckets - 1)) {
+		if (m->budget == budget && memcmp(m->remaining, remaining, PHRASE_LANES) == 0) {
+			if (start < m->start)
+				m->start = start;
+			return;
+		}
+	}
+
+	memcpy(m->remaining, remaining, PHRASE_LANES);
+	m->budget = budget;
+	m->start = start;
+	w->used++;
+
+}
+
+
+static int memo_rehash(struct phrase_worker *w, int buckets)
+{
+
+	struct phrase_memo *memo, *m;
+	unsigned long j;
+	int i;
+
+	memo = malloc(sizeof(struct phrase_memo) * buckets);
+	if (memo == NULL)
+		return 0;
+
+	for (i = 0; i < buckets; i++)
+		memo[i].start = -1;
+
+	for (i = 0; i < w->buckets; i++) {
+		m = &w->memo[i];
+		if (m->start < 0)
+			continue;
+		for (j = memo_hash(m->remaining, m->budget) & (buckets - 1); memo[j].start >= 0; j = (j + 1) & (buckets - 1))
+			;
+		memo[j] = *m;
+	}
+
+	free(w->memo);
+	w->memo = memo;
+	w->buckets = buckets;
+
+	return 1;
+
+}
+
+
+static unsigned long memo_hash(const unsigned char *remaining, int budget)
+{
+
+	/* FNV-1a */
+
+	unsigned long h = 2166136261UL;
+	int i;
+
+	for (i = 0; i < PHRASE_LANES; i++)
+		h = (h ^ remaining[i]) * 16777619UL;
+
+	return (h ^ (unsigned long)budget) * 16777619UL;
+
+}
+
+
+static int vector_fits(const unsigned char *counts, const unsigned char *remaining)
+{
+
+	/* no lane of "counts" above that of "remaining": saturated differences
+	 * are all zero */
+
+#if defined(PHRASE_SSE2)
+	__m128i a, b;
+
+	a = _mm_subs_epu8(_mm_loadu_si128((const __m128i *)counts),
+		_mm_loadu_si128((const __m128i *)remaining));
+	b = _mm_subs_epu8(_mm_loadu_si128((const __m128i *)(counts + 16)),
+		_mm_loadu_si128((const __m128i *)(remaining + 16)));
+
+	return _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_or_si128(a, b), _mm_setzero_si128())) == 0xFFFF;
+#elif defined(PHRASE_NEON)
+	uint8x16_t a, b;
+
+	a = vqsubq_u8(vld1q_u8(counts), vld1q_u8(remaining));
+	b = vqsubq_u8(vld1q_u8(counts + 16), vld1q_u8(remaining + 16));
+
+	return vmaxvq_u8(vorrq_u8(a, b)) == 0;
+#else
+	int i;
+
+	for (i = 0; i < PHRASE_LANES; i++)
+		if (counts[i] > remaining[i])
+			return 0;
+
+	return 1;
+#endif
+
+}
+
+
+static void vector_subtract(unsigned char *result, const unsigned char *remaining,
+	const unsigned char *counts)
+{
+
+#if defined(PHRASE_SSE2)
+	_mm_storeu_si128((__m128i *)result, _mm_sub_epi8(_mm_loadu_si128((const __m128i *)remaining),
+		_mm_loadu_si128((const __m128i *)counts)));
+	_mm_storeu_si128((__m128i *)(result + 16), _mm_sub_epi8(_mm_loadu_si128((const __m128i *)(remaining + 16)),
+		_mm_loadu_si128((const __m128i *)(counts + 16))));
+#elif defined(PHRASE_NEON)
+	vst1q_u8(result, vsubq_u8(vld1q_u8(remaining), vld1q_u8(counts)));
+	vst1q_u8(result + 16, vsubq_u8(vld1q_u8(remaining + 16), vld1q_u8(counts + 16)));
+#else
+	int i;
+
+	for (i = 0; i < PHRASE_LANES; i++)
+		result[i] = remaining[i] - counts[i];
+#endif
+
+}
+
+
+static int compare_elements(const void *a, const void *b)
+{
+	long x = *(const long *)a, y = *(const long *)b;
+	return x < y ? -1 : x > y;
+}
+
+
+static int compare_candidates(const void *a, const void *b)
+{
+
+	const struct phrase_candidate *x = a, *y = b;
+
+	if (x->length != y->length)
+		return x->length > y->length ? -1 : 1;
+
+	return strcmp(x->word, y->word);
+
+}
@@ -0,0 +1,74 @@
+/*
+ * @file anagram_phrase.h
+ * @author Emanuel Fiuza de Oliveira
+ * @email efiuza87@gmail.com
+ */
+
+
+#ifndef _ANAGRAM_PHRASE_H
+#define _ANAGRAM_PHRASE_H
+
+
+#include "anagram.h"
+
+
+/*
+ * An anagram phrase dictionary finds the phrases of dictionary words that use
+ * exactly the elements of a source string ("dormitory" gives "dirty room"),
+ * spaces aside. Sources are not bound by "anagram_element_limit", and words
+ * may repeat within a phrase. Elements are compared as they are, so a
+ * dictionary in lower case wants sources in lower case.
+ */
+
+
+/* Reference to anagram phrase dictionary opaque type. */
+typedef struct anagram_phrase *anagram_phrase_ref;
+
+
+/*
+ * This function creates a phrase dictionary holding the words of the file on
+ * "path", one per line, or no words if "path" is a null pointer. On success,
+ * returns a reference to a phrase dictionary. On failure, returns a NULL
+ * pointer and sets errno to indicate the error.
+ */
+anagram_phrase_ref anagram_phrase_create(const char *path);
+
+
+/*
+ * This function adds "word" to the dictionary. On success, returns the number
+ * of words in the dictionary. On failure, returns -1 and sets errno to
+ * indicate the error.
+ */
+int anagram_phrase_add(anagram_phrase_ref phrase, const char *word);
+
+
+/*
+ * This function returns the number of words in the dictionary.
+ * On error, returns -1.
+ */
+int anagram_phrase_count(anagram_phrase_ref phrase);
+
+
+/*
+ * This function searches the phrases of at most "words" words (any number if
+ * "words" is 0) spelling "string", each found once whatever the order of its
+ * words, on "threads" threads (one per processor if "threads" is 0). The
+ * callback function is called for each phrase, one call at a time, with
+ * "argument", the number of phrases found so far and the phrase, its words
+ * separated by single spaces; returning 0 stops the search. Phrases come in
+ * no particular order unless a single thread is used. On success, returns the
+ * number of phrases delivered. On failure, returns -1 and sets errno to
+ * indicate the error (ERANGE if "string" has too many elements, or too many
+ * distinct ones).
+ */
+int anagram_phrase_solve(anagram_phrase_ref phrase, const char *string, int words,
+	int threads, void *argument, anagram_callback_f callback);
+
+
+/*
+ * Frees the supplied phrase dictionary. No value is returned.
+ */
+void anagram_phrase_release(anagram_phrase_ref phrase);
+
+
+#endif
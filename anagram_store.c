@@ -0,0 +1,513 @@
+/*
+ * @file anagram_store.c
+ * @author Emanuel Fiuza de Oliveira
+ * @email efiuza87@gmail.com
+ */
+
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "anagram_store.h"
+#include "anagram_table.h"
+
+
+/*
+ * Container layout (integers are 64-bit little-endian):
+ *
+ *   header  magic "ANAGSTOR", version, offset of the first index page
+ *   page    offset of the next page (0 if last), used slots, slots...
+ *   slot    null padded source string, offset and size of the anagram file
+ *
+ * Anagram files and index pages are only ever appended; a slot becomes
+ * visible when the "used" counter of its page is written, after the anagram
+ * file itself is on disk.
+ */
+
+#define STORE_MAGIC "ANAGSTOR"
+#define STORE_VERSION 1
+#define STORE_HEADER_SIZE 32
+#define STORE_SOURCE_SIZE 48
+#define STORE_SLOT_SIZE (STORE_SOURCE_SIZE + 16)
+#define STORE_PAGE_SLOTS 128
+#define STORE_PAGE_SIZE (16 + STORE_PAGE_SLOTS * STORE_SLOT_SIZE)
+
+
+/*
+ * Basic Types
+ */
+
+
+struct store_map {
+	char   *address;
+	size_t length;
+	int    references;
+};
+
+
+struct store_entry {
+	char source[STORE_SOURCE_SIZE];
+	long offset;
+	long size;
+};
+
+
+struct anagram_store {
+	int                  fd;
+	struct store_map     *map;
+	struct store_entry   *entries;
+	int                  count;
+	int                  capacity;
+	struct anagram_table table;
+	long                 page;     /* offset of the last index page */
+	int                  used;     /* slots used in the last index page */
+	long                 end;      /* container size */
+};
+
+
+/*
+ * Static Function Interface
+ */
+
+
+static struct store_map *map_create(int fd, long length);
+static void map_release(void *context);
+static int index_insert(struct anagram_store *s, const char *source, long offset, long size);
+static void index_drop(struct anagram_store *s);
+static const char *index_key(const void *context, int entry);
+static int page_write(int fd, long offset);
+static int pwrite_all(int fd, const void *buffer, size_t size, long offset);
+static void put64(unsigned char *buffer, long value);
+static long get64(const unsigned char *buffer);
+
+
+/*
+ * Interface Implementation
+ */
+
+
+anagram_store_ref anagram_store_open(const char *path, int create)
+{
+
+	struct anagram_store *s;
+	struct stat st;
+	unsigned char header[STORE_HEADER_SIZE];
+	const unsigned char *page, *slot;
+	long offset, next;
+	int used, i, errn;
+
+	s = malloc(sizeof(struct anagram_store));
+	if (s == NULL)
+		return NULL;
+
+	memset(s, 0, sizeof(struct anagram_store));
+	s->map = NULL;
+	s->entries = NULL;
+
+	s->fd = open(path, create ? O_RDWR | O_CREAT : O_RDWR, 0666);
+	if (s->fd < 0) {
+		errn = errno;
+		goto failure;
+	}
+
+	if (fstat(s->fd, &st) != 0) {
+		errn = errno;
+		goto failure;
+	}
+
+	/* initialize empty container with its first index page */
+	if (st.st_size == 0 && create) {
+		memset(header, 0, STORE_HEADER_SIZE);
+		memcpy(header, STORE_MAGIC, 8);
+		put64(header + 8, STORE_VERSION);
+		put64(header + 16, STORE_HEADER_SIZE);
+		if (!pwrite_all(s->fd, header, STORE_HEADER_SIZE, 0)
+			|| !page_write(s->fd, STORE_HEADER_SIZE) || fsync(s->fd) != 0) {
+			errn = errno;
+			goto failure;
+		}
+		st.st_size = STORE_HEADER_SIZE + STORE_PAGE_SIZE;
+	}
+
+	if (st.st_size < STORE_HEADER_SIZE + STORE_PAGE_SIZE) {
+		errn = EBADF;
+		goto failure;
+	}
+
+	s->end = (long)st.st_size;
+	s->map = map_create(s->fd, s->end);
+	if (s->map == NULL) {
+		errn = errno;
+		goto failure;
+	}
+
+	/* check header */
+	if (memcmp(s->map->address, STORE_MAGIC, 8) != 0
+		|| get64((unsigned char *)s->map->address + 8) != STORE_VERSION) {
+		errn = EBADF;
+		goto failure;
+	}
+
+	if (!anagram_table_init(&s->table, 64, index_key, s)) {
+		errn = ENOMEM;
+		goto failure;
+	}
+
+	/* walk index pages */
+	next = get64((unsigned char *)s->map->address + 16);
+	do {
+		offset = next;
+		if (offset < STORE_HEADER_SIZE || offset > s->end - STORE_PAGE_SIZE) {
+			errn = EBADF;
+			goto failure;
+		}
+		page = (unsigned char *)s->map->address + offset;
+		next = get64(page);
+		used = (int)get64(page + 8);
+		/* pages are appended, so each one links forward, within the file */
+		if ((next != 0 && (next < offset + STORE_PAGE_SIZE || next > s->end - STORE_PAGE_SIZE))
+			|| used < 0 || used > STORE_PAGE_SLOTS) {
+			errn = EBADF;
+			goto failure;
+		}
+		for (i = 0; i < used; i++) {
+			slot = page + 16 + i * STORE_SLOT_SIZE;
+			if (slot[STORE_SOURCE_SIZE - 1] != '\0'
+				|| get64(slot + STORE_SOURCE_SIZE) < STORE_HEADER_SIZE
+				|| get64(slot + STORE_SOURCE_SIZE + 8) < 0
+				|| get64(slot + STORE_SOURCE_SIZE) > s->end - get64(slot + STORE_SOURCE_SIZE + 8)) {
+				errn = EBADF;
+				goto failure;
+			}
+			if (!index_insert(s, (const char *)slot, get64(slot + STORE_SOURCE_SIZE),
+				get64(slot + STORE_SOURCE_SIZE + 8))) {
+				errn = ENOMEM;
+				goto failure;
+			}
+		}
+	} while (next != 0);
+
+	s->page = offset;
+	s->used = used;
+
+	return s;
+
+	failure:
+		anagram_store_close(s);
+		errno = errn;
+		return NULL;
+
+}
+
+
+int anagram_store_count(anagram_store_ref s)
+{
+	if (s != NULL)
+		return s->count;
+	return -1;
+}
+
+
+const char *anagram_store_source(anagram_store_ref s, int index)
+{
+	if (s == NULL || index < 0 || index >= s->count)
+		return NULL;
+	return s->entries[index].source;
+}
+
+
+anagram_ref anagram_lookup(anagram_store_ref s, const char *string)
+{
+
+	struct store_entry *e;
+	anagram_ref a;
+	int i, errn;
+
+	if (s == NULL || string == NULL) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	i = anagram_table_find(&s->table, string);
+	if (i < 0) {
+		errno = ENOENT;
+		return NULL;
+	}
+
+	/* the anagram object holds a reference to the current mapping */
+	e = &s->entries[i];
+	s->map->references++;
+	a = anagram_open_buffer(s->map->address + e->offset, e->size, map_release, s->map);
+	if (a == NULL) {
+		errn = errno;
+		map_release(s->map);
+		errno = errn;
+	}
+
+	return a;
+
+}
+
+
+int anagram_store_append(anagram_store_ref s, anagram_ref a)
+{
+
+	struct store_map *map;
+	unsigned char slot[STORE_SLOT_SIZE], count[8];
+	const char *source;
+	long offset, size, end;
+	int errn;
+
+	map = NULL;
+
+	if (s == NULL || a == NULL || (source = anagram_source_string(a)) == NULL
+		|| strlen(source) >= STORE_SOURCE_SIZE) {
+		errno = EINVAL;
+		return 0;
+	}
+
+	if (anagram_table_find(&s->table, source) >= 0) {
+		errno = EEXIST;
+		return 0;
+	}
+
+	/* copy anagram file to the end of the container */
+	offset = s->end;
+	if (lseek(s->fd, (off_t)offset, SEEK_SET) < 0
+		|| anagram_export(a, s->fd, ANAGRAM_EXPORT_IMAGE) < 0) {
+		errn = errno;
+		goto failure;
+	}
+	end = (long)lseek(s->fd, 0, SEEK_CUR);
+	if (end < 0) {
+		errn = errno;
+		goto failure;
+	}
+	size = end - offset;
+
+	/* chain a new index page when the last one is full; once linked, the
+	 * page stays part of the container even if this append fails, so later
+	 * images go past it */
+	if (s->used == STORE_PAGE_SLOTS) {
+		put64(count, end);
+		if (!page_write(s->fd, end) || fsync(s->fd) != 0
+			|| !pwrite_all(s->fd, count, 8, s->page)) {
+			errn = errno;
+			goto failure;
+		}
+		s->page = end;
+		s->used = 0;
+		end += STORE_PAGE_SIZE;
+		s->end = end;
+	}
+
+	/* map the grown container and index the entry before publishing it, so
+	 * the index never lacks a published entry; objects handed out earlier
+	 * keep the old map */
+	map = map_create(s->fd, end);
+	if (map == NULL) {
+		errn = errno;
+		goto failure;
+	}
+	if (!index_insert(s, source, offset, size)) {
+		errn = ENOMEM;
+		goto failure;
+	}
+
+	/* write slot, then publish it by bumping the page counter */
+	memset(slot, 0, STORE_SLOT_SIZE);
+	strcpy((char *)slot, source);
+	put64(slot + STORE_SOURCE_SIZE, offset);
+	put64(slot + STORE_SOURCE_SIZE + 8, size);
+	put64(count, (long)s->used + 1);
+	if (!pwrite_all(s->fd, slot, STORE_SLOT_SIZE, s->page + 16 + (long)s->used * STORE_SLOT_SIZE)
+		|| fsync(s->fd) != 0 || !pwrite_all(s->fd, count, 8, s->page + 8)
+		|| fsync(s->fd) != 0) {
+		errn = errno;
+		index_drop(s);
+		goto failure;
+	}
+	s->used++;
+	s->end = end;
+
+	map_release(s->map);
+	s->map = map;
+
+	return 1;
+
+	failure:
+		if (map != NULL)
+			map_release(map);
+		errno = errn;
+		return 0;
+
+}
+
+
+void anagram_store_close(anagram_store_ref s)
+{
+	if (s == NULL)
+		return;
+	if (s->map != NULL)
+		map_release(s->map);
+	if (s->fd >= 0)
+		close(s->fd);
+	free(s->entries);
+	anagram_table_free(&s->table);
+	free(s);
+}
+
+
+/*
+ * Static Function Implementation
+ */
+
+
+static struct store_map *map_create(int fd, long length)
+{
+
+	struct store_map *map;
+	void *address;
+
+	map = malloc(sizeof(struct store_map));
+	if (map == NULL)
+		return NULL;
+
+	address = mmap(NULL, (size_t)length, PROT_READ, MAP_SHARED, fd, 0);
+	if (address == MAP_FAILED) {
+		free(map);
+		return NULL;
+	}
+
+	map->address = address;
+	map->length = (size_t)length;
+	map->references = 1;
+
+	return map;
+
+}
+
+
+static void map_release(void *context)
+{
+
+	struct store_map *map = context;
+
+	map->references--;
+	if (map->references == 0) {
+		munmap(map->address, map->length);
+		free(map);
+	}
+
+}
+
+
+static int index_insert(struct anagram_store *s, const char *source, long offset, long size)
+{
+
+	struct store_entry *entries;
+
+	if (s->count == s->capacity) {
+		entries = realloc(s->entries, sizeof(struct store_entry) * (s->capacity + 64));
+		if (entries == NULL)
+			return 0;
+		s->entries = entries;
+		s->capacity += 64;
+	}
+
+	strcpy(s->entries[s->count].source, source);
+	s->entries[s->count].offset = offset;
+	s->entries[s->count].size = size;
+
+	if (!anagram_table_insert(&s->table))
+		return 0;
+	s->count++;
+
+	return 1;
+
+}
+
+
+static void index_drop(struct anagram_store *s)
+{
+	/* removes the entry inserted last */
+	anagram_table_drop(&s->table);
+	s->count--;
+}
+
+
+static const char *index_key(const void *context, int entry)
+{
+	return ((const struct anagram_store *)context)->entries[entry].source;
+}
+
+
+static int page_write(int fd, long offset)
+{
+
+	unsigned char *page;
+	int result;
+
+	page = calloc(1, STORE_PAGE_SIZE);
+	if (page == NULL)
+		return 0;
+
+	result = pwrite_all(fd, page, STORE_PAGE_SIZE, offset);
+	free(page);
+
+	return result;
+
+}
+
+
+static int pwrite_all(int fd, const void *buffer, size_t size, long offset)
+{
+
+	const char *b = buffer;
+	ssize_t written;
+
+	while (size > 0) {
+		written = pwrite(fd, b, size, (off_t)offset);
+		if (written < 0) {
+			if (errno == EINTR)
+				continue;
+			return 0;
+		}
+		b += written;
+		size -= (size_t)written;
+		offset += (long)written;
+	}
+
+	return 1;
+
+}
+
+
+static void put64(unsigned char *buffer, long value)
+{
+
+	unsigned long v = (unsigned long)value;
+	int i;
+
+	for (i = 0; i < 8; i++, v >>= 8)
+		buffer[i] = (unsigned char)(v & 0xFF);
+
+}
+
+
+static long get64(const unsigned char *buffer)
+{
+
+	unsigned long v = 0;
+	int i;
+
+	for (i = 7; i >= 0; i--)
+		v = (v << 8) | buffer[i];
+
+	return (long)v;
+
+}
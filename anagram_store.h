@@ -0,0 +1,76 @@
+/*
+ * @file anagram_store.h
+ * @author Emanuel Fiuza de Oliveira
+ * @email efiuza87@gmail.com
+ */
+
+
+#ifndef _ANAGRAM_STORE_H
+#define _ANAGRAM_STORE_H
+
+
+#include "anagram.h"
+
+
+/*
+ * An anagram store is a single container file holding many anagram files, one
+ * per source string, reachable through an index of source strings. The
+ * container is mapped once; sets are appended without rewriting it.
+ */
+
+
+/* Reference to anagram store opaque type. */
+typedef struct anagram_store *anagram_store_ref;
+
+
+/*
+ * This function opens the anagram store on "path", mapping it in memory.
+ * If "create" is non-zero a missing or empty file is initialized as an empty
+ * store. On success, returns a reference to an anagram store. On failure,
+ * returns a NULL pointer and sets errno to indicate the error.
+ */
+anagram_store_ref anagram_store_open(const char *path, int create);
+
+
+/*
+ * This function returns the number of anagram sets in the store.
+ * On error, returns -1.
+ */
+int anagram_store_count(anagram_store_ref store);
+
+
+/*
+ * This function returns the source string of the anagram set at position
+ * "index" (in append order). On failure, returns a NULL pointer.
+ */
+const char *anagram_store_source(anagram_store_ref store, int index);
+
+
+/*
+ * This function looks up the anagram set whose source string is "string" and
+ * returns a read-only anagram object over the mapped set, which must be freed
+ * with "anagram_release". The object stays valid after the store is closed.
+ * On failure, returns a NULL pointer and sets errno to indicate the error
+ * (ENOENT if the store has no such set).
+ */
+anagram_ref anagram_lookup(anagram_store_ref store, const char *string);
+
+
+/*
+ * This function appends a copy of "anagram" (see "anagram_generate") to the
+ * store at the end of the container file. On success, returns 1. On failure,
+ * returns 0 and sets errno to indicate the error (EEXIST if the store already
+ * holds a set with the same source string).
+ */
+int anagram_store_append(anagram_store_ref store, anagram_ref anagram);
+
+
+/*
+ * Closes the store and unmaps the container file. Anagram objects obtained
+ * through "anagram_lookup" keep their part of the mapping alive until they
+ * are released. No value is returned.
+ */
+void anagram_store_close(anagram_store_ref store);
+
+
+#endif
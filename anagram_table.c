@@ -0,0 +1,144 @@
+/*
+ * @file anagram_table.c
+ * @author Emanuel Fiuza de Oliveira
+ * @email efiuza87@gmail.com
+ */
+
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include "anagram_table.h"
+
+
+/*
+ * Static Function Interface
+ */
+
+
+static int table_rehash(struct anagram_table *t, int buckets);
+
+
+/*
+ * Interface Implementation
+ */
+
+
+unsigned long anagram_hash(const char *string)
+{
+
+	/* FNV-1a */
+
+	unsigned long h = 2166136261UL;
+
+	while (*string != '\0')
+		h = (h ^ (unsigned char)*string++) * 16777619UL;
+
+	return h;
+
+}
+
+
+int anagram_table_init(struct anagram_table *t, int buckets,
+	anagram_table_key_f key, const void *context)
+{
+	t->slots = NULL;
+	t->buckets = 0;
+	t->count = 0;
+	t->key = key;
+	t->context = context;
+	return table_rehash(t, buckets);
+}
+
+
+int anagram_table_insert(struct anagram_table *t)
+{
+
+	unsigned long i;
+
+	if (t->count * 2 >= t->buckets && !table_rehash(t, t->buckets * 2))
+		return 0;
+
+	for (i = anagram_hash(t->key(t->context, t->count)) % t->buckets; t->slots[i] >= 0; i = (i + 1) % t->buckets)
+		;
+	t->slots[i] = t->count++;
+
+	return 1;
+
+}
+
+
+int anagram_table_find(const struct anagram_table *t, const char *key)
+{
+
+	unsigned long i;
+	int e;
+
+	for (i = anagram_hash(key) % t->buckets; (e = t->slots[i]) >= 0; i = (i + 1) % t->buckets)
+		if (strcmp(t->key(t->context, e), key) == 0)
+			return e;
+
+	return -1;
+
+}
+
+
+void anagram_table_drop(struct anagram_table *t)
+{
+
+	/* no entry was placed probing past the bucket of the last one, so
+	 * clearing it breaks no chain */
+
+	unsigned long i;
+
+	t->count--;
+	for (i = anagram_hash(t->key(t->context, t->count)) % t->buckets; t->slots[i] != t->count; i = (i + 1) % t->buckets)
+		;
+	t->slots[i] = -1;
+
+}
+
+
+void anagram_table_free(struct anagram_table *t)
+{
+	free(t->slots);
+	t->slots = NULL;
+	t->buckets = 0;
+	t->count = 0;
+}
+
+
+/*
+ * Static Function Implementation
+ */
+
+
+static int table_rehash(struct anagram_table *t, int buckets)
+{
+
+	unsigned long j;
+	int *slots, i;
+
+	slots = malloc(sizeof(int) * buckets);
+	if (slots == NULL) {
+		errno = ENOMEM;
+		return 0;
+	}
+
+	for (i = 0; i < buckets; i++)
+		slots[i] = -1;
+
+	for (i = 0; i < t->count; i++) {
+		for (j = anagram_hash(t->key(t->context, i)) % buckets; slots[j] >= 0; j = (j + 1) % buckets)
+			;
+		slots[j] = i;
+	}
+
+	free(t->slots);
+	t->slots = slots;
+	t->buckets = buckets;
+
+	return 1;
+
+}
+
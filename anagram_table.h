@@ -0,0 +1,76 @@
+/*
+ * @file anagram_table.h
+ * @author Emanuel Fiuza de Oliveira
+ * @email efiuza87@gmail.com
+ */
+
+
+#ifndef _ANAGRAM_TABLE_H
+#define _ANAGRAM_TABLE_H
+
+
+/*
+ * Internal string-keyed hash table shared by the anagram cache and store.
+ * Entries live in an array owned by the caller and are numbered in insertion
+ * order; the table only holds their numbers, in open addressing buckets kept
+ * at most half full, and reads their keys back through a callback.
+ */
+
+
+/* Key callback: returns the key of entry "entry" of "context". */
+typedef const char *(*anagram_table_key_f)(const void *context, int entry);
+
+
+struct anagram_table {
+	int                 *slots;   /* entry numbers, -1 marks a free bucket */
+	int                 buckets;
+	int                 count;
+	anagram_table_key_f key;
+	const void          *context;
+};
+
+
+/*
+ * This function returns the FNV-1a hash of "string".
+ */
+unsigned long anagram_hash(const char *string);
+
+
+/*
+ * This function initializes an empty table of "buckets" buckets (a power of
+ * two) whose keys are read through "key" from "context". On success,
+ * returns 1. On failure, returns 0 and sets errno to indicate the error.
+ */
+int anagram_table_init(struct anagram_table *table, int buckets,
+	anagram_table_key_f key, const void *context);
+
+
+/*
+ * This function adds the next entry (numbered after the last one added),
+ * whose key must already be readable, doubling the buckets when half full.
+ * On success, returns 1. On failure, returns 0 and sets errno to indicate
+ * the error.
+ */
+int anagram_table_insert(struct anagram_table *table);
+
+
+/*
+ * This function returns the number of the entry holding "key", or -1 if
+ * there is none.
+ */
+int anagram_table_find(const struct anagram_table *table, const char *key);
+
+
+/*
+ * This function removes the entry added last. No value is returned.
+ */
+void anagram_table_drop(struct anagram_table *table);
+
+
+/*
+ * Releases the buckets of the table. No value is returned.
+ */
+void anagram_table_free(struct anagram_table *table);
+
+
+#endif
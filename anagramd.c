@@ -0,0 +1,583 @@
+/*
+ * @file anagramd.c
+ * @author Emanuel Fiuza de Oliveira
+ * @email efiuza87@gmail.com
+ *
+ * Anagram query server. Listens on a Unix domain socket and answers
+ * newline-terminated requests, in order, keeping an LRU cache of open anagram
+ * objects so that files are opened once and hot sets stay in memory:
+ *
+ *   PING                  -> OK
+ *   COUNT path            -> OK permutations complete
+ *   STRING path index     -> OK string
+ *   FILTER path term      -> OK count first
+ *   RANK path string      -> OK rank
+ *   QUIT                  -> OK (connection closed)
+ *
+ * Paths name anagram files relative to the served directory (the current one
+ * unless given), and requests for files outside of it fail with EACCES.
+ * FILTER on a list in minimal-change order fails with EINVAL.
+ * Failures are reported as "ERR errno message". Clients may pipeline any
+ * number of requests; all of them are served by a single poll() loop.
+ */
+
+
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "anagram.h"
+#include "anagram_table.h"
+
+
+#define SERVER_CLIENT_LIMIT 1024
+#define SERVER_LINE_LIMIT 4096
+#define SERVER_OUTPUT_LIMIT (1024 * 1024)
+#define SERVER_CACHE_DEFAULT 64
+
+
+/*
+ * Basic Types
+ */
+
+
+struct handle {
+	char          *path;
+	anagram_ref   anagram;
+	struct handle *prev;    /* LRU list, most recent first */
+	struct handle *next;
+	struct handle *chain;   /* hash bucket */
+};
+
+
+struct cache {
+	struct handle *head;
+	struct handle *tail;
+	struct handle **table;
+	int           buckets;
+	int           count;
+	int           capacity;
+};
+
+
+struct client {
+	int    fd;
+	char   input[SERVER_LINE_LIMIT];
+	int    length;
+	char   *output;
+	size_t size;
+	size_t offset;
+	size_t capacity;
+	int    closing;
+};
+
+
+/*
+ * Static Data
+ */
+
+
+static volatile sig_atomic_t running = 1;
+static char *root = NULL; /* resolved directory files are served from */
+
+
+/*
+ * Static Function Interface
+ */
+
+
+static int cache_init(struct cache *c, int capacity);
+static anagram_ref cache_get(struct cache *c, const char *path);
+static void cache_unlink(struct cache *c, struct handle *h);
+static void cache_free(struct cache *c);
+static void serve(struct cache *c, struct client *cl, char *line);
+static int resolve(const char *path, char *resolved);
+static void reply(struct client *cl, const char *format, ...);
+static void reply_error(struct client *cl, int errn);
+static int client_read(struct cache *c, struct client *cl);
+static int client_write(struct client *cl);
+static void client_close(struct client *cl);
+static void stop(int number);
+
+
+int main(int argc, char *argv[])
+{
+
+	struct sockaddr_un address;
+	struct pollfd *fds;
+	struct client *clients;
+	struct cache cache;
+	int listener, capacity, count, fd, i, j;
+
+	if (argc < 2) {
+		printf("Usage: %s SOCKET_PATH [CACHE_SIZE [DIRECTORY]]\n\n", argv[0]);
+		exit(EXIT_SUCCESS);
+	}
+
+	capacity = argc > 2 ? atoi(argv[2]) : SERVER_CACHE_DEFAULT;
+	if (capacity < 1 || strlen(argv[1]) >= sizeof(address.sun_path)) {
+		printf("Invalid arguments\n");
+		exit(EXIT_FAILURE);
+	}
+
+	root = realpath(argc > 3 ? argv[3] : ".", NULL);
+	if (root == NULL) {
+		printf("Error resolving directory #%04d\n", errno);
+		exit(EXIT_FAILURE);
+	}
+
+	signal(SIGPIPE, SIG_IGN);
+	signal(SIGINT, stop);
+	signal(SIGTERM, stop);
+
+	/* allocate client table; slot 0 of "fds" is the listening socket */
+	fds = calloc(SERVER_CLIENT_LIMIT + 1, sizeof(struct pollfd));
+	clients = calloc(SERVER_CLIENT_LIMIT, sizeof(struct client));
+	if (fds == NULL || clients == NULL || !cache_init(&cache, capacity)) {
+		printf("Error allocating memory #%04d\n", errno);
+		exit(EXIT_FAILURE);
+	}
+
+	/* create listening socket */
+	listener = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (listener < 0) {
+		printf("Error creating socket #%04d\n", errno);
+		exit(EXIT_FAILURE);
+	}
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	strcpy(address.sun_path, argv[1]);
+	unlink(argv[1]);
+	if (bind(listener, (struct sockaddr *)&address, sizeof(address)) != 0
+		|| listen(listener, 128) != 0) {
+		printf("Error binding socket #%04d\n", errno);
+		exit(EXIT_FAILURE);
+	}
+	fcntl(listener, F_SETFL, O_NONBLOCK);
+
+	count = 0;
+	while (running) {
+
+		/* build poll set; stop reading from clients with a full backlog */
+		fds[0].fd = listener;
+		fds[0].events = count < SERVER_CLIENT_LIMIT ? POLLIN : 0;
+		for (i = 0; i < count; i++) {
+			fds[i + 1].fd = clients[i].fd;
+			fds[i + 1].events = 0;
+			if (!clients[i].closing && clients[i].size < SERVER_OUTPUT_LIMIT)
+				fds[i + 1].events |= POLLIN;
+			if (clients[i].size > clients[i].offset)
+				fds[i + 1].events |= POLLOUT;
+			fds[i + 1].revents = 0;
+		}
+
+		if (poll(fds, count + 1, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			printf("Error polling sockets #%04d\n", errno);
+			break;
+		}
+
+		/* serve clients */
+		for (i = 0; i < count; i++) {
+			if (fds[i + 1].revents & (POLLERR | POLLNVAL))
+				clients[i].closing = 2;
+			if ((fds[i + 1].revents & (POLLIN | POLLHUP)) && !clients[i].closing
+				&& !client_read(&cache, &clients[i]))
+				clients[i].closing = 2;
+			if (clients[i].closing < 2 && clients[i].size > clients[i].offset
+				&& !client_write(&clients[i]))
+				clients[i].closing = 2;
+		}
+
+		/* drop finished clients, compacting the table */
+		for (i = 0, j = 0; i < count; i++) {
+			if (clients[i].closing == 2
+				|| (clients[i].closing && clients[i].size == clients[i].offset))
+				client_close(&clients[i]);
+			else
+				clients[j++] = clients[i];
+		}
+		count = j;
+
+		/* accept new clients */
+		if (fds[0].revents & POLLIN) {
+			while (count < SERVER_CLIENT_LIMIT && (fd = accept(listener, NULL, NULL)) >= 0) {
+				fcntl(fd, F_SETFL, O_NONBLOCK);
+				memset(&clients[count], 0, sizeof(struct client));
+				clients[count].fd = fd;
+				clients[count].output = NULL;
+				count++;
+			}
+		}
+
+	}
+
+	for (i = 0; i < count; i++)
+		client_close(&clients[i]);
+	close(listener);
+	unlink(argv[1]);
+	cache_free(&cache);
+	free(clients);
+	free(fds);
+	free(root);
+
+	exit(EXIT_SUCCESS);
+
+}
+
+
+/*
+ * Static Function Implementation
+ */
+
+
+static int cache_init(struct cache *c, int capacity)
+{
+	c->head = NULL;
+	c->tail = NULL;
+	c->count = 0;
+	c->capacity = capacity;
+	c->buckets = capacity * 2 + 1;
+	c->table = calloc(c->buckets, sizeof(struct handle *));
+	return c->table != NULL;
+}
+
+
+static anagram_ref cache_get(struct cache *c, const char *path)
+{
+
+	struct handle *h, **bucket;
+
+	bucket = &c->table[anagram_hash(path) % c->buckets];
+	for (h = *bucket; h != NULL; h = h->chain)
+		if (strcmp(h->path, path) == 0)
+			break;
+
+	if (h != NULL) {
+		/* move to front */
+		if (h != c->head) {
+			cache_unlink(c, h);
+			h->prev = NULL;
+			h->next = c->head;
+			c->head->prev = h;
+			c->head = h;
+		}
+		return h->anagram;
+	}
+
+	/* miss: open and evict the least recently used handle if needed */
+	h = malloc(sizeof(struct handle));
+	if (h == NULL)
+		return NULL;
+	h->path = malloc(strlen(path) + 1);
+	if (h->path == NULL) {
+		free(h);
+		return NULL;
+	}
+	h->anagram = anagram_open(path);
+	if (h->anagram == NULL) {
+		free(h->path);
+		free(h);
+		return NULL;
+	}
+	strcpy(h->path, path);
+
+	if (c->count == c->capacity) {
+		struct handle *victim = c->tail, **link;
+		cache_unlink(c, victim);
+		for (link = &c->table[anagram_hash(victim->path) % c->buckets]; *link != victim; link = &(*link)->chain)
+			;
+		*link = victim->chain;
+		anagram_release(victim->anagram);
+		free(victim->path);
+		free(victim);
+		c->count--;
+	}
+
+	h->chain = *bucket;
+	*bucket = h;
+	h->prev = NULL;
+	h->next = c->head;
+	if (c->head != NULL)
+		c->head->prev = h;
+	else
+		c->tail = h;
+	c->head = h;
+	c->count++;
+
+	return h->anagram;
+
+}
+
+
+static void cache_unlink(struct cache *c, struct handle *h)
+{
+	if (h->prev != NULL)
+		h->prev->next = h->next;
+	else
+		c->head = h->next;
+	if (h->next != NULL)
+		h->next->prev = h->prev;
+	else
+		c->tail = h->prev;
+}
+
+
+static void cache_free(struct cache *c)
+{
+
+	struct handle *h, *next;
+
+	for (h = c->head; h != NULL; h = next) {
+		next = h->next;
+		anagram_release(h->anagram);
+		free(h->path);
+		free(h);
+	}
+
+	free(c->table);
+
+}
+
+
+static void serve(struct cache *c, struct client *cl, char *line)
+{
+
+	anagram_ref a;
+	const char *command, *path, *argument, *string;
+	char *end, file[PATH_MAX];
+	long index;
+	int count, first;
+
+	command = strtok(line, " \t\r");
+	path = strtok(NULL, " \t\r");
+	argument = strtok(NULL, " \t\r");
+
+	if (command == NULL) {
+		reply_error(cl, EINVAL);
+		return;
+	}
+
+	if (strcmp(command, "PING") == 0) {
+		reply(cl, "OK\n");
+		return;
+	}
+
+	if (strcmp(command, "QUIT") == 0) {
+		reply(cl, "OK\n");
+		cl->closing = 1;
+		return;
+	}
+
+	/* unknown commands are rejected before the path touches the file system */
+	if (strcmp(command, "COUNT") != 0 && strcmp(command, "STRING") != 0
+		&& strcmp(command, "FILTER") != 0 && strcmp(command, "RANK") != 0) {
+		reply_error(cl, EINVAL);
+		return;
+	}
+
+	if (path == NULL || (argument == NULL && strcmp(command, "COUNT") != 0)) {
+		reply_error(cl, EINVAL);
+		return;
+	}
+
+	if (!resolve(path, file)) {
+		reply_error(cl, errno);
+		return;
+	}
+
+	a = cache_get(c, file);
+	if (a == NULL) {
+		reply_error(cl, errno);
+		return;
+	}
+
+	/* cached lists may still be growing in another process; files written
+	 * without a header are served as they were opened */
+	if (anagram_refresh(a) < 0 && errno != ENOTSUP) {
+		reply_error(cl, errno);
+		return;
+	}
+
+	/* requests are stateless: every one starts from the full result set */
+	anagram_filter(a, NULL);
+
+	if (strcmp(command, "COUNT") == 0) {
+		reply(cl, "OK %d %d\n", anagram_permutation_count(a), anagram_is_complete(a));
+	}
+	else if (strcmp(command, "STRING") == 0) {
+		index = strtol(argument, &end, 10);
+		if (*end != '\0' || index < 0 || index >= anagram_permutation_count(a)) {
+			reply_error(cl, ERANGE);
+			return;
+		}
+		string = anagram_string(a, (int)index);
+		if (string == NULL)
+			reply_error(cl, errno);
+		else
+			reply(cl, "OK %s\n", string);
+	}
+	else if (strcmp(command, "FILTER") == 0) {
+		count = anagram_filter(a, argument);
+		if (count < 0) {
+			reply_error(cl, errno);
+			return;
+		}
+		first = count > 0 ? anagram_rank(a, anagram_string(a, 0)) : -1;
+		anagram_filter(a, NULL);
+		reply(cl, "OK %d %d\n", count, first);
+	}
+	else {
+		first = anagram_rank(a, argument);
+		if (first < 0)
+			reply_error(cl, errno);
+		else
+			reply(cl, "OK %d\n", first);
+	}
+
+}
+
+
+static int resolve(const char *path, char *resolved)
+{
+
+	/* paths are relative to the served directory and may not leave it, not
+	 * even through ".." or symbolic links */
+
+	char joined[PATH_MAX];
+	size_t length;
+
+	length = strlen(root);
+	if (path[0] == '/' || length + strlen(path) + 2 > PATH_MAX) {
+		errno = EACCES;
+		return 0;
+	}
+
+	sprintf(joined, "%s/%s", root, path);
+	if (realpath(joined, resolved) == NULL)
+		return 0;
+
+	if (strncmp(resolved, root, length) != 0 || (length > 1 && resolved[length] != '/')) {
+		errno = EACCES;
+		return 0;
+	}
+
+	return 1;
+
+}
+
+
+static void reply(struct client *cl, const char *format, ...)
+{
+
+	va_list arguments;
+	char *output;
+	size_t capacity;
+	int length;
+
+	/* make room for the longest reply (a string plus two integers) */
+	if (cl->capacity - cl->size < 256) {
+		capacity = cl->capacity > 0 ? cl->capacity * 2 : 4096;
+		output = realloc(cl->output, capacity);
+		if (output == NULL) {
+			cl->closing = 2;
+			return;
+		}
+		cl->output = output;
+		cl->capacity = capacity;
+	}
+
+	va_start(arguments, format);
+	length = vsnprintf(cl->output + cl->size, cl->capacity - cl->size, format, arguments);
+	va_end(arguments);
+
+	if (length > 0)
+		cl->size += (size_t)length;
+
+}
+
+
+static void reply_error(struct client *cl, int errn)
+{
+	reply(cl, "ERR %d %s\n", errn, strerror(errn));
+}
+
+
+static int client_read(struct cache *c, struct client *cl)
+{
+
+	ssize_t size;
+	char *line, *newline;
+	int rest;
+
+	size = read(cl->fd, cl->input + cl->length, SERVER_LINE_LIMIT - cl->length);
+	if (size < 0)
+		return errno == EAGAIN || errno == EINTR;
+	if (size == 0) {
+		cl->closing = 1;
+		return 1;
+	}
+	cl->length += (int)size;
+
+	/* serve every complete request in order */
+	line = cl->input;
+	while (!cl->closing && (newline = memchr(line, '\n', cl->input + cl->length - line)) != NULL) {
+		*newline = '\0';
+		serve(c, cl, line);
+		line = newline + 1;
+	}
+
+	rest = (int)(cl->input + cl->length - line);
+	if (rest == SERVER_LINE_LIMIT) {
+		reply_error(cl, E2BIG);
+		cl->closing = 1;
+		rest = 0;
+	}
+	memmove(cl->input, line, rest);
+	cl->length = rest;
+
+	return 1;
+
+}
+
+
+static int client_write(struct client *cl)
+{
+
+	ssize_t size;
+
+	size = write(cl->fd, cl->output + cl->offset, cl->size - cl->offset);
+	if (size < 0)
+		return errno == EAGAIN || errno == EINTR;
+
+	cl->offset += (size_t)size;
+	if (cl->offset == cl->size)
+		cl->offset = cl->size = 0;
+
+	return 1;
+
+}
+
+
+static void client_close(struct client *cl)
+{
+	close(cl->fd);
+	free(cl->output);
+	cl->output = NULL;
+}
+
+
+static void stop(int number)
+{
+	(void)number;
+	running = 0;
+}
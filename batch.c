@@ -0,0 +1,429 @@
+/*
+ * @file batch.c
+ * @author Emanuel Fiuza de Oliveira
+ * @email efiuza87@gmail.com
+ *
+ * Batch driver. Reads one source string per line from a file (or standard
+ * input) and creates, generates and tests "<source>.anagram" for each of them
+ * on a pool of threads. Items are dealt to the threads heaviest first by
+ * permutation count, and idle threads steal work from the busiest one, so a
+ * few huge sets and many tiny ones still finish together. Each list is checked
+ * against its checksums after generation ("anagram_verify"); the quadratic
+ * "anagram_test" runs only on request (-t).
+ */
+
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include "anagram.h"
+
+
+#define BATCH_LINE_LIMIT 256
+
+
+/*
+ * Basic Types
+ */
+
+
+struct item {
+	char *source;
+	int  permutations;  /* expected, used as the task cost */
+	int  line;
+};
+
+
+struct queue {
+	pthread_mutex_t mutex;
+	struct item     **items;  /* heaviest first */
+	int             head;     /* owner takes from the head */
+	int             tail;     /* thieves take from the tail */
+	long            load;     /* permutations still queued */
+};
+
+
+struct worker {
+	pthread_t thread;
+	int       id;
+	int       done;
+	int       stolen;
+	long      permutations;
+};
+
+
+/*
+ * Static Data
+ */
+
+
+static struct queue *queues;
+static int workers_count;
+static const char *directory = ".";
+static int verifying = 1;
+static int testing = 0;
+static pthread_mutex_t output_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int succeeded, failed;
+
+
+/*
+ * Static Function Interface
+ */
+
+
+static void *work(void *argument);
+static struct item *take(int id, int *stolen);
+static int process(struct item *item, long *permutations, char *status);
+static int compare(const void *a, const void *b);
+static int compare_sources(const void *a, const void *b);
+static float delta(struct timeval *b, struct timeval *a);
+
+
+int main(int argc, char *argv[])
+{
+
+	FILE *fp;
+	struct item *items, *next;
+	struct worker *workers;
+	struct timeval ti, tf;
+	char line[BATCH_LINE_LIMIT], *end;
+	long total;
+	int count, capacity, option, number, lightest, duplicates, i, j;
+
+	workers_count = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	while ((option = getopt(argc, argv, "j:d:nt")) != -1) {
+		switch (option) {
+		case 'j':
+			workers_count = atoi(optarg);
+			break;
+		case 'd':
+			directory = optarg;
+			break;
+		case 'n':
+			verifying = 0;
+			break;
+		case 't':
+			testing = 1;
+			break;
+		default:
+			printf("Usage: %s [-j THREADS] [-d DIRECTORY] [-n] [-t] [FILE]\n\n", argv[0]);
+			exit(EXIT_FAILURE);
+		}
+	}
+	if (workers_count < 1)
+		workers_count = 1;
+
+	/* open input */
+	fp = optind < argc ? fopen(argv[optind], "r") : stdin;
+	if (fp == NULL) {
+		printf("Error opening input file #%04d\n", errno);
+		exit(EXIT_FAILURE);
+	}
+
+	/* read source strings */
+	items = NULL;
+	count = 0, capacity = 0, number = 0;
+	while (fgets(line, BATCH_LINE_LIMIT, fp) != NULL) {
+		number++;
+		end = line + strcspn(line, "\r\n");
+		*end = '\0';
+		if (line[0] == '\0')
+			continue;
+		if (count == capacity) {
+			capacity = capacity > 0 ? capacity * 2 : 1024;
+			next = realloc(items, sizeof(struct item) * capacity);
+			if (next == NULL) {
+				printf("Error allocating memory #%04d\n", errno);
+				exit(EXIT_FAILURE);
+			}
+			items = next;
+		}
+		items[count].source = malloc(strlen(line) + 1);
+		if (items[count].source == NULL) {
+			printf("Error allocating memory #%04d\n", errno);
+			exit(EXIT_FAILURE);
+		}
+		strcpy(items[count].source, line);
+		/* invalid strings cost nothing; they fail as soon as they are run */
+		items[count].permutations = anagram_permutation_total(line);
+		if (items[count].permutations < 0)
+			items[count].permutations = 0;
+		items[count].line = number;
+		count++;
+	}
+	if (fp != stdin)
+		fclose(fp);
+
+	/* a repeated source would have two threads writing the same file */
+	qsort(items, count, sizeof(struct item), compare_sources);
+	for (i = 0, j = 0, duplicates = 0; i < count; i++) {
+		if (j > 0 && strcmp(items[i].source, items[j - 1].source) == 0) {
+			free(items[i].source);
+			duplicates++;
+			continue;
+		}
+		items[j++] = items[i];
+	}
+	count = j;
+
+	/* deal items heaviest first to the least loaded queue */
+	queues = calloc(workers_count, sizeof(struct queue));
+	workers = calloc(workers_count, sizeof(struct worker));
+	if (queues == NULL || workers == NULL) {
+		printf("Error allocating memory #%04d\n", errno);
+		exit(EXIT_FAILURE);
+	}
+	for (i = 0; i < workers_count; i++) {
+		pthread_mutex_init(&queues[i].mutex, NULL);
+		queues[i].items = malloc(sizeof(struct item *) * (count + 1));
+		if (queues[i].items == NULL) {
+			printf("Error allocating memory #%04d\n", errno);
+			exit(EXIT_FAILURE);
+		}
+	}
+	qsort(items, count, sizeof(struct item), compare);
+	total = 0;
+	for (i = 0; i < count; i++) {
+		for (j = 1, lightest = 0; j < workers_count; j++)
+			if (queues[j].load < queues[lightest].load)
+				lightest = j;
+		queues[lightest].items[queues[lightest].tail++] = &items[i];
+		queues[lightest].load += items[i].permutations;
+		total += items[i].permutations;
+	}
+
+	printf("%d source strings (%d duplicates skipped), %ld permutations, %d threads.\n\n",
+		count, duplicates, total, workers_count);
+
+	/* run */
+	gettimeofday(&ti, NULL);
+	for (i = 0; i < workers_count; i++) {
+		workers[i].id = i;
+		if (pthread_create(&workers[i].thread, NULL, work, &workers[i]) != 0) {
+			printf("Error creating thread #%04d\n", errno);
+			exit(EXIT_FAILURE);
+		}
+	}
+	for (i = 0; i < workers_count; i++)
+		pthread_join(workers[i].thread, NULL);
+	gettimeofday(&tf, NULL);
+
+	/* summary report */
+	printf("\n%d succeeded, %d failed in %0.4f seconds.\n", succeeded, failed, delta(&tf, &ti));
+	for (i = 0; i < workers_count; i++)
+		printf("\tthread %d: %d items (%d stolen), %ld permutations.\n",
+			i, workers[i].done, workers[i].stolen, workers[i].permutations);
+	putchar('\n');
+
+	for (i = 0; i < count; i++)
+		free(items[i].source);
+	for (i = 0; i < workers_count; i++) {
+		pthread_mutex_destroy(&queues[i].mutex);
+		free(queues[i].items);
+	}
+	free(items);
+	free(queues);
+	free(workers);
+
+	exit(failed > 0 ? EXIT_FAILURE : EXIT_SUCCESS);
+
+}
+
+
+/*
+ * Static Function Implementation
+ */
+
+
+static void *work(void *argument)
+{
+
+	struct worker *w = argument;
+	struct item *item;
+	struct timeval ti, tf;
+	char status[128];
+	long permutations;
+	int stolen, ok;
+
+	while ((item = take(w->id, &stolen)) != NULL) {
+
+		gettimeofday(&ti, NULL);
+		permutations = 0;
+		ok = process(item, &permutations, status);
+		gettimeofday(&tf, NULL);
+
+		w->done++;
+		w->stolen += stolen;
+		w->permutations += permutations;
+
+		pthread_mutex_lock(&output_mutex);
+		if (ok)
+			succeeded++;
+		else
+			failed++;
+		printf("%s\t%d\t%s\t%ld\t%0.4f\n", ok ? "OK" : "ERR", item->line,
+			item->source, permutations, delta(&tf, &ti));
+		if (!ok)
+			printf("\t%s\n", status);
+		pthread_mutex_unlock(&output_mutex);
+
+	}
+
+	return NULL;
+
+}
+
+
+static struct item *take(int id, int *stolen)
+{
+
+	struct queue *q;
+	struct item *item;
+	long load;
+	int victim, i;
+
+	/* own queue first, heaviest item */
+	q = &queues[id];
+	pthread_mutex_lock(&q->mutex);
+	item = NULL;
+	if (q->head < q->tail) {
+		item = q->items[q->head++];
+		q->load -= item->permutations;
+	}
+	pthread_mutex_unlock(&q->mutex);
+
+	*stolen = 0;
+	if (item != NULL)
+		return item;
+
+	/* steal the lightest item of the most loaded queue; loads may change
+	 * between the survey and the theft, which only makes the choice stale */
+	for (;;) {
+		victim = -1, load = -1;
+		for (i = 0; i < workers_count; i++) {
+			if (i == id)
+				continue;
+			q = &queues[i];
+			pthread_mutex_lock(&q->mutex);
+			if (q->head < q->tail && q->load > load) {
+				victim = i;
+				load = q->load;
+			}
+			pthread_mutex_unlock(&q->mutex);
+		}
+		if (victim < 0)
+			return NULL;
+		q = &queues[victim];
+		pthread_mutex_lock(&q->mutex);
+		if (q->head < q->tail) {
+			item = q->items[--q->tail];
+			q->load -= item->permutations;
+		}
+		pthread_mutex_unlock(&q->mutex);
+		if (item != NULL) {
+			*stolen = 1;
+			return item;
+		}
+	}
+
+}
+
+
+static int process(struct item *item, long *permutations, char *status)
+{
+
+	anagram_ref anagram;
+	char *path;
+	int errn;
+
+	/* sources name files in "directory" and must stay there */
+	if (strchr(item->source, '/') != NULL || strstr(item->source, "..") != NULL) {
+		sprintf(status, "Error invalid source string #%04d", EINVAL);
+		return 0;
+	}
+
+	path = malloc(strlen(directory) + strlen(item->source) + 10);
+	if (path == NULL) {
+		sprintf(status, "Error allocating memory #%04d", errno);
+		return 0;
+	}
+	sprintf(path, "%s/%s.anagram", directory, item->source);
+
+	/* open existing file (resuming it if incomplete) or create a new one */
+	anagram = anagram_open(path);
+	if (anagram == NULL && errno == ENOENT)
+		anagram = anagram_create(path, item->source);
+	if (anagram == NULL) {
+		sprintf(status, "Error initializing anagram file #%04d", errno);
+		free(path);
+		return 0;
+	}
+	free(path);
+
+	if (!anagram_generate(anagram, NULL, NULL)) {
+		sprintf(status, "Error generating permutations #%04d", errno);
+		goto failure;
+	}
+
+	/* files written before checksums existed cannot be verified */
+	if (verifying && !anagram_verify(anagram) && errno != ENOTSUP) {
+		sprintf(status, "Error verifying anagram #%04d", errno);
+		goto failure;
+	}
+
+	if (testing && anagram_permutation_count(anagram) > 1
+		&& !anagram_test(anagram, NULL, NULL)) {
+		sprintf(status, "Error testing anagram #%04d", errno);
+		goto failure;
+	}
+
+	*permutations = anagram_permutation_count(anagram);
+	anagram_release(anagram);
+
+	return 1;
+
+	failure:
+		errn = errno;
+		anagram_release(anagram);
+		errno = errn;
+		return 0;
+
+}
+
+
+static int compare(const void *a, const void *b)
+{
+
+	const struct item *x = a, *y = b;
+
+	if (x->permutations != y->permutations)
+		return x->permutations > y->permutations ? -1 : 1;
+
+	return x->line - y->line;
+
+}
+
+
+static int compare_sources(const void *a, const void *b)
+{
+
+	const struct item *x = a, *y = b;
+	int c;
+
+	/* the first line of a repeated source is kept */
+	if ((c = strcmp(x->source, y->source)) != 0)
+		return c;
+
+	return x->line - y->line;
+
+}
+
+
+static float delta(struct timeval *b, struct timeval *a) {
+	float dt = (b->tv_sec - a->tv_sec) + (b->tv_usec / 1000000.0f) - (a->tv_usec / 1000000.0f);
+	return 	dt;
+}
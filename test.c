@@ -4,14 +4,33 @@
 #include <string.h>
 #include <sys/time.h>
 #include "anagram.h"
+#include "anagram_cache.h"
+#include "anagram_store.h"
+#include "anagram_phrase.h"
 
 float delta(struct timeval *b, struct timeval *a);
 int cb(void *argument, int count, const char *anagram);
+int until(void *argument, int count, const char *anagram);
+int checks(void);
+int check_cursor(void);
+int check_top(void);
+int check_phrase(void);
+int check_classify(void);
+int check_store(void);
+int check_sub(void);
+int check_compact(void);
+int check_index(void);
+int check_shards(void);
+int check_sample(void);
+int check_lazy(void);
+int check_cache(void);
+int check(int condition, const char *what);
 
 int main(int argc, char *argv[])
 {
 
 	FILE *fp;
+	anagram_stats st;
 	struct timeval ti, tf;
 	float dt;
 	anagram_ref anagram;
@@ -30,6 +49,9 @@ int main(int argc, char *argv[])
 		exit(EXIT_FAILURE);
 	}
 
+	/* collect phase timings */
+	anagram_stats_timing(1);
+
 	/* build anagram path */
 	sprintf(buf, "%s.anagram", argv[1]);
 
@@ -134,11 +156,11 @@ int main(int argc, char *argv[])
 
 	/* write file */
 	gettimeofday(&ti, NULL);
-	for (i = 0, c = anagram_count(anagram); i < c; i++)
-		if (fprintf(fp, "%07d. %s\n", i + 1, anagram_string(anagram, i)) < 0) {
-			printf("Error writing permutation to file #%04d\n", errno);
-			exit(EXIT_FAILURE);
-		}
+	fflush(fp);
+	if ((i = anagram_export(anagram, fileno(fp), ANAGRAM_EXPORT_NUMBERED)) < 0) {
+		printf("Error writing permutations to file #%04d\n", errno);
+		exit(EXIT_FAILURE);
+	}
 	gettimeofday(&tf, NULL);
 	dt = delta(&tf, &ti);
 	printf("\t%d permutations written to text file in %0.4f seconds.\n\n", i, dt);
@@ -157,6 +179,23 @@ int main(int argc, char *argv[])
 		printf("...Result reset from %d to %d permutations.\n\n", i, c);
 	}
 
+	/* library behaviour checks, on objects of their own */
+	printf("%d. Checking library behaviour...\n", seq++);
+	if (!checks()) {
+		printf("Error checking library behaviour\n");
+		exit(EXIT_FAILURE);
+	}
+	puts("\tAll checks passed.\n");
+
+	/* print statistics */
+	if (anagram_get_stats(anagram, &st)) {
+		printf("%d. Statistics...\n", seq++);
+		printf("\t%lu seeks, %lu reads (%lu bytes), %lu writes (%lu bytes), %lu syncs.\n",
+			st.seeks, st.reads, st.bytes_read, st.writes, st.bytes_written, st.syncs);
+		printf("\tpermute %0.4fs, encode %0.4fs, I/O %0.4fs, callbacks %0.4fs (%lu calls).\n\n",
+			st.permute_time, st.encode_time, st.io_time, st.callback_time, st.callbacks);
+	}
+
 	/* release anagram object */
 	anagram_release(anagram);
 
@@ -177,3 +216,515 @@ float delta(struct timeval *b, struct timeval *a) {
 int cb(void *argument, int count, const char *anagram) {
 	return 1;
 }
+
+int until(void *argument, int count, const char *anagram) {
+	return count < *(int *)argument;
+}
+
+int checks(void) {
+
+	FILE *fp;
+	anagram_ref a, r;
+	int c, ok = 1;
+
+	/* no arrangement of "aab" leaves every element off its place */
+	a = anagram_create_memory("aab");
+	ok &= check(a != NULL && anagram_generate_constrained(a, 0, NULL, cb), "generating an empty constrained list");
+	ok &= check(anagram_is_complete(a) && anagram_permutation_count(a) == 0, "completing an empty constrained list");
+	anagram_release(a);
+
+	/* prefix matches are one run in lexicographic order only */
+	a = anagram_create_memory("abcde");
+	ok &= check(a != NULL && anagram_generate(a, NULL, NULL), "generating a lexicographic list");
+	ok &= check(anagram_filter(a, "b") == 24 && anagram_count(a) == 24, "filtering a lexicographic list");
+	anagram_release(a);
+	a = anagram_create_memory("abcde");
+	ok &= check(a != NULL && anagram_generate_gray(a, NULL, NULL), "generating a minimal-change list");
+	errno = 0;
+	ok &= check(anagram_filter(a, "b") < 0 && errno == EINVAL, "rejecting a filter on a minimal-change list");
+	ok &= check(anagram_filter(a, "") == 120, "resetting a minimal-change list");
+	anagram_release(a);
+
+	/* a reader follows what a generation cancelled midway has published */
+	remove("check.anagram");
+	anagram_release(anagram_create("check.anagram", "abcd"));
+	a = anagram_open("check.anagram");
+	c = 12;
+	ok &= check(a != NULL && anagram_generate(a, &c, until), "generating a partial list");
+	r = anagram_open("check.anagram");
+	ok &= check(r != NULL && anagram_wait(r, 12, 1000) >= 12, "waiting for published permutations");
+	ok &= check(anagram_count(r) == anagram_permutation_count(a) && strcmp(anagram_string(r, 11), anagram_string(a, 11)) == 0, "reading published permutations");
+	errno = 0;
+	ok &= check(anagram_wait(r, 24, 10) < 0 && errno == ETIMEDOUT, "timing out on a stalled list");
+	errno = 0;
+	ok &= check(anagram_refresh(a) < 0 && errno == EBUSY, "refusing to refresh a list being generated");
+	anagram_release(r);
+	anagram_release(a);
+	remove("check.anagram");
+
+	/* the second record is a null byte, then a known marker or zeros */
+	for (c = -8; c <= -5; c += 3) {
+		anagram_release(anagram_create("check.anagram", "abcd"));
+		fp = fopen("check.anagram", "r+b");
+		ok &= check(fp != NULL && fseek(fp, (long)c, SEEK_END) == 0 && fputc('x', fp) == 'x' && fclose(fp) == 0, "corrupting a control record");
+		errno = 0;
+		ok &= check(anagram_open("check.anagram") == NULL && errno == EBADF, "rejecting a corrupt control record");
+		remove("check.anagram");
+	}
+
+	/* checksums catch a flipped byte in a permutation record */
+	a = anagram_create("check.anagram", "abcde");
+	ok &= check(a != NULL && anagram_generate(a, NULL, NULL), "generating a checksummed list");
+	anagram_release(a);
+	a = anagram_open("check.anagram");
+	ok &= check(a != NULL && anagram_verify(a), "verifying an intact list");
+	anagram_release(a);
+	fp = fopen("check.anagram", "r+b");
+	ok &= check(fp != NULL && fseek(fp, -1L, SEEK_END) == 0 && fputc('x', fp) == 'x' && fclose(fp) == 0, "corrupting a permutation record");
+	a = anagram_open("check.anagram");
+	errno = 0;
+	ok &= check(a != NULL && !anagram_verify(a) && errno == EILSEQ, "detecting a corrupt permutation record");
+	anagram_release(a);
+	remove("check.anagram");
+
+	ok &= check_cursor();
+	ok &= check_top();
+	ok &= check_phrase();
+	ok &= check_classify();
+	ok &= check_store();
+	ok &= check_sub();
+	ok &= check_compact();
+	ok &= check_index();
+	ok &= check_shards();
+	ok &= check_sample();
+	ok &= check_lazy();
+	ok &= check_cache();
+
+	return ok;
+
+}
+
+int check_cursor(void) {
+
+	anagram_ref a;
+	anagram_cursor_ref cursor;
+	const char *string = NULL;
+	int c, ok = 1;
+
+	/* a cursor steps through the same list as generation */
+	a = anagram_create_memory("abcd");
+	ok &= check(a != NULL && anagram_generate(a, NULL, NULL), "generating a list to step through");
+	cursor = anagram_cursor_create("abcd", 5);
+	ok &= check(cursor != NULL && anagram_cursor_rank(cursor) == 5, "creating a cursor");
+	for (c = 5; cursor != NULL && (string = anagram_cursor_next(cursor)) != NULL; c++)
+		if (c >= 24 || strcmp(string, anagram_string(a, c)) != 0)
+			break;
+	ok &= check(cursor != NULL && c == 24 && string == NULL && anagram_cursor_rank(cursor) == 24, "stepping through a list with a cursor");
+	anagram_cursor_release(cursor);
+	anagram_release(a);
+
+	errno = 0;
+	ok &= check(anagram_cursor_create("abcd", 24) == NULL && errno == ERANGE, "rejecting a cursor past the list");
+
+	return ok;
+
+}
+
+int check_top(void) {
+
+	anagram_ref a;
+	anagram_weights weights;
+	double position[9], scores[2];
+	int ranks[2], c, ok = 1;
+
+	/* with one point per element in its sorted place, "abc" scores 3 and
+	 * "acb", the first of the three scoring 1, comes next */
+	for (c = 0; c < 9; c++)
+		position[c] = c % 4 == 0;
+	weights.bigram = NULL;
+	weights.position = position;
+	a = anagram_create_memory("abc");
+	ok &= check(a != NULL && anagram_top(a, &weights, 2, ranks, scores, NULL, NULL) == 2
+		&& ranks[0] == 0 && scores[0] == 3.0 && ranks[1] == 1 && scores[1] == 1.0, "finding the best scoring permutations");
+	ok &= check(anagram_top(a, &weights, 10, NULL, NULL, NULL, NULL) == 6, "finding fewer permutations than asked");
+	anagram_release(a);
+
+	return ok;
+
+}
+
+int check_phrase(void) {
+
+	anagram_phrase_ref phrase;
+	int ok = 1;
+
+	/* phrases of dictionary words, each found once */
+	phrase = anagram_phrase_create(NULL);
+	ok &= check(phrase != NULL && anagram_phrase_add(phrase, "dirty") == 1
+		&& anagram_phrase_add(phrase, "room") == 2 && anagram_phrase_add(phrase, "dormitory") == 3, "building a phrase dictionary");
+	ok &= check(anagram_phrase_solve(phrase, "dormitory", 0, 1, NULL, cb) == 2, "solving phrases");
+	ok &= check(anagram_phrase_solve(phrase, "dormitory", 0, 2, NULL, cb) == 2, "solving phrases on threads");
+	ok &= check(anagram_phrase_solve(phrase, "dormitory", 1, 1, NULL, cb) == 1, "solving one-word phrases");
+	ok &= check(anagram_phrase_solve(phrase, "roomy", 0, 1, NULL, cb) == 0, "solving a source without phrases");
+	anagram_phrase_release(phrase);
+
+	return ok;
+
+}
+
+int check_classify(void) {
+
+	static const char *const candidates[] = { "silent", "google", NULL, "tinsel" };
+	anagram_ref a;
+	char results[4];
+	int ranks[4], ok = 1;
+
+	/* candidates are told apart by their elements alone */
+	a = anagram_create_memory("listen");
+	ok &= check(a != NULL && anagram_generate(a, NULL, NULL), "generating a list to classify against");
+	ok &= check(anagram_classify(a, candidates, 4, results, ranks) == 2
+		&& results[0] && !results[1] && !results[2] && results[3]
+		&& ranks[0] == anagram_rank(a, "silent") && ranks[1] == -1 && ranks[2] == -1
+		&& ranks[3] == anagram_rank(a, "tinsel"), "classifying candidates");
+	anagram_release(a);
+
+	return ok;
+
+}
+
+int check_store(void) {
+
+	anagram_store_ref store;
+	anagram_ref a;
+	char source[8];
+	int i, found, ok = 1;
+
+	/* more sets than an index page holds chain a second page */
+	remove("check.store");
+	store = anagram_store_open("check.store", 1);
+	ok &= check(store != NULL, "creating a store");
+	for (i = 0; store != NULL && i < 130; i++) {
+		sprintf(source, "s%03d", i);
+		a = anagram_create_memory(source);
+		ok &= check(a != NULL && anagram_generate(a, NULL, NULL) && anagram_store_append(store, a), "appending to a store");
+		anagram_release(a);
+	}
+	errno = 0;
+	a = anagram_create_memory("s000");
+	ok &= check(!anagram_store_append(store, a) && errno == EEXIST, "refusing a stored source");
+	anagram_release(a);
+	anagram_store_close(store);
+
+	/* every set is found again after reopening */
+	store = anagram_store_open("check.store", 0);
+	ok &= check(store != NULL && anagram_store_count(store) == 130, "reopening a store");
+	for (i = 0, found = 0; store != NULL && i < 130; i++) {
+		sprintf(source, "s%03d", i);
+		a = anagram_lookup(store, source);
+		if (a != NULL && anagram_is_complete(a) && anagram_count(a) == anagram_permutation_total(source)
+			&& strcmp(anagram_source_string(a), source) == 0)
+			found++;
+		anagram_release(a);
+	}
+	ok &= check(found == 130, "looking up every stored set");
+	errno = 0;
+	ok &= check(anagram_lookup(store, "s999") == NULL && errno == ENOENT, "looking up a missing set");
+	anagram_store_close(store);
+	remove("check.store");
+
+	return ok;
+
+}
+
+int check_sub(void) {
+
+	anagram_sub_ref sub;
+	char previous[8];
+	const char *string;
+	int c, i, ordered, ok = 1;
+
+	/* arrangements of 1, 2 and 6 or more elements of "banana" */
+	ok &= check(anagram_sub_total("banana", 1) == 188 && anagram_sub_total("banana", 2) == 185
+		&& anagram_sub_total("banana", 6) == 60, "counting sub-anagrams");
+
+	/* generation cancelled midway is resumed after reopening */
+	remove("check.sub");
+	sub = anagram_sub_create("check.sub", "banana", 2);
+	c = 50;
+	ok &= check(sub != NULL && anagram_sub_generate(sub, &c, until) && anagram_sub_count(sub) == 50
+		&& !anagram_sub_is_complete(sub), "generating part of a sub-anagram list");
+	errno = 0;
+	ok &= check(anagram_sub_string(sub, 0) == NULL && errno == EAGAIN, "refusing to index a partial sub-anagram list");
+	anagram_sub_release(sub);
+	sub = anagram_sub_open("check.sub");
+	ok &= check(sub != NULL && anagram_sub_count(sub) == 50 && !anagram_sub_is_complete(sub), "reopening a partial sub-anagram list");
+	ok &= check(anagram_sub_generate(sub, NULL, NULL) && anagram_sub_count(sub) == 185
+		&& anagram_sub_is_complete(sub), "resuming a sub-anagram list");
+	anagram_sub_release(sub);
+
+	/* records come back through the rank index in lexicographic order, each
+	 * at the rank computed from the source alone */
+	sub = anagram_sub_open("check.sub");
+	ok &= check(sub != NULL && anagram_sub_is_complete(sub), "reopening a complete sub-anagram list");
+	previous[0] = '\0';
+	for (i = 0, ordered = 0; sub != NULL && i < 185 && (string = anagram_sub_string(sub, i)) != NULL; i++) {
+		if (strcmp(previous, string) < 0 && anagram_sub_rank(sub, string) == i)
+			ordered++;
+		strcpy(previous, string);
+	}
+	ok &= check(ordered == 185, "reading a sub-anagram list in rank order");
+	ok &= check(strcmp(anagram_sub_string(sub, 0), "aa") == 0 && strcmp(anagram_sub_string(sub, 99), "ban") == 0
+		&& strcmp(anagram_sub_string(sub, 104), "banana") == 0, "looking up sub-anagrams by rank");
+	errno = 0;
+	ok &= check(anagram_sub_rank(sub, "bab") < 0 && errno == EINVAL, "ranking a string with missing elements");
+	errno = 0;
+	ok &= check(anagram_sub_string(sub, 185) == NULL && errno == ERANGE, "rejecting a rank past a sub-anagram list");
+	anagram_sub_release(sub);
+	remove("check.sub");
+
+	return ok;
+
+}
+
+int check_compact(void) {
+
+	anagram_ref a, compact;
+	int i, same, ok = 1;
+
+	/* a list that cannot be saved until it is complete */
+	a = anagram_create_memory("abcdef");
+	errno = 0;
+	ok &= check(a != NULL && !anagram_save_compact(a, "check.compact") && errno == EAGAIN, "refusing to compact a partial list");
+
+	/* every record survives front coding, across many blocks */
+	ok &= check(anagram_generate(a, NULL, NULL) && anagram_save_compact(a, "check.compact"), "saving a compact list");
+	compact = anagram_open_compact("check.compact");
+	ok &= check(compact != NULL && anagram_is_complete(compact) && anagram_count(compact) == 720, "opening a compact list");
+	for (i = 0, same = 0; compact != NULL && i < 720; i++)
+		if (strcmp(anagram_string(compact, 719 - i), anagram_string(a, 719 - i)) == 0)
+			same++;
+	ok &= check(same == 720, "reading a compact list");
+
+	/* binary search through the block keys */
+	ok &= check(anagram_find(compact, "abcdef") == 0 && anagram_find(compact, "fedcba") == 719
+		&& anagram_find(compact, "cafebd") == anagram_find(a, "cafebd") && anagram_find(a, "cafebd") > 0, "finding stored strings");
+	errno = 0;
+	ok &= check(anagram_find(compact, "abcdeg") < 0 && errno == ENOENT, "missing an absent string");
+
+	/* the io layer serves filters and tests unchanged */
+	ok &= check(anagram_filter(compact, "ca") == 24 && strcmp(anagram_string(compact, 0), "cabdef") == 0, "filtering a compact list");
+	ok &= check(anagram_filter(compact, NULL) == 720 && anagram_test(compact, NULL, cb), "testing a compact list");
+	anagram_release(compact);
+	anagram_release(a);
+	remove("check.compact");
+
+	return ok;
+
+}
+
+int check_index(void) {
+
+	anagram_ref a;
+	anagram_index_ref index;
+	anagram_condition conditions[11];
+	int ranks[4], count, first, ok = 1;
+
+	/* over five chunks of records, with runs and bitmaps */
+	a = anagram_create_memory("abcdefghi");
+	ok &= check(a != NULL && anagram_generate(a, NULL, NULL), "generating a list to index");
+	remove("check.index");
+	ok &= check(anagram_index_build(a, "check.index"), "building a position index");
+	index = anagram_index_open("check.index");
+	ok &= check(index != NULL && anagram_index_count(index) == 362880, "opening a position index");
+
+	/* a prefix query matches the prefix filter */
+	conditions[0].position = 0, conditions[0].element = "c", conditions[0].negate = 0;
+	conditions[1].position = 1, conditions[1].element = "a", conditions[1].negate = 0;
+	count = anagram_filter(a, "ca");
+	first = anagram_rank(a, anagram_string(a, 0));
+	ok &= check(anagram_index_query(index, conditions, 2, ranks, 4) == count && count == 5040
+		&& ranks[0] == first && ranks[3] == first + 3, "querying a prefix");
+	anagram_filter(a, NULL);
+
+	/* negated sets and positions counted from the end */
+	conditions[0].element = "ab", conditions[0].negate = 1;
+	ok &= check(anagram_index_query(index, conditions, 1, NULL, 0) == 362880 - 2 * 40320, "querying a negated condition");
+	conditions[0].position = -1, conditions[0].element = "a", conditions[0].negate = 0;
+	count = anagram_index_query(index, conditions, 1, ranks, 1);
+	conditions[0].position = 8;
+	ok &= check(count == 40320 && anagram_index_query(index, conditions, 1, NULL, 0) == count
+		&& anagram_string(a, ranks[0])[8] == 'a', "querying from the end");
+
+	/* more conditions than elements (the limit is at most 10) */
+	for (count = 0; count <= anagram_element_limit(); count++)
+		conditions[count] = conditions[0];
+	errno = 0;
+	ok &= check(anagram_index_query(index, conditions, count, NULL, 0) < 0
+		&& errno == EINVAL, "rejecting too many conditions");
+
+	anagram_index_release(index);
+	anagram_release(a);
+	remove("check.index");
+
+	return ok;
+
+}
+
+int check_shards(void) {
+
+	anagram_ref a, full, list;
+	int c, i, same, ok = 1;
+
+	remove("check.manifest");
+	remove("check.shard0");
+	remove("check.shard1");
+	full = anagram_create_memory("abcde");
+	ok &= check(full != NULL && anagram_generate(full, NULL, NULL), "generating a full list");
+
+	/* the first shard in one pass */
+	a = anagram_create("check.shard0", "abcde");
+	ok &= check(a != NULL && anagram_generate_range(a, 0, 50, NULL, NULL) && anagram_is_complete(a)
+		&& anagram_count(a) == 50, "generating a shard");
+	ok &= check(anagram_manifest_add("check.manifest", a, "check.shard0"), "adding a shard to a manifest");
+	anagram_release(a);
+
+	/* the second shard cancelled, reopened and resumed */
+	a = anagram_create("check.shard1", "abcde");
+	c = 20;
+	ok &= check(a != NULL && anagram_generate_range(a, 50, -1, &c, until) && !anagram_is_complete(a)
+		&& anagram_count(a) == 20, "generating part of a shard");
+	errno = 0;
+	ok &= check(!anagram_manifest_add("check.manifest", a, "check.shard1") && errno == EAGAIN, "refusing a partial shard");
+	anagram_release(a);
+	a = anagram_open("check.shard1");
+	errno = 0;
+	ok &= check(a != NULL && !anagram_generate_range(a, 40, -1, NULL, NULL) && errno == EINVAL, "refusing to resume another range");
+	ok &= check(anagram_generate_range(a, 50, -1, NULL, NULL) && anagram_is_complete(a)
+		&& anagram_count(a) == 70, "resuming a shard");
+	ok &= check(anagram_manifest_add("check.manifest", a, "check.shard1"), "adding a resumed shard to a manifest");
+	anagram_release(a);
+
+	/* the shards read through the manifest match the full list */
+	list = anagram_open_manifest("check.manifest");
+	ok &= check(list != NULL && anagram_is_complete(list) && anagram_count(list) == 120, "opening a manifest");
+	for (i = 0, same = 0; list != NULL && i < 120; i++)
+		if (strcmp(anagram_string(list, i), anagram_string(full, i)) == 0)
+			same++;
+	ok &= check(same == 120, "reading shards through a manifest");
+	anagram_release(list);
+	anagram_release(full);
+	remove("check.manifest");
+	remove("check.shard0");
+	remove("check.shard1");
+
+	return ok;
+
+}
+
+int check_sample(void) {
+
+	anagram_ref a;
+	int ranks[120], seen[120];
+	int i, all, increasing, ok = 1;
+
+	/* drawing every permutation of an ungenerated list returns each rank once */
+	a = anagram_create_memory("abcde");
+	memset(seen, 0, sizeof(seen));
+	ok &= check(a != NULL && anagram_sample(a, 120, 7, 0, ranks, NULL, NULL) == 120, "drawing a full sample");
+	for (i = 0, all = 0; i < 120; i++)
+		if (ranks[i] >= 0 && ranks[i] < 120 && seen[ranks[i]]++ == 0)
+			all++;
+	ok &= check(all == 120, "drawing every rank once");
+
+	/* sorted draws come back strictly increasing */
+	ok &= check(anagram_sample(a, 30, 11, 1, ranks, NULL, NULL) == 30, "drawing a sorted sample");
+	for (i = 1, increasing = ranks[0] >= 0; i < 30; i++)
+		if (ranks[i] <= ranks[i - 1] || ranks[i] >= 120)
+			increasing = 0;
+	ok &= check(increasing, "sorting a sample");
+	errno = 0;
+	ok &= check(anagram_sample(a, 121, 7, 0, ranks, NULL, NULL) < 0 && errno == ERANGE, "rejecting a sample larger than the list");
+	anagram_release(a);
+
+	return ok;
+
+}
+
+int check_lazy(void) {
+
+	anagram_ref a, full;
+	char string[8];
+	int i, same, ok = 1;
+
+	remove("check.lazy");
+	full = anagram_create_memory("abcdef");
+	ok &= check(full != NULL && anagram_generate(full, NULL, NULL), "generating an eager list");
+
+	/* reads just past the frontier extend generation by the look-ahead */
+	a = anagram_create("check.lazy", "abcdef");
+	ok &= check(a != NULL && anagram_set_lazy(a, 10) == 0, "enabling lazy reads");
+	ok &= check(anagram_string(a, 5) != NULL && strcmp(anagram_string(a, 5), anagram_string(full, 5)) == 0
+		&& anagram_permutation_count(a) == 16, "extending a list to a read");
+	strcpy(string, anagram_string(a, 20));
+	ok &= check(strcmp(string, anagram_string(full, 20)) == 0 && anagram_permutation_count(a) == 31, "extending a list past its frontier");
+
+	/* reads far past it are unranked without generating anything */
+	strcpy(string, anagram_string(a, 500));
+	ok &= check(strcmp(string, anagram_string(full, 500)) == 0 && anagram_permutation_count(a) == 31
+		&& !anagram_is_complete(a), "unranking far past the frontier");
+	anagram_release(a);
+
+	/* the lazily generated records are durable and intact */
+	a = anagram_open("check.lazy");
+	ok &= check(a != NULL && anagram_permutation_count(a) == 31 && anagram_verify(a), "verifying a lazily generated list");
+	ok &= check(anagram_generate(a, NULL, NULL) && anagram_is_complete(a), "completing a lazily generated list");
+	for (i = 0, same = 0; a != NULL && i < 720; i++)
+		if (strcmp(anagram_string(a, i), anagram_string(full, i)) == 0)
+			same++;
+	ok &= check(same == 720, "matching an eagerly generated list");
+	anagram_release(a);
+	anagram_release(full);
+	remove("check.lazy");
+
+	return ok;
+
+}
+
+int check_cache(void) {
+
+	anagram_cache_ref cache;
+	anagram_ref a, b, c;
+	int ok = 1;
+
+	/* sources with the same letters share one list and keep their own string */
+	cache = anagram_cache_create(NULL);
+	a = anagram_cache_get(cache, "listen");
+	b = anagram_cache_get(cache, "silent");
+	ok &= check(a != NULL && b != NULL && anagram_cache_count(cache) == 1, "sharing a cached list");
+	ok &= check(strcmp(anagram_source_string(a), "listen") == 0 && strcmp(anagram_source_string(b), "silent") == 0,
+		"keeping each source string");
+	ok &= check(anagram_count(a) == 720 && anagram_count(b) == 720
+		&& strcmp(anagram_string(a, 100), anagram_string(b, 100)) == 0, "reading a shared list");
+	c = anagram_cache_get(cache, "banana");
+	ok &= check(c != NULL && anagram_cache_count(cache) == 2 && anagram_count(c) == 60, "caching another list");
+
+	/* an alias needs the same elements as the list it reads */
+	errno = 0;
+	ok &= check(anagram_alias(c, "bananas") == NULL && errno == EINVAL, "rejecting an alias of other elements");
+
+	/* objects outlive the cache */
+	anagram_cache_release(cache);
+	ok &= check(strcmp(anagram_string(b, 0), "eilnst") == 0, "reading a list after releasing the cache");
+	anagram_release(a);
+	anagram_release(b);
+	anagram_release(c);
+
+	return ok;
+
+}
+
+int check(int condition, const char *what) {
+	if (!condition)
+		printf("\tCheck failed: %s (errno %d).\n", what, errno);
+	return condition;
+}